@@ -0,0 +1,43 @@
+#ifndef ANALYTICS_HH
+#define ANALYTICS_HH
+
+#include "history.hh"
+
+#include <cstdint>
+
+/**
+ * Live move and outcome analytics across every match the process plays.
+ * Each thread counts into its own cache-line aligned block with plain
+ * relaxed stores, so recording a move is a few uncontended increments;
+ * readers merge every block into a snapshot
+ */
+
+namespace analytics {
+
+// Merged counters
+struct Snapshot {
+	// Moves applied, and how often each cell was played
+	uint64_t moves;
+	uint64_t cells[9];
+	// How often each cell was the opening move
+	uint64_t opening[9];
+	// Finished matches by outcome (indexed by Outcome), overall and by
+	// opening move
+	uint64_t outcomes[3];
+	uint64_t by_opening[9][3];
+	// Total moves over every finished match
+	uint64_t length_sum;
+};
+
+// Count a move on cell `pos` (0-8) as the `ply`-th move of its match
+void record_move(int pos, int ply);
+// Count a finished match with its opening cell (-1 if no move was made)
+// and length
+void record_result(Outcome outcome, int opening, int moves);
+
+// Merge every thread's counters
+Snapshot snapshot();
+
+} // namespace analytics
+
+#endif
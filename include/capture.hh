@@ -0,0 +1,101 @@
+#ifndef CAPTURE_HH
+#define CAPTURE_HH
+
+#include "protocol.hh"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Wire-level traffic capture. Every frame a session receives or queues is
+ * copied, with its connection id and a CLOCK_MONOTONIC timestamp, into a
+ * per-thread lock-free ring; a background thread drains the rings into the
+ * capture file in time order. A full ring drops the record rather than
+ * blocking the session, and with capture off a record costs one relaxed
+ * load
+ */
+
+namespace capture {
+
+enum class Dir : uint8_t {
+	// Frame received from the client
+	IN,
+	// Frame queued for the client
+	OUT,
+	// Connection accepted / closed (no frame)
+	OPEN,
+	CLOSE,
+	// A server process started capturing into the file; connection ids
+	// restart after it
+	EPOCH
+};
+
+// On-disk record, followed by `len` frame bytes
+struct Record {
+	uint64_t ts_ns;
+	uint32_t conn;
+	uint16_t len;
+	Dir dir;
+	uint8_t reserved;
+};
+static_assert(sizeof(Record) == 16);
+
+// Runtime switch, set by open()
+extern std::atomic<bool> enabled;
+
+// Open (creating if needed) a capture file for appending and start the
+// writer thread. Returns false on error
+bool open(const std::string& path);
+// Write out everything recorded so far
+void flush();
+// Records dropped because a ring was full
+uint64_t dropped();
+
+// Id for a new connection, never 0
+uint32_t new_conn();
+
+// Append a record to the calling thread's ring: one frame, given whole or
+// as header + payload, or an event with no frame
+void write(uint32_t conn, Dir dir, const uint8_t* frame, size_t len);
+void write(uint32_t conn, Dir dir, const TTT_PROTO::MsgHeader& hdr,
+		   const uint8_t* payload);
+
+// Record if capture is on. Cheap enough for the hot path
+inline void record(uint32_t conn, Dir dir, const uint8_t* frame, size_t len) {
+	if (enabled.load(std::memory_order_relaxed))
+		write(conn, dir, frame, len);
+}
+inline void record(uint32_t conn, Dir dir, const TTT_PROTO::MsgHeader& hdr,
+				   const uint8_t* payload) {
+	if (enabled.load(std::memory_order_relaxed))
+		write(conn, dir, hdr, payload);
+}
+inline void record(uint32_t conn, Dir dir) { record(conn, dir, nullptr, 0); }
+
+// Read-only view of a capture file
+class Reader {
+  public:
+	Reader() = default;
+	~Reader();
+
+	Reader(const Reader&) = delete;
+	Reader& operator=(const Reader&) = delete;
+
+	// Map a capture file. Returns false on error
+	bool open(const std::string& path);
+
+	// Next record in file order, pointing `frame` at its bytes. Returns
+	// false at the end of the file or on a truncated record
+	bool next(Record& rec, const uint8_t*& frame);
+
+  private:
+	const uint8_t* m_map = nullptr;
+	size_t m_size = 0;
+	size_t m_pos = 0;
+};
+
+} // namespace capture
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef EVENTLOG_HH
+#define EVENTLOG_HH
+
+#include "protocol.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bounded log of the current match's move events and result, kept so a
+ * reconnecting client can be sent only the events it missed. Entries are
+ * stored with the sequence number in host byte order. Sequence numbers keep
+ * counting (and wrap) across the matches on one pair of seats, so a number
+ * seen in an earlier match is never mistaken for one in the current match.
+ * Trivially copyable, so it travels inside the hot restart state as-is
+ */
+class EventLog {
+  public:
+	// Events kept; older ones are overwritten
+	static constexpr size_t CAP = 16;
+
+	// Record a move by `player` (1 or 2) and return its sequence number.
+	// The first event ever logged is 1
+	uint16_t append(uint8_t pos, uint8_t player);
+	// Sequence number of the latest event, 0 if there is none
+	uint16_t seq() const { return m_seq; }
+	// Append the events after `last_seq` to `out`, oldest first. Returns
+	// false (leaving `out` untouched) if some of them were overwritten, or
+	// `last_seq` is ahead of the log or before the current match
+	bool since(uint16_t last_seq, std::vector<TTT_PROTO::PL_MoveEvent>& out) const;
+	// Record the result of the current match: the winner (1 or 2), or 0 for
+	// a draw
+	void finish(uint8_t winner) { m_result = int8_t(winner); }
+	// Result of the current match as given to finish(), or -1 while it is
+	// still being played
+	int result() const { return m_result; }
+	// Start a new match: events logged so far can no longer be replayed
+	void clear();
+
+  private:
+	TTT_PROTO::PL_MoveEvent m_events[CAP] = {};
+	uint16_t m_seq = 0;
+	// Sequence number the current match started after
+	uint16_t m_base = 0;
+	int8_t m_result = -1;
+};
+
+// New random resume token (never 0). Not thread-safe; the server only
+// issues tokens under game_mutex
+uint64_t new_resume_token();
+
+#endif
@@ -14,8 +14,8 @@ class Game {
   public:
 	// Game class constructor
 	Game();
-	// Reset game
-	void reset();
+	// Reset game, with `first` to move
+	void reset(Player first = Player::P1);
 	// Apply a player's move to a cell on the board
 	bool move(int pos, Player p);
 	// Check if a cell is occupied
@@ -43,4 +43,4 @@ class Game {
 	Player m_current;
 };
 
-#endif
\ No newline at end of file
+#endif
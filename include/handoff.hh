@@ -0,0 +1,108 @@
+#ifndef HANDOFF_HH
+#define HANDOFF_HH
+
+#include "eventlog.hh"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * Hot restart support. A running server listens on a Unix socket; a newly
+ * started server connects to it and receives the listening socket, every
+ * live client socket (via SCM_RIGHTS) and the serialized match state, then
+ * carries on mid-game while the old process exits
+ */
+
+// Most descriptors passed in one handoff (listener + both players)
+constexpr int HANDOFF_MAX_FDS = 3;
+
+// Match state sent alongside the descriptors
+struct HandoffState {
+	// Board cells, as Cell values
+	uint8_t cells[9];
+	// Active player (1 or 2)
+	uint8_t active;
+	// Rating id of each seated player (-1 if anonymous)
+	int32_t rating_id[2];
+	// Moves played so far, packed 4 bits per cell, and their count
+	uint64_t move_log;
+	uint8_t move_count;
+	// Bit i set if player i + 1's socket is included, in seat order after
+	// the listener
+	uint8_t seats;
+	// Frames the old process had read but not yet applied when it froze
+	uint32_t inflight;
+	// CLOCK_MONOTONIC time at which the old process stopped serving
+	uint64_t frozen_ns;
+	// Resume token issued to each seat (0 if none)
+	uint64_t token[2];
+	// Bit i set if seat i is held for a dropped player to resume. The new
+	// process restarts the full grace window for it
+	uint8_t held;
+	// Nonzero once the match has started / has a result
+	uint8_t started;
+	uint8_t finished;
+	// Player who moved first in the match (1 or 2), and bit i set if player
+	// i + 1 asked for a rematch
+	uint8_t first;
+	uint8_t rematch;
+	// Move events of the match, for replay to resuming clients
+	EventLog events;
+};
+
+/**
+ * Stops every session reader at a frame boundary before a handoff, so each
+ * frame is either applied by the old process or left whole in the socket
+ * for the new one. Readers call wait() before reading each frame; stop()
+ * makes them park there instead and returns once all of them have.
+ * resume() lets them carry on if the handoff fails
+ */
+class ReaderGate {
+  public:
+	ReaderGate();
+	~ReaderGate();
+
+	ReaderGate(const ReaderGate&) = delete;
+	ReaderGate& operator=(const ReaderGate&) = delete;
+
+	// Register and unregister the calling thread as a reader
+	void enter();
+	void leave();
+	// Block until `fd` is readable (or closed), parking while stopped
+	void wait(int fd);
+
+	// Park every reader. Returns true once all registered readers are
+	// parked, or false if some are still mid-frame after `timeout_ms`
+	bool stop(int timeout_ms);
+	// Release the parked readers
+	void resume();
+
+  private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stopped = false;
+	int m_readers = 0;
+	int m_parked = 0;
+	// Readable while stopped, to wake readers blocked in poll()
+	int m_wake[2] = {-1, -1};
+};
+
+// Create a Unix stream socket listening on `path`, replacing any stale
+// socket file. Returns the fd or -1
+int handoff_listen(const std::string& path);
+// Connect to a server listening on `path`. Returns the fd or -1 if no
+// server is running there
+int handoff_connect(const std::string& path);
+
+// Send `state` plus `nfds` descriptors over a Unix socket. Returns true if
+// successful
+bool handoff_send(int unix_fd, const HandoffState& state, const int* fds,
+				  int nfds);
+// Receive the state and up to HANDOFF_MAX_FDS descriptors. Returns the
+// number of descriptors received, or -1 on error
+int handoff_recv(int unix_fd, HandoffState& state, int* fds);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HASHRING_HH
+#define HASHRING_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Consistent-hash ring. Each node is placed at VNODES pseudo-random points
+ * derived from its name, and a key belongs to the first point at or after
+ * its hash. Adding or removing a node only moves the keys on the arcs that
+ * node owns, and placement does not depend on the order nodes were added
+ */
+class HashRing {
+  public:
+	// Points per node; more points spread keys more evenly
+	static constexpr int VNODES = 128;
+
+	// Place node `id` on the ring under `name` (e.g. "host:port")
+	void add(uint32_t id, const std::string& name);
+	// Take node `id` off the ring
+	void remove(uint32_t id);
+	bool contains(uint32_t id) const;
+	bool empty() const { return m_points.empty(); }
+
+	// Every node once, in ring order starting at the owner of `key`: the
+	// order to fall back in when a node cannot take the key
+	void walk(uint64_t key, std::vector<uint32_t>& out) const;
+	// The first node on walk(key) that `usable(id)` accepts, or -1
+	template <typename F> int64_t place(uint64_t key, F usable) const {
+		static thread_local std::vector<uint32_t> order;
+		walk(key, order);
+		for (uint32_t id : order)
+			if (usable(id))
+				return id;
+		return -1;
+	}
+
+  private:
+	// (point, node id), sorted by point
+	std::vector<std::pair<uint64_t, uint32_t>> m_points;
+};
+
+// 64-bit mix of `x` (splitmix64 finalizer)
+uint64_t hash64(uint64_t x);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef HEARTBEAT_HH
+#define HEARTBEAT_HH
+
+#include "perthread.hh"
+#include "sendqueue.hh"
+
+#include <cstdint>
+#include <mutex>
+
+/**
+ * Connection heartbeats. One background thread pings every registered peer
+ * through its send queue, tightening the schedule while a pong is overdue,
+ * and shuts down peers that stay silent past the dead window. Pong echoes
+ * feed a per-connection smoothed RTT/jitter estimate (RFC 6298 style) and a
+ * process-wide RTT histogram
+ */
+
+struct HeartbeatConfig {
+	// Ping interval while the peer is healthy
+	uint32_t interval_ms = 1000;
+	// Silence after which a peer is considered dead
+	uint32_t dead_after_ms = 10000;
+};
+
+// Settings used by the heartbeat thread (set before heartbeat_start)
+extern HeartbeatConfig heartbeat_config;
+
+// Liveness and RTT state of one connection
+class PeerHealth {
+  public:
+	PeerHealth(int sockfd, SendQueue& queue);
+
+	// Note that a frame arrived from the peer
+	void heard();
+	// Handle a pong echoing the ping timestamp `stamp_ns`, received at
+	// `now_ns`
+	void pong(uint64_t stamp_ns, uint64_t now_ns = monotonic_ns());
+
+	// Smoothed RTT and jitter (RTT variance) in microseconds, and the number
+	// of samples they are based on
+	uint64_t srtt_us() const;
+	uint64_t jitter_us() const;
+	uint32_t samples() const;
+
+  private:
+	friend void heartbeat_tick(uint64_t now_ns);
+
+	int m_fd;
+	SendQueue& m_queue;
+
+	mutable std::mutex m_mutex;
+	uint64_t m_last_heard_ns;
+	uint64_t m_last_ping_ns = 0;
+	uint64_t m_last_pong_ns = 0;
+	uint64_t m_next_ping_ns;
+	uint64_t m_interval_ns;
+	// RTT estimate in nanoseconds
+	uint64_t m_srtt_ns = 0;
+	uint64_t m_rttvar_ns = 0;
+	uint32_t m_samples = 0;
+	bool m_dead = false;
+};
+
+// Start the heartbeat thread (once per process)
+void heartbeat_start();
+// Register / unregister a peer. A peer must be removed before it or its
+// send queue is destroyed
+void heartbeat_add(PeerHealth* peer);
+void heartbeat_remove(PeerHealth* peer);
+// Run one round of pings and dead-peer checks (called by the thread)
+void heartbeat_tick(uint64_t now_ns);
+// Stop (or restart) pinging and disconnecting peers. Once this returns no
+// tick is running, so no socket is touched until it is called with false
+void heartbeat_pause(bool pause);
+
+// Process-wide RTT distribution, in microseconds. Percentiles are upper
+// bounds of power-of-two histogram buckets
+struct RttSummary {
+	uint64_t samples;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+	uint64_t max_us;
+};
+RttSummary rtt_summary();
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef HISTORY_HH
+#define HISTORY_HH
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Columnar match-history store. Finished matches are buffered per column
+ * and written as full blocks; each column in a block is frame-of-reference
+ * bit-packed and carries its min/max, so queries can skip whole blocks and
+ * scan the rest column-at-a-time across all cores. Rows not yet in a block
+ * are kept durable in a raw row log next to the file (FILE.tail), which
+ * readers include and which is emptied once its rows make a block
+ */
+
+// Result of a finished match
+enum class Outcome : uint8_t { X_WIN, O_WIN, DRAW };
+
+// Player id recorded for anonymous players
+constexpr uint32_t NO_PLAYER = 0xFFFFFFFF;
+
+// Rows buffered before a block is written
+constexpr size_t HISTORY_BLOCK_ROWS = 16384;
+// Longest a buffered row waits before it is appended to the row log, so a
+// crash loses at most this much history
+constexpr unsigned HISTORY_FLUSH_MS = 1000;
+
+// One finished match
+struct MatchRow {
+	// Rating ids of the X and O players (NO_PLAYER if anonymous)
+	uint32_t player_x;
+	uint32_t player_o;
+	Outcome outcome;
+	uint8_t move_count;
+	// Cell index (0-8) of move i in bits [4i, 4i + 4)
+	uint64_t moves;
+};
+
+// Cell index of the i-th move in a packed move sequence
+inline int move_at(uint64_t moves, int i) {
+	return int((moves >> (4 * i)) & 0xF);
+}
+
+// Append-only writer; safe to call from several session threads
+class HistoryWriter {
+  public:
+	HistoryWriter() = default;
+	~HistoryWriter();
+
+	HistoryWriter(const HistoryWriter&) = delete;
+	HistoryWriter& operator=(const HistoryWriter&) = delete;
+
+	// Open (creating if needed) a history file for appending, picking up
+	// the rows its row log holds. Buffered rows are logged every `flush_ms`
+	// by a background thread (0: only on flush())
+	bool open(const std::string& path, unsigned flush_ms = HISTORY_FLUSH_MS);
+	bool is_open() const { return m_fd != -1; }
+
+	// Buffer a finished match, writing a block once enough are buffered
+	void append(const MatchRow& row);
+	// Append the buffered rows not yet logged to the row log
+	void flush();
+
+  private:
+	// Write the buffered rows as a block and empty the row log. Caller
+	// holds m_mutex
+	void write_block();
+	// Append rows from m_logged on to the row log. Caller holds m_mutex
+	void write_log();
+	// Empty the row log, tying it to the current end of the file. Caller
+	// holds m_mutex
+	bool reset_log();
+	// Background thread: flush every `flush_ms` until destroyed
+	void flush_loop(unsigned flush_ms);
+
+	int m_fd = -1;
+	int m_log_fd = -1;
+	std::mutex m_mutex;
+	std::vector<MatchRow> m_rows;
+	// Leading rows of m_rows already in the row log
+	size_t m_logged = 0;
+	std::condition_variable m_wake;
+	bool m_stop = false;
+	std::thread m_flusher;
+};
+
+// Filter for HistoryReader::run
+struct HistoryQuery {
+	enum class Result : uint8_t { ANY, WIN, LOSS, DRAW };
+
+	// Rating id to filter on, or -1 for every player
+	int64_t player = -1;
+	// 'X' or 'O' to require the player's side, 0 for either
+	char role = 0;
+	// Result from the player's point of view (or of either side if no
+	// player is given)
+	Result result = Result::ANY;
+	// Inclusive bounds on the number of moves played
+	uint8_t min_moves = 0;
+	uint8_t max_moves = 9;
+};
+
+struct HistoryResult {
+	// Matching rows, and rows actually scanned
+	uint64_t matched = 0;
+	uint64_t scanned = 0;
+	// Blocks in the file, and blocks skipped by their min/max
+	uint64_t blocks = 0;
+	uint64_t skipped = 0;
+	// The first matches found, as (row number, row)
+	std::vector<std::pair<uint64_t, MatchRow>> rows;
+};
+
+// Read-only view of a history file
+class HistoryReader {
+  public:
+	HistoryReader() = default;
+	~HistoryReader();
+
+	HistoryReader(const HistoryReader&) = delete;
+	HistoryReader& operator=(const HistoryReader&) = delete;
+
+	// Map a history file and index its blocks. Returns false on error
+	bool open(const std::string& path);
+	// Total rows in the file
+	uint64_t rows() const { return m_rows; }
+
+	// Run `q` on `threads` threads, returning up to `limit` sample rows
+	HistoryResult run(const HistoryQuery& q, unsigned threads,
+					  size_t limit) const;
+
+  private:
+	struct Block {
+		const uint8_t* data;
+		uint64_t first_row;
+	};
+
+	const uint8_t* m_map = nullptr;
+	size_t m_size = 0;
+	uint64_t m_rows = 0;
+	std::vector<Block> m_blocks;
+	// The row log's rows, packed into a block of their own
+	std::vector<uint64_t> m_tail;
+};
+
+#endif
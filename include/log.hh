@@ -0,0 +1,113 @@
+#ifndef LOG_HH
+#define LOG_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+/**
+ * Asynchronous structured logger. LOG_* calls copy a fixed-size record
+ * (timestamp, level, subsystem, format literal, up to 4 arguments) into a
+ * per-thread lock-free ring and return; a background thread formats and
+ * writes records in batches. A full ring drops the record rather than
+ * blocking the caller
+ */
+
+namespace logger {
+
+enum class Level : uint8_t { DEBUG, INFO, WARN, ERROR };
+
+enum class Subsys : uint8_t {
+	NET,
+	GAME,
+	QUEUE,
+	SHARD,
+	RESTART,
+	TRACE,
+	ROUTE,
+	COUNT
+};
+
+// One record argument. Strings are stored by pointer, so they must outlive
+// the record (literals or long-lived globals)
+struct Arg {
+	enum Kind : uint8_t { INT, UINT, DOUBLE, STR } kind;
+	union {
+		int64_t i;
+		uint64_t u;
+		double d;
+		const char* s;
+	};
+
+	Arg() : kind(INT), i(0) {}
+	template <typename T>
+		requires std::is_integral_v<T>
+	Arg(T v) {
+		if constexpr (std::is_signed_v<T>) {
+			kind = INT;
+			i = v;
+		} else {
+			kind = UINT;
+			u = v;
+		}
+	}
+	Arg(double v) : kind(DOUBLE), d(v) {}
+	Arg(const char* v) : kind(STR), s(v) {}
+};
+
+// Most arguments a single record can carry
+constexpr int MAX_ARGS = 4;
+
+// Minimum level written, and bitmask of enabled subsystems
+extern std::atomic<uint8_t> min_level;
+extern std::atomic<uint32_t> subsys_mask;
+
+// Cheap check done before building a record
+inline bool enabled(Level l, Subsys s) {
+	return uint8_t(l) >= min_level.load(std::memory_order_relaxed) &&
+		   (subsys_mask.load(std::memory_order_relaxed) >> uint8_t(s)) & 1;
+}
+
+// Parse "debug|info|warn|error". Returns false if unknown
+bool set_level(const std::string& name);
+// Enable only the comma-separated subsystems (e.g. "net,game"). Returns
+// false if a name is unknown
+bool set_filter(const std::string& names);
+
+// Start the background writer for this process. Safe to call again after
+// fork(), which does not carry the writer thread over; the child starts
+// with empty rings, leaving what was buffered before the fork to the parent
+void start();
+// Write out everything recorded so far
+void flush();
+
+// Append a record; `fmt` must be a string literal using {} placeholders
+void write(Level l, Subsys s, const char* fmt, const Arg* args, int nargs);
+
+template <typename... Args>
+void log(Level l, Subsys s, const char* fmt, Args... args) {
+	static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+	if constexpr (sizeof...(Args) == 0) {
+		write(l, s, fmt, nullptr, 0);
+	} else {
+		const Arg a[] = {Arg(args)...};
+		write(l, s, fmt, a, int(sizeof...(Args)));
+	}
+}
+
+} // namespace logger
+
+#define LOG_AT(level, sub, ...)                                                \
+	do {                                                                       \
+		if (logger::enabled(logger::Level::level, logger::Subsys::sub))        \
+			logger::log(logger::Level::level, logger::Subsys::sub,            \
+						__VA_ARGS__);                                          \
+	} while (0)
+
+#define LOG_DEBUG(sub, ...) LOG_AT(DEBUG, sub, __VA_ARGS__)
+#define LOG_INFO(sub, ...) LOG_AT(INFO, sub, __VA_ARGS__)
+#define LOG_WARN(sub, ...) LOG_AT(WARN, sub, __VA_ARGS__)
+#define LOG_ERROR(sub, ...) LOG_AT(ERROR, sub, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef MESSAGE_HH
+#define MESSAGE_HH
+
+#include "protocol.hh"
+#include "trace.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Typed message layer. The catalog below binds every MsgType to its
+ * payload struct and allowed payload sizes, all checked at compile time.
+ * Messages encode into fixed-size stack buffers, and received frames are
+ * decoded and dispatched through a jump table generated per handler, so
+ * neither direction touches the heap or branches on the type at runtime
+ */
+namespace TTT_PROTO {
+
+/**
+ * Catalog entry: payload type P, sent as between `Min` and sizeof(P) bytes
+ * (variable-size payloads send a prefix of P)
+ */
+template <typename P, size_t Min = sizeof(P)> struct Payload {
+	static_assert(std::is_trivially_copyable_v<P>,
+				  "payloads are copied byte for byte");
+	static_assert(sizeof(P) <= MAX_PAYLOAD, "payload does not fit a frame");
+	static_assert(Min <= sizeof(P));
+
+	using type = P;
+	static constexpr bool known = true;
+	static constexpr size_t min_size = Min;
+	static constexpr size_t max_size = sizeof(P);
+};
+struct NoPayload {
+	using type = PL_Empty;
+	static constexpr bool known = true;
+	static constexpr size_t min_size = 0;
+	static constexpr size_t max_size = 0;
+};
+
+// Message catalog. Types without an entry are rejected by dispatch()
+template <MsgType T> struct Msg {
+	static constexpr bool known = false;
+};
+
+// Server -> client
+template <> struct Msg<MsgType::WELCOME> : Payload<PL_Welcome> {};
+template <> struct Msg<MsgType::SERVER_FULL> : NoPayload {};
+template <> struct Msg<MsgType::BOARD_UPDATE> : Payload<PL_Board> {};
+template <> struct Msg<MsgType::TURN> : Payload<PL_Turn> {};
+template <> struct Msg<MsgType::MOVE_RESULT> : Payload<PL_MovRes> {};
+template <> struct Msg<MsgType::WIN> : Payload<PL_Win> {};
+template <> struct Msg<MsgType::DRAW> : Payload<PL_Draw> {};
+template <> struct Msg<MsgType::ERROR> : Payload<PL_Error> {};
+template <>
+struct Msg<MsgType::LEADERBOARD>
+	: Payload<PL_Leaderboard, offsetof(PL_Leaderboard, entries)> {};
+template <> struct Msg<MsgType::PING> : Payload<PL_Ping> {};
+template <> struct Msg<MsgType::MOVE_EVENT> : Payload<PL_MoveEvent> {};
+template <> struct Msg<MsgType::STATS> : Payload<PL_Stats> {};
+template <> struct Msg<MsgType::REMATCH> : Payload<PL_Rematch> {};
+template <> struct Msg<MsgType::JOINED> : Payload<PL_Joined> {};
+
+// Client -> server
+// A bare position byte moves in match 0
+template <>
+struct Msg<MsgType::MOVE_REQUEST> : Payload<PL_MovReq, sizeof(PL_MovReq::pos)> {};
+template <> struct Msg<MsgType::QUIT_REQUEST> : NoPayload {};
+template <> struct Msg<MsgType::MOVE_ACK> : NoPayload {};
+// Shorter names may be sent without padding
+template <> struct Msg<MsgType::HELLO> : Payload<PL_Hello, 0> {};
+// An empty request asks for LEADERBOARD_MAX entries
+template <>
+struct Msg<MsgType::LEADERBOARD_REQUEST> : Payload<PL_LeaderboardReq, 0> {};
+template <> struct Msg<MsgType::PONG> : Payload<PL_Ping> {};
+template <> struct Msg<MsgType::RESUME> : Payload<PL_Resume> {};
+template <> struct Msg<MsgType::STATS_REQUEST> : NoPayload {};
+template <> struct Msg<MsgType::REMATCH_REQUEST> : NoPayload {};
+template <> struct Msg<MsgType::JOIN_REQUEST> : NoPayload {};
+
+// Payload struct of message type T
+template <MsgType T> using PayloadOf = typename Msg<T>::type;
+
+// Compile-time message type, passed to dispatch handlers
+template <MsgType T> using MsgTag = std::integral_constant<MsgType, T>;
+
+/**
+ * Encoded frame (header + payload) in a fixed-size buffer sized for the
+ * largest payload its message type allows
+ */
+template <size_t MaxPayload> struct FrameBuf {
+	std::array<uint8_t, sizeof(MsgHeader) + MaxPayload> bytes;
+	uint8_t len;
+
+	const uint8_t* data() const { return bytes.data(); }
+	size_t size() const { return len; }
+};
+template <MsgType T> using FrameOf = FrameBuf<Msg<T>::max_size>;
+
+// Encode a message of type T with a `size`-byte prefix of `p` as payload.
+// `size` is clamped to the sizes the catalog allows
+template <MsgType T>
+FrameOf<T> encode(const PayloadOf<T>& p, size_t size) {
+	TTT_TRACE_SPAN("encode");
+	using M = Msg<T>;
+	static_assert(M::known, "message type missing from the catalog");
+
+	size = size < M::min_size ? M::min_size
+		   : size > M::max_size ? M::max_size
+								: size;
+	FrameOf<T> f;
+	f.bytes[0] = static_cast<uint8_t>(T);
+	f.bytes[1] = static_cast<uint8_t>(size);
+	if constexpr (M::max_size > 0)
+		std::memcpy(f.bytes.data() + sizeof(MsgHeader), &p, size);
+	f.len = static_cast<uint8_t>(sizeof(MsgHeader) + size);
+	return f;
+}
+
+// Encode a fixed-size message
+template <MsgType T> FrameOf<T> encode(const PayloadOf<T>& p) {
+	static_assert(Msg<T>::min_size == Msg<T>::max_size,
+				  "variable-size message: pass the payload size");
+	return encode<T>(p, Msg<T>::max_size);
+}
+
+// Encode a message without payload
+template <MsgType T> FrameOf<T> encode() {
+	static_assert(Msg<T>::max_size == 0, "message needs a payload");
+	return encode<T>(PL_Empty{}, 0);
+}
+
+// Decode a `size`-byte payload of type T into `out`, zero-filling whatever
+// a shorter payload leaves out. Returns false if the size is not allowed
+template <MsgType T>
+bool decode(const uint8_t* payload, size_t size, PayloadOf<T>& out) {
+	using M = Msg<T>;
+	if (size < M::min_size || size > M::max_size)
+		return false;
+	out = PayloadOf<T>{};
+	if constexpr (M::max_size > 0) {
+		if (size > 0)
+			std::memcpy(&out, payload, size);
+	}
+	return true;
+}
+
+namespace detail {
+
+template <typename H>
+using DispatchFn = int (*)(H& handler, const uint8_t* payload, size_t size);
+
+template <typename H, MsgType T>
+int dispatch_one(H& handler, const uint8_t* payload, size_t size) {
+	PayloadOf<T> p;
+	if (!decode<T>(payload, size, p))
+		return (int)ProtoErr::INVALID_SIZE;
+	handler(MsgTag<T>{}, p, size);
+	return (int)ProtoErr::OK;
+}
+
+template <typename H>
+int dispatch_unknown(H&, const uint8_t*, size_t) {
+	return (int)ProtoErr::INVALID_TYPE;
+}
+
+template <typename H, MsgType T> constexpr DispatchFn<H> table_entry() {
+	if constexpr (Msg<T>::known)
+		return &dispatch_one<H, T>;
+	else
+		return &dispatch_unknown<H>;
+}
+
+template <typename H, size_t... I>
+constexpr std::array<DispatchFn<H>, 256>
+make_table(std::index_sequence<I...>) {
+	return {{table_entry<H, MsgType(I)>()...}};
+}
+
+} // namespace detail
+
+/**
+ * Decode a received frame and call `handler(MsgTag<T>{}, payload, size)`
+ * with its typed payload. The handler is usually a generic lambda that
+ * picks its case with `if constexpr`, so each table entry is straight-line
+ * code. Returns 0, or a ProtoErr for unknown types and disallowed sizes
+ */
+template <typename H>
+int dispatch(const MsgHeader& hdr, const uint8_t* payload, H&& handler) {
+	TTT_TRACE_SPAN("dispatch");
+	using Handler = std::remove_reference_t<H>;
+	static constexpr auto table =
+		detail::make_table<Handler>(std::make_index_sequence<256>{});
+	return table[hdr.type](handler, payload, hdr.size);
+}
+
+} // namespace TTT_PROTO
+
+#endif
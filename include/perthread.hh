@@ -0,0 +1,86 @@
+#ifndef PERTHREAD_HH
+#define PERTHREAD_HH
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+inline uint64_t monotonic_ns() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+/**
+ * Registry of per-thread items (log, capture and trace rings, analytics
+ * counters). A thread claims an item on first use and hands it back when it
+ * exits; items are recycled, never freed, so a reader walking items() still
+ * sees what exited threads left behind.
+ *
+ * T has a `std::atomic<bool> free` member, false while a thread owns it.
+ * It may define `bool reusable() const` to keep a free item unclaimed (a
+ * ring not yet drained) and `void claimed()`, called on each claim with
+ * mutex() held. The calling thread's item is tracked per type, so there is
+ * one registry per T
+ */
+template <typename T> class PerThread {
+  public:
+	// The calling thread's item, claimed on first use
+	T& local() {
+		if (!s_handle.item)
+			s_handle.item = claim();
+		return *s_handle.item;
+	}
+	// The calling thread's item, or nullptr if it has not claimed one
+	T* current() const { return s_handle.item; }
+
+	// Held while walking items() or claiming
+	std::mutex& mutex() { return m_mutex; }
+	// Every item ever created. Caller holds mutex()
+	const std::vector<std::unique_ptr<T>>& items() const { return m_items; }
+
+  private:
+	// Hands the calling thread's item back on thread exit
+	struct Handle {
+		T* item = nullptr;
+		~Handle() {
+			if (item)
+				item->free.store(true, std::memory_order_release);
+		}
+	};
+
+	// Slow path: recycle a free item or create a new one
+	T* claim() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		T* item = nullptr;
+		for (auto& t : m_items) {
+			if constexpr (requires { t->reusable(); }) {
+				if (!t->reusable())
+					continue;
+			}
+			bool expected = true;
+			if (t->free.compare_exchange_strong(expected, false)) {
+				item = t.get();
+				break;
+			}
+		}
+		if (!item) {
+			m_items.push_back(std::make_unique<T>());
+			item = m_items.back().get();
+		}
+		if constexpr (requires { item->claimed(); })
+			item->claimed();
+		return item;
+	}
+
+	static inline thread_local Handle s_handle;
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<T>> m_items;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef PROTOCOL_HH
 #define PROTOCOL_HH
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -22,9 +23,22 @@ enum class MsgType : uint8_t {
 	WIN,
 	DRAW,
 	ERROR,
+	LEADERBOARD,
+	PING,
+	MOVE_EVENT,
+	STATS,
+	REMATCH,
+	JOINED,
 	MOVE_REQUEST = 100,
 	QUIT_REQUEST,
-	MOVE_ACK	  // New: acknowledge move received
+	MOVE_ACK,	  // New: acknowledge move received
+	HELLO,
+	LEADERBOARD_REQUEST,
+	PONG,
+	RESUME,
+	STATS_REQUEST,
+	REMATCH_REQUEST,
+	JOIN_REQUEST
 };
 
 enum class ProtoErr : int {
@@ -43,7 +57,11 @@ enum class GameErr : uint8_t {
 	MALFORMED_MOVE_REQUEST = 4,
 	GAME_ALREADY_FINISHED = 5,
 	SERVER_FULL_ERROR = 6,
-	TIMEOUT = 7
+	TIMEOUT = 7,
+	RESUME_REJECTED = 8,
+	UNEXPECTED_MESSAGE = 9,
+	UNKNOWN_MATCH = 10,
+	TOO_MANY_MATCHES = 11
 };
 
 struct MsgHeader {
@@ -51,21 +69,164 @@ struct MsgHeader {
 	uint8_t size;
 };
 
+// Largest payload a header can describe, and the largest frame on the wire.
+// Buffers reserved to these sizes never reallocate once warmed up
+constexpr size_t MAX_PAYLOAD = 255;
+constexpr size_t MAX_FRAME = sizeof(MsgHeader) + MAX_PAYLOAD;
+
 struct PL_Welcome {
 	uint8_t p_id;
+	uint8_t reserved[7];
+	// Opaque token the client presents in RESUME to reclaim its seat after
+	// a dropped connection (host byte order, echoed back unchanged)
+	uint64_t resume_token;
 };
+
+/**
+ * Game messages name the match they belong to (network byte order). A
+ * connection to the main listener plays a single match, always match 0; one
+ * to the multiplexed listener holds seats in any number of matches at once
+ * (see PL_Joined). A single-match client may send MOVE_REQUEST as just the
+ * position byte
+ */
 struct PL_Board {
 	uint8_t cells[9];
+	uint8_t reserved[3];
+	uint32_t match;
 };
 struct PL_MovReq {
 	uint8_t pos;
+	uint8_t reserved[3];
+	uint32_t match;
 };
 struct PL_MovRes {
 	uint8_t status;
+	uint8_t reserved[3];
+	uint32_t match;
 };
 struct PL_Error {
 	uint8_t error_code;
+	uint8_t reserved[3];
+	// Match the failed request named, 0 if none
+	uint32_t match;
+};
+// Player whose turn it is / who won (1 or 2)
+struct PL_Turn {
+	uint8_t player;
+	uint8_t reserved[3];
+	uint32_t match;
+};
+struct PL_Win {
+	uint8_t winner;
+	uint8_t reserved[3];
+	uint32_t match;
+};
+struct PL_Draw {
+	uint32_t match;
+};
+// Reply to JOIN_REQUEST on the multiplexed listener: the seat taken (1 or
+// 2) in a new or waiting match. BOARD_UPDATE and TURN follow once the
+// match has both players
+struct PL_Joined {
+	uint8_t p_id;
+	uint8_t reserved[3];
+	uint32_t match;
+};
+// Payload of messages that carry none
+struct PL_Empty {};
+
+// Longest player name on the wire, including the terminating NUL
+constexpr size_t PLAYER_NAME_LEN = 16;
+// Most entries returned in one leaderboard
+constexpr size_t LEADERBOARD_MAX = 10;
+
+// Sent by the client after connecting to identify the player
+struct PL_Hello {
+	char name[PLAYER_NAME_LEN];
+};
+struct PL_LeaderboardReq {
+	uint8_t count;
+};
+
+/**
+ * Leaderboard reply. Multi-byte fields are in network byte order, and only
+ * the first `count` entries are sent
+ */
+struct PL_RatingEntry {
+	char name[PLAYER_NAME_LEN];
+	uint16_t rating;
+	uint16_t games;
+};
+struct PL_Leaderboard {
+	// Requesting player's rank and rating (0 if unrated)
+	uint32_t self_rank;
+	uint16_t self_rating;
+	uint8_t count;
+	uint8_t reserved;
+	PL_RatingEntry entries[LEADERBOARD_MAX];
+};
+static_assert(sizeof(PL_Leaderboard) <= MAX_PAYLOAD);
+
+/**
+ * Heartbeat. The server stamps each PING with its own clock and the client
+ * echoes the payload back unchanged in a PONG, so the stamp is opaque to the
+ * client and stays in host byte order
+ */
+struct PL_Ping {
+	uint64_t stamp_ns;
+};
+
+/**
+ * Session resumption. Every applied move is broadcast as a MOVE_EVENT with
+ * a sequence number (network byte order, first move is 1) that keeps
+ * counting across rematches. A client whose connection dropped reconnects
+ * and sends RESUME with its token and the last sequence number it saw; the
+ * server replies with WELCOME, the missed MOVE_EVENTs (or a BOARD_UPDATE if
+ * they are no longer logged or predate the current match) and the current
+ * TURN
+ */
+struct PL_MoveEvent {
+	uint16_t seq;
+	uint8_t pos;
+	// Player who moved (1 or 2)
+	uint8_t player;
+};
+struct PL_Resume {
+	uint64_t token;
+	uint16_t last_seq;
+	uint8_t reserved[6];
+};
+
+/**
+ * Rematch. After WIN or DRAW both players stay connected, and either may
+ * send REMATCH_REQUEST. The opponent is sent REMATCH OFFERED; once both
+ * have asked, both are sent REMATCH STARTED followed by the empty board and
+ * TURN, with the other player moving first. A player who leaves instead
+ * gets the opponent a REMATCH DECLINED
+ */
+enum class RematchStatus : uint8_t { OFFERED = 1, DECLINED, STARTED };
+struct PL_Rematch {
+	uint8_t status;
+};
+
+/**
+ * Live analytics over every match the server has played, in reply to
+ * STATS_REQUEST. All fields are in network byte order. Outcome-indexed
+ * arrays are ordered X win, O win, draw
+ */
+struct PL_Stats {
+	// Moves applied, and total moves over every finished match
+	uint32_t moves;
+	uint32_t length_sum;
+	// Finished matches by outcome
+	uint32_t outcomes[3];
+	// How often each cell was played, and played as the opening move
+	uint32_t cells[9];
+	uint32_t opening[9];
+	// Finished matches by opening cell and outcome
+	uint32_t by_opening[9][3];
 };
+static_assert(sizeof(PL_Stats) <= MAX_PAYLOAD);
 
 /**
  * Serialize + deserialize functions
@@ -79,4 +240,4 @@ int deserialize(const std::vector<uint8_t>& bytes, MsgHeader& header_r,
 				std::vector<uint8_t>& payload_r);
 } // namespace TTT_PROTO
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,104 @@
+#ifndef RATINGS_HH
+#define RATINGS_HH
+
+#include "protocol.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Longest player name, including the terminating NUL
+constexpr size_t NAME_LEN = TTT_PROTO::PLAYER_NAME_LEN;
+
+// Rating given to a newly registered player
+constexpr float INITIAL_RATING = 1200.0f;
+
+// One player's persistent record, stored as-is in the mapped file
+struct RatingRecord {
+	char name[NAME_LEN];
+	float rating;
+	uint32_t games;
+	uint32_t wins;
+	uint32_t losses;
+	uint32_t draws;
+};
+
+/**
+ * Player identities and Elo ratings. Records live in an mmap'd file, so
+ * opening it is just a map plus an index rebuild. A name index and an
+ * order-statistics tree sorted by rating sit on top, giving O(log n) rank
+ * queries. The store has its own reader/writer lock and never needs the
+ * game lock
+ */
+class RatingStore {
+  public:
+	RatingStore() = default;
+	~RatingStore();
+
+	RatingStore(const RatingStore&) = delete;
+	RatingStore& operator=(const RatingStore&) = delete;
+
+	// Map (creating if needed) the rating file. Returns false on error
+	bool open(const std::string& path);
+	// True once a file has been opened
+	bool is_open() const { return m_header != nullptr; }
+
+	// Look up a player by name, registering them if new. Returns the
+	// player's id, or -1 if the store is not open
+	int32_t player(const std::string& name);
+
+	// Record a finished match between players `a` and `b`. `score_a` is 1
+	// if a won, 0 if b won, 0.5 for a draw
+	void record_match(int32_t a, int32_t b, float score_a);
+
+	// Id of an existing player, or -1 if unknown
+	int32_t find(const std::string& name) const;
+
+	// 1-based leaderboard position of player `id` (0 if unknown)
+	uint32_t rank(int32_t id) const;
+	// Copy of player `id`'s record. Returns false if unknown
+	bool get(int32_t id, RatingRecord& out) const;
+	// The `n` highest-rated players, best first
+	std::vector<RatingRecord> top(size_t n) const;
+
+  private:
+	struct FileHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t count;
+		uint32_t capacity;
+	};
+
+	// Leaderboard key: higher rating first, ties broken by id
+	using Key = std::pair<float, uint32_t>;
+	struct KeyOrder {
+		bool operator()(const Key& a, const Key& b) const {
+			return a.first != b.first ? a.first > b.first : a.second < b.second;
+		}
+	};
+	using RankTree =
+		__gnu_pbds::tree<Key, __gnu_pbds::null_type, KeyOrder,
+						 __gnu_pbds::rb_tree_tag,
+						 __gnu_pbds::tree_order_statistics_node_update>;
+
+	// Map `capacity` records of the file. Caller holds m_mutex exclusively
+	bool map(uint32_t capacity);
+	// Pointer to record `id`
+	RatingRecord* rec(uint32_t id) const;
+
+	int m_fd = -1;
+	FileHeader* m_header = nullptr;
+	size_t m_mapped = 0;
+
+	mutable std::shared_mutex m_mutex;
+	std::unordered_map<std::string, uint32_t> m_by_name;
+	RankTree m_ranks;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef SENDQUEUE_HH
+#define SENDQUEUE_HH
+
+#include "protocol.hh"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// What to do when a peer's queue would exceed its byte cap
+enum class SlowPolicy : uint8_t {
+	// Shut the connection down
+	DISCONNECT,
+	// Discard queued boards and turns but the latest of each, keeping every
+	// other frame (results, errors, rematch offers) in order
+	DROP_TO_SNAPSHOT,
+	// Discard queued boards that a newer board supersedes
+	COALESCE_BOARD
+};
+
+// Queue-depth metrics for one connection
+struct QueueStats {
+	// Bytes currently waiting to be sent
+	size_t depth_bytes;
+	// Largest depth_bytes seen
+	size_t high_water;
+	// Frames written to the socket
+	uint64_t sent;
+	// Frames discarded by the slow-consumer policy
+	uint64_t dropped;
+	// Times the queue hit its cap
+	uint64_t overflows;
+};
+
+/**
+ * Bounded outbound queue for a single connection. push() copies the frame
+ * into a fixed ring and returns immediately, so it is safe to call while
+ * holding the game lock; a dedicated writer thread drains the ring to the
+ * socket. A slow peer therefore only ever blocks its own writer.
+ *
+ * The socket stays blocking and each queue owns one writer thread, so a
+ * session takes two threads (reader and writer). A server seats two players
+ * plus its mux connections, which keeps that small; a server holding
+ * thousands of connections would want one poll() loop draining
+ * non-blocking sockets instead
+ */
+class SendQueue {
+  public:
+	// Frames queued by default
+	static constexpr size_t DEFAULT_SLOTS = 64;
+
+	// Frames pushed are captured under `capture_conn` while wire capture is
+	// on (0 leaves them out). The ring holds `slots` frames, allocated here
+	SendQueue(int sockfd, SlowPolicy policy, size_t byte_cap,
+			  uint32_t capture_conn = 0, size_t slots = DEFAULT_SLOTS);
+	~SendQueue();
+
+	SendQueue(const SendQueue&) = delete;
+	SendQueue& operator=(const SendQueue&) = delete;
+
+	// Queue a serialized frame. Returns false if the peer is gone or was
+	// disconnected by the policy
+	bool push(const uint8_t* frame, size_t len);
+	// Queue any contiguous frame buffer (a FrameBuf or a byte vector)
+	template <typename F> bool push(const F& frame) {
+		return push(frame.data(), frame.size());
+	}
+	// Wait up to `timeout_ms` for everything queued to reach the socket.
+	// Returns true if the queue drained
+	bool flush(int timeout_ms);
+	// Flush for up to `linger_ms`, then stop the writer thread
+	void stop(int linger_ms);
+	// Wait up to `timeout_ms` for the queue to drain, then hold the writer
+	// so nothing more reaches the socket and the queue never shuts it down,
+	// as the socket is about to be handed to another process. Returns false,
+	// leaving the writer running, if the queue did not drain
+	bool park(int timeout_ms);
+	// Let a parked writer send again
+	void unpark();
+
+	// Snapshot of the queue-depth metrics
+	QueueStats stats() const;
+
+  private:
+	struct Frame {
+		uint16_t len;
+		uint8_t bytes[TTT_PROTO::MAX_FRAME];
+	};
+
+	// Writer thread body
+	void run();
+	// Append a frame to the ring. Caller holds m_mutex
+	void append(const Frame& f);
+	// Remove every queued frame matching `type`, or all but the newest with
+	// `keep_last`. Caller holds m_mutex
+	void remove_type(TTT_PROTO::MsgType type, bool keep_last = false);
+	// Apply the slow-consumer policy before appending `incoming`. Returns
+	// false if the connection was dropped. Caller holds m_mutex
+	bool overflow(const Frame& incoming);
+	// Give up on the peer. Caller holds m_mutex
+	void disconnect();
+
+	int m_fd;
+	SlowPolicy m_policy;
+	size_t m_cap;
+	uint32_t m_capture_conn;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cv;
+	// Ring capacity in frames
+	size_t m_slots;
+	std::vector<Frame> m_ring;
+	size_t m_head = 0;
+	size_t m_count = 0;
+	// True while the writer is sending a frame it already popped
+	bool m_sending = false;
+	bool m_stop = false;
+	bool m_dead = false;
+	// Set by park(): frames are still queued but never sent
+	bool m_parked = false;
+	// Set while depth is above half the cap, so lag is reported once
+	bool m_lagging = false;
+
+	QueueStats m_stats{};
+	std::thread m_thread;
+};
+
+#endif
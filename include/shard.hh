@@ -0,0 +1,80 @@
+#ifndef SHARD_HH
+#define SHARD_HH
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+
+/**
+ * Per-shard counters. In sharded mode these live in a shared anonymous
+ * mapping created before fork(), so the supervisor can aggregate them
+ * without any IPC
+ */
+struct ShardStats {
+	// Connections accepted into a player slot
+	std::atomic<uint64_t> accepted;
+	// Connections refused because the shard's match was full
+	std::atomic<uint64_t> refused;
+	// Matches that reached a win or draw
+	std::atomic<uint64_t> matches;
+	// Times the supervisor had to restart this shard
+	std::atomic<uint32_t> restarts;
+	// Pid of the running shard process (0 if not running)
+	std::atomic<pid_t> pid;
+	// Seats held for dropped players to resume
+	std::atomic<uint32_t> held;
+};
+
+// Counters for the current process. Points into shared memory inside a
+// shard, or at a process-local instance otherwise
+extern ShardStats* shard_stats;
+// Index of the current shard, or -1 when not sharded
+extern int shard_index;
+
+/**
+ * Each shard accepts on its own SO_REUSEPORT listener, and the kernel picks
+ * the shard blindly. Shards therefore pass connections to each other: a
+ * new player goes to the lobby, the one shard with a player waiting for an
+ * opponent, and a resuming player to the shard that issued its token
+ */
+
+// Number of shards (0 when not sharded)
+int shard_count();
+// Shard with a lone player waiting for an opponent, or -1
+int lobby_shard();
+// Make this shard the lobby unless another shard is. Returns the lobby
+// shard afterwards
+int join_lobby();
+// Stop being the lobby, once the match has both players
+void leave_lobby();
+// True if any shard holds a seat for a dropped player
+bool seats_held();
+
+// Mark a resume token as issued by this shard (unchanged when not sharded)
+uint64_t shard_token(uint64_t token);
+// Shard that issued `token`
+int token_shard(uint64_t token);
+
+// Pass connection `fd` to shard `idx`, which has seen it `hops` times, and
+// close it here. Returns false if it could not be passed
+bool pass_conn(int idx, int fd, uint8_t hops);
+// Wait for a connection passed to this shard. Returns its fd and hop count,
+// or -1
+int recv_conn(uint8_t& hops);
+
+// Pin the calling process to a single CPU. Returns false on failure
+bool pin_to_cpu(int cpu);
+
+/**
+ * Fork `n` shard processes and supervise them. Each child pins itself to a
+ * CPU, points shard_stats at its slot and calls `serve(index)`, which should
+ * never return. A child starts with SIGINT, SIGTERM and SIGUSR1 blocked,
+ * for `serve` to wait on. Crashed or exited shards are restarted, and leave
+ * the lobby; SIGUSR1 prints the aggregated stats and
+ * is passed on to every shard, and SIGINT/SIGTERM stop every shard and
+ * print the aggregated stats. Never returns
+ */
+[[noreturn]] void run_shards(int n, const std::function<void(int)>& serve);
+
+#endif
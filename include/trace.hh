@@ -0,0 +1,60 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include "perthread.hh"
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hot-path tracing. Spans are compiled in only when built with TTT_TRACE
+ * (make TRACE=1); even then they cost a single relaxed load until tracing
+ * is enabled at runtime. Finished spans go into a per-thread ring buffer
+ * and are exported as Chrome/Perfetto trace JSON
+ */
+
+#define TTT_TRACE_CAT2(a, b) a##b
+#define TTT_TRACE_CAT(a, b) TTT_TRACE_CAT2(a, b)
+
+#ifdef TTT_TRACE
+// Record the rest of the enclosing scope as a span called `name`, which
+// must be a string literal
+#define TTT_TRACE_SPAN(name)                                                   \
+	trace::Span TTT_TRACE_CAT(trace_span_, __LINE__)(name)
+#else
+#define TTT_TRACE_SPAN(name) ((void)0)
+#endif
+
+namespace trace {
+
+// Runtime switch, off by default
+extern std::atomic<bool> enabled;
+
+// Append a finished span to the calling thread's ring
+void record(const char* name, uint64_t start_ns, uint64_t end_ns);
+
+// Write every buffered span as Chrome trace JSON. Returns true on success
+bool dump_chrome_json(const char* path);
+
+// RAII span; records on destruction if tracing was enabled at construction
+class Span {
+  public:
+	explicit Span(const char* name)
+		: m_name(name),
+		  m_start(enabled.load(std::memory_order_relaxed) ? monotonic_ns() : 0) {}
+	~Span() {
+		if (m_start)
+			record(m_name, m_start, monotonic_ns());
+	}
+
+	Span(const Span&) = delete;
+	Span& operator=(const Span&) = delete;
+
+  private:
+	const char* m_name;
+	uint64_t m_start;
+};
+
+} // namespace trace
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef VALIDATE_HH
+#define VALIDATE_HH
+
+#include "history.hh"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Batch validation of recorded games. Each game's moves are replayed on
+ * 9-bit X/O bitmasks, one game per SIMD lane (8 lanes with AVX2, 4 with
+ * SSE4.1), checking that every move lands on an empty cell, that play stops
+ * once someone has won, and that the recorded outcome matches the final
+ * position. The widest kernel the CPU supports is picked at runtime, with a
+ * scalar fallback
+ */
+
+// Result of validating one game. When a game has several problems, the one
+// met first while replaying it is reported
+enum class Verdict : uint8_t {
+	OK,
+	// A move is off the board or on an occupied cell
+	ILLEGAL_MOVE,
+	// Moves were recorded after the game had been won
+	PLAY_AFTER_END,
+	// The final position is decided but the recorded outcome disagrees
+	WRONG_OUTCOME,
+	// Nobody has won and the board is not full (e.g. a forfeit)
+	UNDECIDED,
+	COUNT
+};
+
+// Display name of a verdict
+const char* verdict_name(Verdict v);
+
+enum class ValidateKernel : uint8_t { SCALAR, SSE41, AVX2 };
+
+// Display name of a kernel
+const char* kernel_name(ValidateKernel k);
+// Widest kernel this CPU supports
+ValidateKernel best_kernel();
+// Whether this CPU can run `k`
+bool kernel_supported(ValidateKernel k);
+
+// Validate `n` games into `out`, with the best kernel for this CPU
+void validate_games(const MatchRow* rows, size_t n, Verdict* out);
+// Validate `n` games into `out` with a specific (supported) kernel
+void validate_games(const MatchRow* rows, size_t n, Verdict* out,
+					ValidateKernel kernel);
+
+#endif
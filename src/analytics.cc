@@ -0,0 +1,82 @@
+#include "analytics.hh"
+#include "perthread.hh"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace analytics {
+
+namespace {
+
+/**
+ * One thread's counters. Only the owning thread writes them, so updates
+ * are relaxed load + store rather than read-modify-write; the alignment
+ * keeps two threads' blocks off the same cache line
+ */
+struct alignas(64) Block {
+	std::atomic<uint64_t> moves{0};
+	std::atomic<uint64_t> cells[9] = {};
+	std::atomic<uint64_t> opening[9] = {};
+	std::atomic<uint64_t> by_opening[9][3] = {};
+	// Matches that ended before any move, by outcome
+	std::atomic<uint64_t> no_opening[3] = {};
+	std::atomic<uint64_t> length_sum{0};
+	// False while a live thread owns the block
+	std::atomic<bool> free{false};
+};
+
+inline void bump(std::atomic<uint64_t>& c, uint64_t by = 1) {
+	c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+// Blocks outlive their threads, so counts from threads that have exited
+// stay in the totals
+PerThread<Block> blocks;
+
+} // namespace
+
+void record_move(int pos, int ply) {
+	if (pos < 0 || pos > 8)
+		return;
+	Block& b = blocks.local();
+	bump(b.moves);
+	bump(b.cells[pos]);
+	if (ply == 0)
+		bump(b.opening[pos]);
+}
+
+void record_result(Outcome outcome, int opening, int moves) {
+	size_t o = size_t(outcome);
+	if (o > 2)
+		return;
+	Block& b = blocks.local();
+	if (opening >= 0 && opening < 9)
+		bump(b.by_opening[opening][o]);
+	else
+		bump(b.no_opening[o]);
+	bump(b.length_sum, uint64_t(moves));
+}
+
+Snapshot snapshot() {
+	Snapshot s{};
+	std::lock_guard<std::mutex> lock(blocks.mutex());
+	for (const auto& b : blocks.items()) {
+		s.moves += b->moves.load(std::memory_order_relaxed);
+		s.length_sum += b->length_sum.load(std::memory_order_relaxed);
+		for (int i = 0; i < 9; i++) {
+			s.cells[i] += b->cells[i].load(std::memory_order_relaxed);
+			s.opening[i] += b->opening[i].load(std::memory_order_relaxed);
+			for (int o = 0; o < 3; o++) {
+				uint64_t n = b->by_opening[i][o].load(std::memory_order_relaxed);
+				s.by_opening[i][o] += n;
+				s.outcomes[o] += n;
+			}
+		}
+		for (int o = 0; o < 3; o++)
+			s.outcomes[o] += b->no_opening[o].load(std::memory_order_relaxed);
+	}
+	return s;
+}
+
+} // namespace analytics
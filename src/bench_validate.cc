@@ -0,0 +1,152 @@
+#include "game.hh"
+#include "history.hh"
+#include "utils.hh"
+#include "validate.hh"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Benchmark for the batch game validator: replays N recorded games (some
+ * deliberately corrupted) through the scalar Game path and through every
+ * validator kernel this CPU supports, checks they agree, and reports
+ * throughput. Usage: bench_validate [games]
+ */
+
+// Random legal game, as the server would record it
+static MatchRow random_game(std::mt19937_64& rng) {
+	Game g;
+	MatchRow r{0, 0, Outcome::DRAW, 0, 0};
+	while (true) {
+		int pos;
+		do {
+			pos = int(rng() % 9);
+		} while (!g.isValidMove(pos));
+
+		Player p = g.activePlayer();
+		g.move(pos, p);
+		r.moves |= uint64_t(pos) << (4 * r.move_count++);
+
+		if (g.checkWin(p)) {
+			r.outcome = (p == Player::P1 ? Outcome::X_WIN : Outcome::O_WIN);
+			return r;
+		}
+		if (g.isDraw())
+			return r;
+		g.switchPlayer();
+	}
+}
+
+// Corrupt a recorded game in one of the ways the validator should catch
+static void corrupt(MatchRow& r, std::mt19937_64& rng) {
+	switch (rng() % 4) {
+	case 0: // Overwrite one move
+		r.moves ^= uint64_t(1 + rng() % 15) << (4 * (rng() % r.move_count));
+		break;
+	case 1: // Wrong outcome
+		r.outcome = Outcome((uint8_t(r.outcome) + 1 + rng() % 2) % 3);
+		break;
+	case 2: // Truncated game
+		r.move_count = uint8_t(rng() % r.move_count);
+		break;
+	default: // Extra moves
+		r.moves |= (rng() & 0xF) << (4 * r.move_count);
+		r.move_count++;
+		break;
+	}
+}
+
+// Reference verdict, replaying through Game::move / checkWin / isDraw
+static Verdict validate_with_game(const MatchRow& r) {
+	Game g;
+	bool won = false;
+	for (int k = 0; k < r.move_count; k++) {
+		if (won)
+			return Verdict::PLAY_AFTER_END;
+		Player p = (k % 2 == 0 ? Player::P1 : Player::P2);
+		if (k >= 9 || !g.move(move_at(r.moves, k), p))
+			return Verdict::ILLEGAL_MOVE;
+		won = g.checkWin(p);
+	}
+
+	Outcome expected;
+	if (won)
+		expected = (r.move_count % 2 == 1 ? Outcome::X_WIN : Outcome::O_WIN);
+	else if (g.isDraw())
+		expected = Outcome::DRAW;
+	else
+		return Verdict::UNDECIDED;
+	return r.outcome == expected ? Verdict::OK : Verdict::WRONG_OUTCOME;
+}
+
+// Print the throughput of one run
+static void report(const char* name, double secs, size_t games,
+				   uint64_t positions) {
+	std::cout << name << ": " << secs * 1000 << " ms, "
+			  << uint64_t(games / secs) / 1000 << "k games/s, "
+			  << uint64_t(positions / secs) / 1000000 << "M positions/s"
+			  << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	using std::cout, std::endl;
+	using clock = std::chrono::steady_clock;
+
+	size_t n = argc > 1 ? std::stoull(argv[1]) : 4'000'000;
+
+	// One game in ten is corrupted
+	std::mt19937_64 rng(42);
+	std::vector<MatchRow> rows(n);
+	uint64_t positions = 0;
+	for (MatchRow& r : rows) {
+		r = random_game(rng);
+		if (rng() % 10 == 0)
+			corrupt(r, rng);
+		positions += r.move_count;
+	}
+
+	/**
+	 * Scalar Game path
+	 */
+	std::vector<Verdict> ref(n);
+	auto start = clock::now();
+	for (size_t i = 0; i < n; i++)
+		ref[i] = validate_with_game(rows[i]);
+	double secs = std::chrono::duration<double>(clock::now() - start).count();
+	report("Game", secs, n, positions);
+
+	uint64_t counts[size_t(Verdict::COUNT)] = {};
+	for (Verdict v : ref)
+		counts[size_t(v)]++;
+	for (size_t v = 0; v < size_t(Verdict::COUNT); v++)
+		cout << "  " << verdict_name(Verdict(v)) << ": " << counts[v] << endl;
+
+	/**
+	 * Every supported kernel, checked against the Game path
+	 */
+	std::vector<Verdict> out(n);
+	for (ValidateKernel k : {ValidateKernel::SCALAR, ValidateKernel::SSE41,
+							 ValidateKernel::AVX2}) {
+		if (!kernel_supported(k)) {
+			cout << kernel_name(k) << ": not supported on this CPU" << endl;
+			continue;
+		}
+
+		start = clock::now();
+		validate_games(rows.data(), n, out.data(), k);
+		secs = std::chrono::duration<double>(clock::now() - start).count();
+		report(kernel_name(k), secs, n, positions);
+
+		for (size_t i = 0; i < n; i++) {
+			if (out[i] != ref[i])
+				fatal_error(1, (std::string(kernel_name(k)) +
+								" disagrees with the Game path at game " +
+								std::to_string(i))
+								   .c_str());
+		}
+	}
+	return 0;
+}
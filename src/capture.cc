@@ -0,0 +1,259 @@
+#include "capture.hh"
+#include "perthread.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace capture {
+
+std::atomic<bool> enabled(false);
+
+namespace {
+
+constexpr char FILE_MAGIC[4] = {'T', 'T', 'T', 'C'};
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+};
+
+// One buffered record with room for the largest frame
+struct Slot {
+	Record rec;
+	uint8_t frame[TTT_PROTO::MAX_FRAME];
+};
+
+// Records buffered per thread before new ones are dropped
+constexpr uint64_t RING_SIZE = 512;
+
+/**
+ * Single-producer, single-consumer ring. The owning thread advances `head`
+ * after writing a record; the writer thread advances `tail` after reading
+ */
+struct Ring {
+	Slot slots[RING_SIZE];
+	std::atomic<uint64_t> head{0};
+	std::atomic<uint64_t> tail{0};
+	// False while a live thread owns the ring
+	std::atomic<bool> free{false};
+
+	// Only recycled once the writer has drained it
+	bool reusable() const { return tail.load() == head.load(); }
+};
+
+PerThread<Ring> rings;
+
+// Serializes draining between the writer thread and flush()
+std::mutex drain_mutex;
+int file_fd = -1;
+std::atomic<uint32_t> next_conn(1);
+std::atomic<uint64_t> dropped_records(0);
+
+// Reserve the next slot of the calling thread's ring, or nullptr if full
+Slot* claim_slot() {
+	Ring& r = rings.local();
+
+	uint64_t head = r.head.load(std::memory_order_relaxed);
+	if (head - r.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+		dropped_records.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+	return &r.slots[head % RING_SIZE];
+}
+
+// Publish the slot returned by claim_slot()
+void publish() {
+	Ring* r = rings.current();
+	r->head.store(r->head.load(std::memory_order_relaxed) + 1,
+				  std::memory_order_release);
+}
+
+/**
+ * Move every buffered record out of the rings, order them by time and
+ * append them to the file in one write
+ */
+void drain() {
+	static std::vector<const Slot*> batch;
+	static std::vector<uint8_t> out;
+	// Rings drained and their new tails, released once the batch is written
+	// so producers cannot reuse the slots before then
+	static std::vector<std::pair<Ring*, uint64_t>> taken;
+
+	std::lock_guard<std::mutex> drain_lock(drain_mutex);
+	batch.clear();
+	out.clear();
+	taken.clear();
+	{
+		std::lock_guard<std::mutex> lock(rings.mutex());
+		for (auto& r : rings.items()) {
+			uint64_t tail = r->tail.load(std::memory_order_relaxed);
+			uint64_t head = r->head.load(std::memory_order_acquire);
+			for (uint64_t i = tail; i < head; i++)
+				batch.push_back(&r->slots[i % RING_SIZE]);
+			if (head != tail)
+				taken.emplace_back(r.get(), head);
+		}
+	}
+	if (batch.empty())
+		return;
+
+	std::stable_sort(batch.begin(), batch.end(),
+					 [](const Slot* a, const Slot* b) {
+						 return a->rec.ts_ns < b->rec.ts_ns;
+					 });
+	for (const Slot* s : batch) {
+		const uint8_t* rec = reinterpret_cast<const uint8_t*>(&s->rec);
+		out.insert(out.end(), rec, rec + sizeof(Record));
+		out.insert(out.end(), s->frame, s->frame + s->rec.len);
+	}
+
+	// O_APPEND keeps each batch contiguous even if a restarted server
+	// appends to the same file
+	size_t done = 0;
+	while (done < out.size()) {
+		ssize_t n = ::write(file_fd, out.data() + done, out.size() - done);
+		if (n <= 0)
+			break;
+		done += size_t(n);
+	}
+
+	for (auto& [r, head] : taken)
+		r->tail.store(head, std::memory_order_release);
+}
+
+void writer_loop() {
+	// Signal handlers may call flush(); keep them off this thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		drain();
+	}
+}
+
+} // namespace
+
+bool open(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	FileHeader h{};
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		std::memcpy(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+		h.version = VERSION;
+		if (::write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+			close(fd);
+			return false;
+		}
+	} else if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+			   std::memcmp(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+			   h.version != VERSION) {
+		close(fd);
+		return false;
+	}
+
+	file_fd = fd;
+	enabled.store(true);
+	record(0, Dir::EPOCH);
+	std::thread(writer_loop).detach();
+	return true;
+}
+
+void flush() {
+	if (file_fd != -1)
+		drain();
+}
+
+uint64_t dropped() { return dropped_records.load(); }
+
+uint32_t new_conn() { return next_conn.fetch_add(1); }
+
+void write(uint32_t conn, Dir dir, const uint8_t* frame, size_t len) {
+	Slot* s = claim_slot();
+	if (!s)
+		return;
+	len = std::min(len, sizeof(s->frame));
+	s->rec = Record{monotonic_ns(), conn, uint16_t(len), dir, 0};
+	if (len > 0)
+		std::memcpy(s->frame, frame, len);
+	publish();
+}
+
+void write(uint32_t conn, Dir dir, const TTT_PROTO::MsgHeader& hdr,
+		   const uint8_t* payload) {
+	Slot* s = claim_slot();
+	if (!s)
+		return;
+	s->rec = Record{monotonic_ns(), conn, uint16_t(sizeof(hdr) + hdr.size), dir, 0};
+	std::memcpy(s->frame, &hdr, sizeof(hdr));
+	if (hdr.size > 0)
+		std::memcpy(s->frame + sizeof(hdr), payload, hdr.size);
+	publish();
+}
+
+/**
+ * Reader
+ */
+
+Reader::~Reader() {
+	if (m_map)
+		munmap(const_cast<uint8_t*>(m_map), m_size);
+}
+
+bool Reader::open(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+		close(fd);
+		return false;
+	}
+	m_size = size_t(st.st_size);
+	void* map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	m_map = static_cast<const uint8_t*>(map);
+	madvise(map, m_size, MADV_SEQUENTIAL);
+
+	FileHeader h;
+	std::memcpy(&h, m_map, sizeof(h));
+	if (std::memcmp(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+		h.version != VERSION)
+		return false;
+	m_pos = sizeof(h);
+	return true;
+}
+
+bool Reader::next(Record& rec, const uint8_t*& frame) {
+	if (m_size - m_pos < sizeof(Record))
+		return false;
+	std::memcpy(&rec, m_map + m_pos, sizeof(rec));
+	if (m_size - m_pos - sizeof(Record) < rec.len)
+		return false;
+	frame = m_map + m_pos + sizeof(Record);
+	m_pos += sizeof(Record) + rec.len;
+	return true;
+}
+
+} // namespace capture
@@ -1,24 +1,56 @@
 #include "game.hh"
+#include "message.hh"
 #include "protocol.hh"
 #include "utils.hh"
 
 #include <algorithm>
+#include <array>
 #include <arpa/inet.h>
 #include <cctype>
 #include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <condition_variable>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <signal.h>
 #include <string>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <thread>
 #include <unistd.h>
-#include <vector>
 
 using namespace TTT_PROTO;
 
 // Local sockfd
 int sockfd = -1;
+// Serializes sends from the game loop and the reader thread
+static std::mutex send_mutex;
+
+// One frame received from the server, in a buffer that fits any payload
+struct Frame {
+	MsgHeader hdr;
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+};
+
+/**
+ * Frames handed from the reader thread to the game loop, in a fixed ring so
+ * receiving never allocates. The reader answers heartbeat pings itself, so
+ * the server keeps hearing from us while the player sits at the prompt. A
+ * full ring makes the reader wait; the server sends a handful of frames per
+ * move, so that only happens if the game loop has stopped
+ */
+constexpr size_t INBOX_SLOTS = 64;
+static std::mutex inbox_mutex;
+static std::condition_variable inbox_cv;
+static std::array<Frame, INBOX_SLOTS> inbox;
+static size_t inbox_head = 0;
+static size_t inbox_count = 0;
+// Set once the connection is gone
+static bool inbox_closed = false;
 
 // Helper method to recv all bytes from a vector to a socket at
 static bool recv_all(int sockfd, void* buf, size_t len) {
@@ -38,42 +70,180 @@ static bool recv_all(int sockfd, void* buf, size_t len) {
 	return true;
 }
 
-// Helper method to send all bytes from a vector to a socket at
-static bool send_all(int sockfd, const std::vector<uint8_t>& data) {
+// Helper method to send all bytes of an encoded frame to a socket
+template <typename F> static bool send_all(int sockfd, const F& data) {
+	std::lock_guard<std::mutex> lock(send_mutex);
 	size_t total = 0, len = data.size();
 	ssize_t n;
 	while (total < len) {
-		if ((n = send(sockfd, data.data() + total, len - total, 0)) <= 0)
+		if ((n = send(sockfd, data.data() + total, len - total,
+					  MSG_NOSIGNAL)) <= 0)
 			return false;
 		total += static_cast<size_t>(n);
 	}
 	return true;
 }
 
+// Read frames from `fd` until the connection drops, answering pings and
+// queueing everything else for the game loop
+static void reader_loop(int fd) {
+	Frame f;
+	while (true) {
+		if (!recv_all(fd, &f.hdr, sizeof(f.hdr)))
+			break;
+		if (f.hdr.size > 0 && !recv_all(fd, f.pl.data(), f.hdr.size))
+			break;
+
+		// Echo the ping payload back unchanged
+		if (static_cast<MsgType>(f.hdr.type) == MsgType::PING) {
+			PL_Ping ping;
+			if (decode<MsgType::PING>(f.pl.data(), f.hdr.size, ping))
+				send_all(fd, encode<MsgType::PONG>(ping));
+			continue;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(inbox_mutex);
+			inbox_cv.wait(lock, [] { return inbox_count < INBOX_SLOTS; });
+			Frame& slot = inbox[(inbox_head + inbox_count) % INBOX_SLOTS];
+			slot.hdr = f.hdr;
+			std::memcpy(slot.pl.data(), f.pl.data(), f.hdr.size);
+			inbox_count++;
+		}
+		inbox_cv.notify_all();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		inbox_closed = true;
+	}
+	inbox_cv.notify_all();
+}
+
+// Wait for the next frame from the reader thread. Returns false once the
+// connection is gone and every frame has been handled
+static bool next_frame(MsgHeader& hdr,
+					   std::array<uint8_t, MAX_PAYLOAD>& pl) {
+	{
+		std::unique_lock<std::mutex> lock(inbox_mutex);
+		inbox_cv.wait(lock, [] { return inbox_count > 0 || inbox_closed; });
+		if (inbox_count == 0)
+			return false;
+		const Frame& f = inbox[inbox_head];
+		hdr = f.hdr;
+		std::memcpy(pl.data(), f.pl.data(), f.hdr.size);
+		inbox_head = (inbox_head + 1) % INBOX_SLOTS;
+		inbox_count--;
+	}
+	inbox_cv.notify_all();
+	return true;
+}
+
+// Connect a new socket to the server. Returns the fd or -1
+static int connect_server(const sockaddr_in& serv_addr) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	// Set socket timeout (30 seconds). The server pings every second or so
+	// while connected, so this only fires if the server has gone silent
+	struct timeval tv;
+	tv.tv_sec = 30;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+
+	if (connect(fd, (const sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Reconnect attempts after a dropped connection, and the backoff between
+// them (doubling up to the cap)
+constexpr int RECONNECT_ATTEMPTS = 8;
+constexpr int RECONNECT_BACKOFF_MS = 250;
+constexpr int RECONNECT_BACKOFF_MAX_MS = 4000;
+
+/**
+ * Reconnect after a dropped connection and ask to resume our seat with
+ * `token`, having seen events up to `last_seq`. The server answers with a
+ * WELCOME, the missed events and the current turn. Returns false if the
+ * server could not be reached
+ */
+static bool reconnect(const sockaddr_in& serv_addr, uint64_t token,
+					  uint16_t last_seq) {
+	int backoff = RECONNECT_BACKOFF_MS;
+	for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS; attempt++) {
+		std::cout << "Connection lost, reconnecting (attempt " << attempt
+				  << ")..." << std::endl;
+		std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+		backoff = std::min(backoff * 2, RECONNECT_BACKOFF_MAX_MS);
+
+		int fd = connect_server(serv_addr);
+		if (fd < 0)
+			continue;
+
+		PL_Resume req{};
+		req.token = token;
+		req.last_seq = htons(last_seq);
+		if (!send_all(fd, encode<MsgType::RESUME>(req))) {
+			close(fd);
+			continue;
+		}
+
+		// Swap in the new connection and restart the reader on it
+		{
+			std::lock_guard<std::mutex> lock(inbox_mutex);
+			inbox_closed = false;
+		}
+		close(sockfd);
+		sockfd = fd;
+		std::thread(reader_loop, fd).detach();
+		return true;
+	}
+	return false;
+}
+
 /**
  * Handle player input. Returns:
  * 0: Successful
  * 1: Quit input
  * 2: Unsucessful
+ * 3: Leaderboard or stats requested (still this player's move)
  */
 static int handle_input(int local_id) {
 	using std::cout, std::endl;
 	const char* color = (local_id == 1 ? C_P1 : C_P2);
 
-	cout << color << "Your move\nSelect cell 1-9\nPress q to quit: " << C_RST;
+	cout << color
+		 << "Your move\nSelect cell 1-9\nPress l for the leaderboard, s for "
+			"stats, q to quit: "
+		 << C_RST;
 	std::string in;
 	std::getline(std::cin, in);
 
 	// Quit input
 	if (in == "q") {
-		std::vector<uint8_t> out;
-		serialize(MsgType::QUIT_REQUEST, nullptr, 0, out);
-		send_all(sockfd, out);
+		send_all(sockfd, encode<MsgType::QUIT_REQUEST>());
 		cout << "You have exited the game. Goodbye." << endl;
 		close(sockfd);
 		return 1;
 	}
 
+	// Leaderboard input
+	if (in == "l") {
+		PL_LeaderboardReq req{(uint8_t)LEADERBOARD_MAX};
+		send_all(sockfd, encode<MsgType::LEADERBOARD_REQUEST>(req, sizeof(req)));
+		return 3;
+	}
+
+	// Stats input
+	if (in == "s") {
+		send_all(sockfd, encode<MsgType::STATS_REQUEST>());
+		return 3;
+	}
+
 	// Empty input check
 	if (in.empty()) {
 		cout << color << "Invalid input!" << C_RST << endl;
@@ -95,19 +265,107 @@ static int handle_input(int local_id) {
 		return 2;
 	}
 
-	PL_MovReq req{(uint8_t)pos};
-	std::vector<uint8_t> out;
-	serialize(MsgType::MOVE_REQUEST, &req, sizeof(req), out);
-	send_all(sockfd, out);
+	PL_MovReq req{(uint8_t)pos, {}, 0};
+	send_all(sockfd, encode<MsgType::MOVE_REQUEST>(req, sizeof(req)));
 	return 0;
 }
 
-// Handle SIGINT (ctrl + c) as another means to quit, as well as SIGTERM
+// Ask whether to play again after a match. Returns true for yes
+static bool prompt_rematch() {
+	while (true) {
+		std::cout << "Play again? (y/n): ";
+		std::string in;
+		if (!std::getline(std::cin, in) || in == "n" || in == "q")
+			return false;
+		if (in == "y")
+			return true;
+	}
+}
+
+// Prompt until the player moves (0), asks for the leaderboard or stats (3)
+// or quits (1)
+static int prompt_move(int local_id) {
+	while (true) {
+		int r = handle_input(local_id);
+		if (r != 2)
+			return r;
+	}
+}
+
+// Print a `size`-byte leaderboard reply
+static void display_leaderboard(const PL_Leaderboard& lb, size_t size) {
+	using std::cout, std::endl;
+
+	size_t header = offsetof(PL_Leaderboard, entries);
+	size_t count = std::min<size_t>(
+		{lb.count, LEADERBOARD_MAX, (size - header) / sizeof(PL_RatingEntry)});
+
+	cout << "\x1b[1m" << "--- Leaderboard ---" << C_RST << endl;
+	for (size_t i = 0; i < count; i++) {
+		const PL_RatingEntry& e = lb.entries[i];
+		std::string name(e.name, strnlen(e.name, PLAYER_NAME_LEN));
+		cout << " " << i + 1 << ". " << name << "  " << ntohs(e.rating)
+			 << " (" << ntohs(e.games) << " games)" << endl;
+	}
+	if (count == 0)
+		cout << " No rated players yet" << endl;
+	if (lb.self_rank)
+		cout << "You are #" << ntohl(lb.self_rank) << " with a rating of "
+			 << ntohs(lb.self_rating) << endl;
+}
+
+// Print a live analytics reply: opening heatmap, win rate by opening,
+// outcome ratios and average game length
+static void display_stats(const PL_Stats& st) {
+	using std::cout, std::endl;
+
+	uint32_t outcomes[3], games = 0, openings = 0;
+	for (int o = 0; o < 3; o++)
+		games += outcomes[o] = ntohl(st.outcomes[o]);
+	for (int i = 0; i < 9; i++)
+		openings += ntohl(st.opening[i]);
+	auto pct = [](uint32_t n, uint32_t of) {
+		return of ? 100 * double(n) / of : 0.0;
+	};
+
+	cout << "\x1b[1m" << "--- Stats ---" << C_RST << endl;
+	cout << " " << games << " games, " << ntohl(st.moves) << " moves";
+	if (games)
+		cout << ", " << double(ntohl(st.length_sum)) / games
+			 << " moves per game";
+	cout << endl;
+	cout.precision(3);
+	cout << " X wins " << pct(outcomes[0], games) << "%, O wins "
+		 << pct(outcomes[1], games) << "%, draws " << pct(outcomes[2], games)
+		 << "%" << endl;
+
+	// Share of openings per cell, laid out like the board
+	cout << " Opening moves (% of openings):" << endl;
+	for (int r = 0; r < 3; r++) {
+		cout << "  ";
+		for (int c = 0; c < 3; c++)
+			cout << std::setw(6) << pct(ntohl(st.opening[3 * r + c]), openings);
+		cout << endl;
+	}
+
+	cout << " X win rate by opening cell:" << endl;
+	for (int i = 0; i < 9; i++) {
+		uint32_t n = 0;
+		for (int o = 0; o < 3; o++)
+			n += ntohl(st.by_opening[i][o]);
+		if (n)
+			cout << "  " << i + 1 << ": " << pct(ntohl(st.by_opening[i][0]), n)
+				 << "% of " << n << endl;
+	}
+	cout.precision(6);
+}
+
+// Handle SIGINT (ctrl + c) as another means to quit, as well as SIGTERM.
+// Sends without send_mutex, which the interrupted thread may be holding
 static void handle_quit(int) {
 	if (sockfd != -1) {
-		std::vector<uint8_t> out;
-		serialize(MsgType::QUIT_REQUEST, nullptr, 0, out);
-		send_all(sockfd, out);
+		auto out = encode<MsgType::QUIT_REQUEST>();
+		send(sockfd, out.data(), out.size(), MSG_NOSIGNAL);
 		std::cout << "\nYou have exited the game. Goodbye." << std::endl;
 		close(sockfd);
 	}
@@ -129,17 +387,11 @@ int main(int argc, char* argv[]) {
 		portno = std::stoi(argv[2]);
 	}
 
-	/**
-	 * Open socket
-	 */
-	if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-		fatal_error(1, "Error opening socket");
-
-	// Set socket timeout (30 seconds)
-	struct timeval tv;
-	tv.tv_sec = 30;
-	tv.tv_usec = 0;
-	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+	// Player name used for ratings
+	std::string name = getenv("USER") ? getenv("USER") : "anonymous";
+	if (argc > 3) {
+		name = argv[3];
+	}
 
 	/**
 	 * Connect to server
@@ -148,51 +400,78 @@ int main(int argc, char* argv[]) {
 	serv_addr.sin_family = AF_INET;
 	serv_addr.sin_port = htons(portno);
 	inet_pton(AF_INET, address.c_str(), &serv_addr.sin_addr);
-	if (connect(sockfd, (sockaddr*)&serv_addr, sizeof(serv_addr)) < 0)
+	if ((sockfd = connect_server(serv_addr)) < 0)
 		fatal_error(1, "Error connecting to server");
 
 	cout << "Successfully connected to server at " << address << ":" << portno << endl;
 	signal(SIGINT, handle_quit);
 	signal(SIGTERM, handle_quit); // Another way of quitting (rarer)
 
+	// Identify ourselves so the server can rate our games
+	{
+		PL_Hello hello{};
+		std::memcpy(hello.name, name.data(),
+					std::min(name.size(), PLAYER_NAME_LEN - 1));
+		send_all(sockfd, encode<MsgType::HELLO>(hello, sizeof(hello)));
+	}
+
+	// Receive frames (and answer pings) in the background
+	std::thread(reader_loop, sockfd).detach();
+
 	// Store the player's id locally
 	int local_id = 0;
 	// Local game state
 	Game local_game;
-
-	/**
-	 * Main game loop
-	 */
-	while (true) {
-		/**
-		 * Read header
-		 */
-		MsgHeader hdr;
-		if (!recv_all(sockfd, &hdr, sizeof(hdr))) {
-			cout << "Disconnected from server" << endl;
-			break;
+	// Set while it is our move but we paused to view the leaderboard
+	bool awaiting_move = false;
+	// Token for resuming our seat, and the last move event seen
+	uint64_t resume_token = 0;
+	uint16_t last_seq = 0;
+	// Set after reconnecting, until the board has been caught up
+	bool resyncing = false;
+	// Payload buffer, reused for every message received
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+	// Set between the end of a match and the start of the next
+	bool game_over = false;
+	// Set once we asked for a rematch, until it starts
+	bool rematch_asked = false;
+	// Set once the player is done playing or quit
+	bool done = false;
+
+	// Prompt for our move, noting whether we paused for the leaderboard
+	auto prompt = [&] {
+		int r = prompt_move(local_id);
+		done = (r == 1);
+		awaiting_move = (r == 3);
+	};
+
+	// Show the final board and offer a rematch, or leave
+	auto end_match = [&] {
+		displayBoard(local_game);
+		game_over = true;
+		if (!prompt_rematch()) {
+			cout << "Thanks for playing. Goodbye." << endl;
+			close(sockfd);
+			done = true;
+			return;
 		}
-
-		/**
-		 * Read payload
-		 */
-		std::vector<uint8_t> pl(hdr.size);
-		if (hdr.size > 0) {
-			if (!recv_all(sockfd, pl.data(), hdr.size)) {
-				cout << "Disconnected from server" << endl;
-				break;
+		send_all(sockfd, encode<MsgType::REMATCH_REQUEST>());
+		rematch_asked = true;
+		cout << "Waiting for player " << 3 - local_id << " to accept..." << endl;
+	};
+
+	// Handle one decoded server message
+	auto on_message = [&](auto tag, const auto& msg, size_t size) {
+		constexpr MsgType type = decltype(tag)::value;
+
+		if constexpr (type == MsgType::WELCOME) {
+			local_id = msg.p_id;
+			resume_token = msg.resume_token;
+
+			if (resyncing) {
+				cout << "Reconnected as player " << local_id << endl;
+				return;
 			}
-		}
-
-		/**
-		 * Determine signal type and respond accordingly
-		 */
-		MsgType type = static_cast<MsgType>(hdr.type);
-		switch (type) {
-		case MsgType::WELCOME: {
-			PL_Welcome welcome;
-			memcpy(&welcome, pl.data(), sizeof(welcome));
-			local_id = welcome.p_id;
 
 			const char* color = (local_id == 1 ? C_P1 : C_P2);
 			cout << "\x1b[38;5;206m"
@@ -201,120 +480,170 @@ int main(int argc, char* argv[]) {
 					"By Nathan Ambrosino\n\n" C_RST
 				 << color << "Welcome, you are player " << local_id << C_RST
 				 << endl;
-		} break;
-
-		case MsgType::BOARD_UPDATE: {
-			PL_Board pl_b;
-			memcpy(&pl_b, pl.data(), sizeof(pl_b));
 
+		} else if constexpr (type == MsgType::BOARD_UPDATE) {
 			// Update local board state
 			auto& b = local_game.board();
 			for (int i = 0; i < 9; i++) {
-				b[i] = static_cast<Cell>(pl_b.cells[i]);
+				b[i] = static_cast<Cell>(msg.cells[i]);
 			}
 			displayBoard(local_game);
-		} break;
+			resyncing = false;
 
-		case MsgType::TURN: {
-			uint8_t turn = pl[0];
-			const char* color = (turn == 1 ? C_P1 : C_P2);
-			cout << color << "It's Player " << (int)turn << "'s turn" << C_RST
-				 << endl;
+		} else if constexpr (type == MsgType::MOVE_EVENT) {
+			last_seq = ntohs(msg.seq);
+
+			// Keep the local board current; it is displayed on
+			// BOARD_UPDATE, or on the next TURN while catching up
+			if (msg.pos < 9)
+				local_game.board()[msg.pos] = (msg.player == 1 ? Cell::X : Cell::O);
+
+		} else if constexpr (type == MsgType::TURN) {
+			if (resyncing) {
+				displayBoard(local_game);
+				resyncing = false;
+			}
+			const char* color = (msg.player == 1 ? C_P1 : C_P2);
+			cout << color << "It's Player " << (int)msg.player << "'s turn"
+				 << C_RST << endl;
 
 			// Current player's turn
-			if (turn == local_id)
-				while (true) {
-					int r = handle_input(local_id);
-					if (r == 0)
-						break;
-					if (r == 1)
-						return 0;
-				}
-		} break;
-
-		case MsgType::MOVE_RESULT: {
-			PL_MovRes mv_rs;
-			memcpy(&mv_rs, pl.data(), sizeof(mv_rs));
-
-			if (mv_rs.status == 0) {
+			if (msg.player == local_id)
+				prompt();
+
+		} else if constexpr (type == MsgType::MOVE_RESULT) {
+			if (msg.status == 0) {
 				cout << "Move successfully applied!" << endl;
 			} else {
 				cout << "Invalid move!" << endl;
-				while (true) {
-					int r = handle_input(local_id);
-					if (r == 0)
-						break;
-					if (r == 1)
-						return 0;
-				}
+				prompt();
 			}
-		} break;
 
-		case MsgType::WIN: {
-			uint8_t winner = pl[0];
+		} else if constexpr (type == MsgType::WIN) {
+			bool won = (msg.winner == local_id);
 			// Bright green for win, bright red for loss
-			const char* color =
-				(winner == local_id ? "\x1b[38;5;46m" : "\x1b[38;5;196m");
+			const char* color = (won ? "\x1b[38;5;46m" : "\x1b[38;5;196m");
 			cout << color << "*** GAME OVER: ";
-			if (winner == local_id) {
+			if (won) {
 				cout << "YOU WIN! ***" << C_RST << endl;
 			} else {
 				cout << "YOU LOSE! ***" << C_RST << endl;
 			}
-			displayBoard(local_game);
-			close(sockfd);
-			return 0;
-		} break;
+			end_match();
 
-		case MsgType::DRAW: {
+		} else if constexpr (type == MsgType::DRAW) {
 			cout << "\x1b[38;5;51m"
 					"*** GAME OVER: It's a draw! ***"
 					"\x1b[0m\n";
-			displayBoard(local_game);
-			close(sockfd);
-			return 0;
-		} break;
-
-		case MsgType::ERROR: {
-			if (pl.size() >= sizeof(PL_Error)) {
-				PL_Error err;
-				memcpy(&err, pl.data(), sizeof(err));
-				const char* err_msg = "Unknown error";
-				
-				switch ((GameErr)err.error_code) {
-					case GameErr::MOVE_OUT_OF_TURN:
-						err_msg = "It's not your turn!";
-						break;
-					case GameErr::MOVE_INVALID:
-						err_msg = "Invalid move!";
-						break;
-					case GameErr::MOVE_CELL_OCCUPIED:
-						err_msg = "That cell is already occupied!";
-						break;
-					case GameErr::MALFORMED_MOVE_REQUEST:
-						err_msg = "Malformed move request sent";
-						break;
-					case GameErr::GAME_ALREADY_FINISHED:
-						err_msg = "Game is already finished";
-						break;
-					case GameErr::SERVER_FULL_ERROR:
-						err_msg = "Server is full!";
-						break;
-					case GameErr::TIMEOUT:
-						err_msg = "Connection timeout";
-						break;
-				}
-				cout << "\x1b[38;5;196m" << "Error: " << err_msg << C_RST << endl;
-			} else {
-				std::string m(pl.begin(), pl.end());
-				cout << "Server error: " << m << endl;
+			end_match();
+
+		} else if constexpr (type == MsgType::REMATCH) {
+			switch ((RematchStatus)msg.status) {
+				case RematchStatus::OFFERED:
+					// We answer at our own prompt; this only matters if we
+					// have not yet
+					if (!rematch_asked)
+						cout << "Player " << 3 - local_id
+							 << " wants a rematch" << endl;
+					break;
+				case RematchStatus::DECLINED:
+					cout << "Player " << 3 - local_id
+						 << " left, no rematch. Goodbye." << endl;
+					close(sockfd);
+					done = true;
+					break;
+				case RematchStatus::STARTED:
+					cout << "\x1b[1m" << "*** Rematch! ***" << C_RST << endl;
+					local_game.reset();
+					game_over = rematch_asked = false;
+					break;
 			}
-		} break;
 
-		default: {
+		} else if constexpr (type == MsgType::ERROR) {
+			const char* err_msg = "Unknown error";
+
+			switch ((GameErr)msg.error_code) {
+				case GameErr::MOVE_OUT_OF_TURN:
+					err_msg = "It's not your turn!";
+					break;
+				case GameErr::MOVE_INVALID:
+					err_msg = "Invalid move!";
+					break;
+				case GameErr::MOVE_CELL_OCCUPIED:
+					err_msg = "That cell is already occupied!";
+					break;
+				case GameErr::MALFORMED_MOVE_REQUEST:
+					err_msg = "Malformed move request sent";
+					break;
+				case GameErr::GAME_ALREADY_FINISHED:
+					err_msg = "Game is already finished";
+					break;
+				case GameErr::SERVER_FULL_ERROR:
+					err_msg = "Server is full!";
+					break;
+				case GameErr::TIMEOUT:
+					err_msg = "Connection timeout";
+					break;
+				case GameErr::RESUME_REJECTED:
+					err_msg = "Could not resume the game";
+					resume_token = 0;
+					break;
+				case GameErr::UNEXPECTED_MESSAGE:
+					err_msg = "Server did not expect that message";
+					break;
+				case GameErr::UNKNOWN_MATCH:
+					err_msg = "No such match";
+					break;
+				case GameErr::TOO_MANY_MATCHES:
+					err_msg = "Seated in too many matches";
+					break;
+			}
+			cout << "\x1b[38;5;196m" << "Error: " << err_msg << C_RST << endl;
+
+		} else if constexpr (type == MsgType::STATS ||
+							 type == MsgType::LEADERBOARD) {
+			if constexpr (type == MsgType::STATS)
+				display_stats(msg);
+			else
+				display_leaderboard(msg, size);
+			if (awaiting_move)
+				prompt();
+
+		} else {
+			cout << "ERR: Unexpected message type received!" << endl;
+		}
+	};
+
+	/**
+	 * Main game loop
+	 */
+	while (true) {
+		/**
+		 * Wait for the next frame from the reader thread
+		 */
+		MsgHeader hdr;
+		if (!next_frame(hdr, pl)) {
+			// Mid-game: try to get our seat back
+			if (resume_token != 0 && !game_over &&
+				reconnect(serv_addr, resume_token, last_seq)) {
+				resyncing = true;
+				awaiting_move = false;
+				continue;
+			}
+			cout << "Disconnected from server" << endl;
+			break;
+		}
+
+		/**
+		 * Determine signal type and respond accordingly
+		 */
+		int rc = dispatch(hdr, pl.data(), on_message);
+		if (rc == (int)ProtoErr::INVALID_TYPE)
 			cout << "ERR: Undefined message type received!" << endl;
-		} break;
-		} // signal switch
+		else if (rc != 0)
+			cout << "ERR: Malformed message received!" << endl;
+		if (done)
+			return 0;
 
 	} // main game loop
 
@@ -0,0 +1,34 @@
+#include "eventlog.hh"
+
+#include <random>
+
+using namespace TTT_PROTO;
+
+uint16_t EventLog::append(uint8_t pos, uint8_t player) {
+	m_seq++;
+	m_events[m_seq % CAP] = PL_MoveEvent{m_seq, pos, player};
+	return m_seq;
+}
+
+bool EventLog::since(uint16_t last_seq, std::vector<PL_MoveEvent>& out) const {
+	// Distances modulo 2^16, so the checks hold across wraparound
+	uint16_t missed = uint16_t(m_seq - last_seq);
+	if (missed > uint16_t(m_seq - m_base) || missed > CAP)
+		return false;
+	for (uint16_t i = 1; i <= missed; i++)
+		out.push_back(m_events[uint16_t(last_seq + i) % CAP]);
+	return true;
+}
+
+void EventLog::clear() {
+	m_base = m_seq;
+	m_result = -1;
+}
+
+uint64_t new_resume_token() {
+	static std::mt19937_64 rng(std::random_device{}());
+	uint64_t t;
+	while ((t = rng()) == 0)
+		;
+	return t;
+}
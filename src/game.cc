@@ -16,9 +16,9 @@ static const int WIN_COMBOS[8][3] = {
 
 Game::Game() { reset(); }
 
-void Game::reset() {
+void Game::reset(Player first) {
 	m_board.fill(Cell::EMPTY);
-	m_current = Player::P1;
+	m_current = first;
 }
 
 bool Game::move(int pos, Player p) {
@@ -70,4 +70,4 @@ void Game::switchPlayer() {
 	} else {
 		m_current = Player::P1;
 	}
-}
\ No newline at end of file
+}
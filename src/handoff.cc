@@ -0,0 +1,174 @@
+#include "handoff.hh"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+ReaderGate::ReaderGate() {
+	if (pipe2(m_wake, O_CLOEXEC | O_NONBLOCK) < 0)
+		m_wake[0] = m_wake[1] = -1;
+}
+
+ReaderGate::~ReaderGate() {
+	if (m_wake[0] != -1) {
+		close(m_wake[0]);
+		close(m_wake[1]);
+	}
+}
+
+void ReaderGate::enter() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_readers++;
+}
+
+void ReaderGate::leave() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_readers--;
+	m_cv.notify_all();
+}
+
+void ReaderGate::wait(int fd) {
+	pollfd pfd[2] = {{fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+	while (true) {
+		if (poll(pfd, m_wake[0] == -1 ? 1 : 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		// A stop wins over a frame that is ready: it stays in the socket
+		if (!(pfd[1].revents & POLLIN))
+			return;
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_parked++;
+		m_cv.notify_all();
+		m_cv.wait(lock, [this] { return !m_stopped; });
+		m_parked--;
+	}
+}
+
+bool ReaderGate::stop(int timeout_ms) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_stopped = true;
+	char c = 0;
+	if (m_wake[1] == -1 || write(m_wake[1], &c, 1) != 1)
+		return false;
+	return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+						 [this] { return m_parked == m_readers; });
+}
+
+void ReaderGate::resume() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	char c;
+	while (m_wake[0] != -1 && read(m_wake[0], &c, 1) == 1)
+		;
+	m_stopped = false;
+	m_cv.notify_all();
+}
+
+// Fill a sockaddr_un for `path`. Returns false if the path is too long
+static bool make_addr(const std::string& path, sockaddr_un& addr) {
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	std::memcpy(addr.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+int handoff_listen(const std::string& path) {
+	sockaddr_un addr;
+	if (!make_addr(path, addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int handoff_connect(const std::string& path) {
+	sockaddr_un addr;
+	if (!make_addr(path, addr))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool handoff_send(int unix_fd, const HandoffState& state, const int* fds,
+				  int nfds) {
+	if (nfds < 0 || nfds > HANDOFF_MAX_FDS)
+		return false;
+
+	iovec iov;
+	iov.iov_base = const_cast<HandoffState*>(&state);
+	iov.iov_len = sizeof(state);
+
+	// Control buffer sized for the maximum, aligned for cmsghdr
+	alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	std::memset(ctrl, 0, sizeof(ctrl));
+
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (nfds > 0) {
+		msg.msg_control = ctrl;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+		cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		std::memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+	}
+
+	return sendmsg(unix_fd, &msg, 0) == (ssize_t)sizeof(state);
+}
+
+int handoff_recv(int unix_fd, HandoffState& state, int* fds) {
+	iovec iov;
+	iov.iov_base = &state;
+	iov.iov_len = sizeof(state);
+
+	alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	if (recvmsg(unix_fd, &msg, MSG_WAITALL) != (ssize_t)sizeof(state))
+		return -1;
+	if (msg.msg_flags & MSG_CTRUNC)
+		return -1;
+
+	int nfds = 0;
+	for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+			continue;
+		nfds = int((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		std::memcpy(fds, CMSG_DATA(cm), sizeof(int) * nfds);
+	}
+	return nfds;
+}
@@ -0,0 +1,56 @@
+#include "hashring.hh"
+
+#include <algorithm>
+
+uint64_t hash64(uint64_t x) {
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// FNV-1a of a node name, so a node lands on the same points in every
+// process regardless of its id
+static uint64_t hash_name(const std::string& name) {
+	uint64_t h = 0xCBF29CE484222325ull;
+	for (unsigned char c : name) {
+		h ^= c;
+		h *= 0x100000001B3ull;
+	}
+	return h;
+}
+
+void HashRing::add(uint32_t id, const std::string& name) {
+	remove(id);
+	uint64_t seed = hash_name(name);
+	for (int i = 0; i < VNODES; i++)
+		m_points.emplace_back(hash64(seed + uint64_t(i)), id);
+	std::sort(m_points.begin(), m_points.end());
+}
+
+void HashRing::remove(uint32_t id) {
+	std::erase_if(m_points, [id](const auto& p) { return p.second == id; });
+}
+
+bool HashRing::contains(uint32_t id) const {
+	return std::any_of(m_points.begin(), m_points.end(),
+					   [id](const auto& p) { return p.second == id; });
+}
+
+void HashRing::walk(uint64_t key, std::vector<uint32_t>& out) const {
+	out.clear();
+	if (m_points.empty())
+		return;
+
+	uint64_t h = hash64(key);
+	auto it = std::lower_bound(m_points.begin(), m_points.end(),
+							   std::make_pair(h, uint32_t(0)));
+	size_t start = size_t(it - m_points.begin());
+	for (size_t i = 0; i < m_points.size(); i++) {
+		uint32_t id = m_points[(start + i) % m_points.size()].second;
+		if (std::find(out.begin(), out.end(), id) == out.end())
+			out.push_back(id);
+		if (out.size() == m_points.size() / VNODES)
+			break;
+	}
+}
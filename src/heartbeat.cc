@@ -0,0 +1,190 @@
+#include "heartbeat.hh"
+#include "log.hh"
+#include "message.hh"
+#include "perthread.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace TTT_PROTO;
+
+HeartbeatConfig heartbeat_config;
+
+// Fastest ping rate used while a pong is overdue
+static constexpr uint64_t MIN_INTERVAL_NS = 100'000'000;
+// How often the heartbeat thread wakes up
+static constexpr auto TICK = std::chrono::milliseconds(50);
+
+static std::mutex peers_mutex;
+static std::vector<PeerHealth*> peers;
+// Set by heartbeat_pause(): ticks leave every peer alone (peers_mutex)
+static bool paused = false;
+
+// RTT histogram: bucket i counts samples in [2^i, 2^(i+1)) microseconds
+static std::atomic<uint64_t> rtt_buckets[40];
+static std::atomic<uint64_t> rtt_max_us(0);
+
+PeerHealth::PeerHealth(int sockfd, SendQueue& queue)
+	: m_fd(sockfd), m_queue(queue) {
+	uint64_t now = monotonic_ns();
+	m_interval_ns = uint64_t(heartbeat_config.interval_ms) * 1'000'000;
+	m_last_heard_ns = now;
+	m_next_ping_ns = now + m_interval_ns;
+}
+
+void PeerHealth::heard() {
+	uint64_t now = monotonic_ns();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_last_heard_ns = now;
+}
+
+void PeerHealth::pong(uint64_t stamp_ns, uint64_t now) {
+	if (stamp_ns == 0 || stamp_ns > now)
+		return;
+	uint64_t rtt = now - stamp_ns;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_last_heard_ns = now;
+		m_last_pong_ns = now;
+
+		// RFC 6298 smoothing: alpha = 1/8, beta = 1/4
+		if (m_samples == 0) {
+			m_srtt_ns = rtt;
+			m_rttvar_ns = rtt / 2;
+		} else {
+			uint64_t err = rtt > m_srtt_ns ? rtt - m_srtt_ns : m_srtt_ns - rtt;
+			m_rttvar_ns = (3 * m_rttvar_ns + err) / 4;
+			m_srtt_ns = (7 * m_srtt_ns + rtt) / 8;
+		}
+		m_samples++;
+
+		// Healthy again: back to the normal schedule
+		m_interval_ns = uint64_t(heartbeat_config.interval_ms) * 1'000'000;
+	}
+
+	uint64_t us = std::max<uint64_t>(rtt / 1000, 1);
+	size_t bucket = std::min<size_t>(std::bit_width(us) - 1, 39);
+	rtt_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	uint64_t prev = rtt_max_us.load(std::memory_order_relaxed);
+	while (us > prev && !rtt_max_us.compare_exchange_weak(prev, us))
+		;
+}
+
+uint64_t PeerHealth::srtt_us() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_srtt_ns / 1000;
+}
+
+uint64_t PeerHealth::jitter_us() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_rttvar_ns / 1000;
+}
+
+uint32_t PeerHealth::samples() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_samples;
+}
+
+void heartbeat_tick(uint64_t now) {
+	uint64_t dead_after =
+		uint64_t(heartbeat_config.dead_after_ms) * 1'000'000;
+
+	std::lock_guard<std::mutex> lock(peers_mutex);
+	if (paused)
+		return;
+	for (PeerHealth* p : peers) {
+		std::lock_guard<std::mutex> peer_lock(p->m_mutex);
+		if (p->m_dead)
+			continue;
+
+		/**
+		 * Dead peer: silent for the whole window. Shutting the socket down
+		 * makes the session's recv fail, which ends it normally
+		 */
+		if (now - p->m_last_heard_ns >= dead_after) {
+			LOG_WARN(NET, "Socket {} silent for {} ms, disconnecting", p->m_fd,
+					 (now - p->m_last_heard_ns) / 1'000'000);
+			p->m_dead = true;
+			shutdown(p->m_fd, SHUT_RDWR);
+			continue;
+		}
+
+		if (now < p->m_next_ping_ns)
+			continue;
+
+		/**
+		 * A pong is overdue if the last ping has been unanswered for longer
+		 * than the retransmission timeout (srtt + 4 * rttvar). Probe faster
+		 * until it answers so a dead peer is noticed early
+		 */
+		bool outstanding = p->m_last_ping_ns > p->m_last_pong_ns;
+		uint64_t rto = p->m_srtt_ns + 4 * p->m_rttvar_ns;
+		if (outstanding && now - p->m_last_ping_ns > rto)
+			p->m_interval_ns = std::max(p->m_interval_ns / 2, MIN_INTERVAL_NS);
+
+		p->m_queue.push(encode<MsgType::PING>(PL_Ping{now}));
+		p->m_last_ping_ns = now;
+		p->m_next_ping_ns = now + p->m_interval_ns;
+	}
+}
+
+void heartbeat_start() {
+	static std::once_flag started;
+	std::call_once(started, [] {
+		std::thread([] {
+			while (true) {
+				std::this_thread::sleep_for(TICK);
+				heartbeat_tick(monotonic_ns());
+			}
+		}).detach();
+	});
+}
+
+void heartbeat_add(PeerHealth* peer) {
+	std::lock_guard<std::mutex> lock(peers_mutex);
+	peers.push_back(peer);
+}
+
+void heartbeat_remove(PeerHealth* peer) {
+	std::lock_guard<std::mutex> lock(peers_mutex);
+	peers.erase(std::remove(peers.begin(), peers.end(), peer), peers.end());
+}
+
+void heartbeat_pause(bool pause) {
+	std::lock_guard<std::mutex> lock(peers_mutex);
+	paused = pause;
+}
+
+RttSummary rtt_summary() {
+	uint64_t counts[40];
+	RttSummary s{};
+	for (size_t i = 0; i < 40; i++) {
+		counts[i] = rtt_buckets[i].load(std::memory_order_relaxed);
+		s.samples += counts[i];
+	}
+	s.max_us = rtt_max_us.load(std::memory_order_relaxed);
+
+	// Upper bound of the bucket holding the q-th quantile
+	auto quantile = [&](double q) -> uint64_t {
+		uint64_t target = uint64_t(q * double(s.samples - 1)) + 1, seen = 0;
+		for (size_t i = 0; i < 40; i++) {
+			seen += counts[i];
+			if (seen >= target)
+				return std::min(uint64_t(2) << i, s.max_us);
+		}
+		return s.max_us;
+	};
+
+	if (s.samples > 0) {
+		s.p50_us = quantile(0.50);
+		s.p90_us = quantile(0.90);
+		s.p99_us = quantile(0.99);
+	}
+	return s;
+}
@@ -0,0 +1,496 @@
+#include "history.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+constexpr char FILE_MAGIC[4] = {'T', 'T', 'T', 'H'};
+constexpr char BLOCK_MAGIC[4] = {'T', 'T', 'T', 'B'};
+constexpr char LOG_MAGIC[4] = {'T', 'T', 'T', 'L'};
+constexpr uint32_t VERSION = 1;
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+};
+
+// Row log header, followed by raw MatchRow records. `base` is the size of
+// the history file the rows follow; once their block is appended the file
+// outgrows it, so a log left behind by a crash is known to be stale
+struct LogHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t base;
+};
+
+std::string log_path(const std::string& path) { return path + ".tail"; }
+
+// Columns stored in every block, in on-disk order
+enum Column { PLAYER_X, PLAYER_O, OUTCOME, MOVE_COUNT, MOVES, NUM_COLUMNS };
+
+// Per-column block metadata. Values are stored as (value - min) in `bits`
+// bits each, packed into `words` 64-bit words
+struct ColumnInfo {
+	uint64_t min;
+	uint64_t max;
+	uint32_t bits;
+	uint32_t words;
+};
+
+struct BlockHeader {
+	char magic[4];
+	uint32_t rows;
+	ColumnInfo cols[NUM_COLUMNS];
+};
+static_assert(sizeof(BlockHeader) % sizeof(uint64_t) == 0);
+
+uint64_t column_value(const MatchRow& r, int c) {
+	switch (c) {
+	case PLAYER_X:
+		return r.player_x;
+	case PLAYER_O:
+		return r.player_o;
+	case OUTCOME:
+		return uint64_t(r.outcome);
+	case MOVE_COUNT:
+		return r.move_count;
+	default:
+		return r.moves;
+	}
+}
+
+// Bit-pack `n` values of `bits` bits each onto the end of `out`
+void pack(const uint64_t* values, size_t n, uint32_t bits,
+		  std::vector<uint64_t>& out) {
+	if (bits == 0)
+		return;
+	size_t base = out.size();
+	out.resize(base + (n * bits + 63) / 64, 0);
+	uint64_t* words = out.data() + base;
+
+	for (size_t i = 0; i < n; i++) {
+		size_t bit = i * bits;
+		size_t w = bit / 64, off = bit % 64;
+		words[w] |= values[i] << off;
+		if (off + bits > 64)
+			words[w + 1] |= values[i] >> (64 - off);
+	}
+}
+
+// Value `i` of a packed column
+inline uint64_t unpack_one(const uint64_t* words, const ColumnInfo& c,
+						   size_t i) {
+	if (c.bits == 0)
+		return c.min;
+	uint64_t mask = c.bits == 64 ? ~0ull : (1ull << c.bits) - 1;
+	size_t bit = i * c.bits;
+	size_t w = bit / 64, off = bit % 64;
+	uint64_t v = words[w] >> off;
+	if (off + c.bits > 64)
+		v |= words[w + 1] << (64 - off);
+	return (v & mask) + c.min;
+}
+
+// Decode a whole packed column into `out`
+template <typename T>
+void unpack(const uint64_t* words, const ColumnInfo& c, size_t n, T* out) {
+	if (c.bits == 0) {
+		std::fill(out, out + n, T(c.min));
+		return;
+	}
+	for (size_t i = 0; i < n; i++)
+		out[i] = T(unpack_one(words, c, i));
+}
+
+// Encode `n` rows as a block: its header, then each column packed in turn
+void encode_block(const MatchRow* rows, size_t n, std::vector<uint64_t>& out) {
+	BlockHeader h{};
+	std::memcpy(h.magic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC));
+	h.rows = uint32_t(n);
+
+	std::vector<uint64_t> values(n);
+	out.assign(sizeof(h) / sizeof(uint64_t), 0);
+
+	for (int c = 0; c < NUM_COLUMNS; c++) {
+		ColumnInfo& info = h.cols[c];
+		info.min = ~0ull;
+		info.max = 0;
+		for (size_t i = 0; i < n; i++) {
+			uint64_t v = column_value(rows[i], c);
+			info.min = std::min(info.min, v);
+			info.max = std::max(info.max, v);
+		}
+		for (size_t i = 0; i < n; i++)
+			values[i] = column_value(rows[i], c) - info.min;
+
+		info.bits = uint32_t(std::bit_width(info.max - info.min));
+		size_t before = out.size();
+		pack(values.data(), n, info.bits, out);
+		info.words = uint32_t(out.size() - before);
+	}
+	std::memcpy(out.data(), &h, sizeof(h));
+}
+
+// Read the row log at `fd` into `rows`, if it follows a history file of
+// `size` bytes. Returns false if it is empty, damaged or stale. A torn last
+// record is left out
+bool read_log(int fd, uint64_t size, std::vector<MatchRow>& rows) {
+	LogHeader h;
+	struct stat st;
+	if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+		std::memcmp(h.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+		h.version != VERSION || h.base != size || fstat(fd, &st) < 0)
+		return false;
+
+	size_t n = std::min((size_t(st.st_size) - sizeof(h)) / sizeof(MatchRow),
+						HISTORY_BLOCK_ROWS - 1);
+	rows.resize(n);
+	size_t bytes = n * sizeof(MatchRow);
+	if (pread(fd, rows.data(), bytes, sizeof(h)) == (ssize_t)bytes)
+		return true;
+	rows.clear();
+	return false;
+}
+
+} // namespace
+
+/**
+ * Writer
+ */
+
+HistoryWriter::~HistoryWriter() {
+	if (m_flusher.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_flusher.join();
+	}
+	flush();
+	if (m_fd != -1)
+		close(m_fd);
+	if (m_log_fd != -1)
+		close(m_log_fd);
+}
+
+bool HistoryWriter::open(const std::string& path, unsigned flush_ms) {
+	m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (m_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) < 0)
+		return false;
+
+	FileHeader h{};
+	if (st.st_size == 0) {
+		std::memcpy(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+		h.version = VERSION;
+		if (write(m_fd, &h, sizeof(h)) != (ssize_t)sizeof(h))
+			return false;
+	} else if (pread(m_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+			   std::memcmp(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+			   h.version != VERSION) {
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	/**
+	 * Pick up the rows a previous writer logged but never put in a block
+	 */
+	m_log_fd = ::open(log_path(path).c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_log_fd < 0 || fstat(m_fd, &st) < 0) {
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+	m_rows.reserve(HISTORY_BLOCK_ROWS);
+	if (read_log(m_log_fd, uint64_t(st.st_size), m_rows)) {
+		m_logged = m_rows.size();
+	} else if (!reset_log()) {
+		close(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	if (flush_ms > 0)
+		m_flusher = std::thread(&HistoryWriter::flush_loop, this, flush_ms);
+	return true;
+}
+
+void HistoryWriter::flush_loop(unsigned flush_ms) {
+	// Signals are handled elsewhere; keep them off this thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		m_wake.wait_for(lock, std::chrono::milliseconds(flush_ms));
+		if (m_fd != -1)
+			write_log();
+	}
+}
+
+void HistoryWriter::append(const MatchRow& row) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_fd == -1)
+		return;
+	m_rows.push_back(row);
+	if (m_rows.size() >= HISTORY_BLOCK_ROWS)
+		write_block();
+}
+
+void HistoryWriter::flush() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_fd != -1)
+		write_log();
+}
+
+void HistoryWriter::write_block() {
+	std::vector<uint64_t> block;
+	encode_block(m_rows.data(), m_rows.size(), block);
+
+	// One write per block; a failed write is cut off again so the file
+	// never ends in a torn block
+	size_t bytes = block.size() * sizeof(uint64_t);
+	off_t end = lseek(m_fd, 0, SEEK_END);
+	if (write(m_fd, block.data(), bytes) != (ssize_t)bytes &&
+		ftruncate(m_fd, end) < 0)
+		m_fd = -1;
+
+	m_rows.clear();
+	if (m_fd != -1)
+		reset_log();
+}
+
+void HistoryWriter::write_log() {
+	size_t n = m_rows.size() - m_logged;
+	if (n == 0)
+		return;
+
+	// Written at a fixed offset, so rows that fail to go out are written
+	// over on the next flush
+	off_t off = off_t(sizeof(LogHeader) + m_logged * sizeof(MatchRow));
+	size_t bytes = n * sizeof(MatchRow);
+	if (pwrite(m_log_fd, m_rows.data() + m_logged, bytes, off) ==
+		(ssize_t)bytes)
+		m_logged = m_rows.size();
+}
+
+bool HistoryWriter::reset_log() {
+	// Emptied before the header moves on, so a crash in between leaves a
+	// log with no rows rather than rows tied to the new file size
+	m_logged = 0;
+	if (ftruncate(m_log_fd, 0) < 0)
+		return false;
+
+	LogHeader h{};
+	std::memcpy(h.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+	h.version = VERSION;
+	h.base = uint64_t(lseek(m_fd, 0, SEEK_END));
+	return pwrite(m_log_fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+}
+
+/**
+ * Reader
+ */
+
+HistoryReader::~HistoryReader() {
+	if (m_map)
+		munmap(const_cast<uint8_t*>(m_map), m_size);
+}
+
+bool HistoryReader::open(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(FileHeader)) {
+		close(fd);
+		return false;
+	}
+
+	m_size = size_t(st.st_size);
+	void* mem = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return false;
+	m_map = static_cast<const uint8_t*>(mem);
+
+	const FileHeader* fh = reinterpret_cast<const FileHeader*>(m_map);
+	if (std::memcmp(fh->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+		fh->version != VERSION)
+		return false;
+
+	/**
+	 * Index the blocks, stopping at a truncated trailing block
+	 */
+	size_t off = sizeof(FileHeader);
+	while (off + sizeof(BlockHeader) <= m_size) {
+		const BlockHeader* bh = reinterpret_cast<const BlockHeader*>(m_map + off);
+		if (std::memcmp(bh->magic, BLOCK_MAGIC, sizeof(BLOCK_MAGIC)) != 0)
+			break;
+
+		size_t words = 0;
+		for (const ColumnInfo& c : bh->cols)
+			words += c.words;
+		size_t bytes = sizeof(BlockHeader) + words * sizeof(uint64_t);
+		if (off + bytes > m_size || bh->rows > HISTORY_BLOCK_ROWS)
+			break;
+
+		m_blocks.push_back({m_map + off, m_rows});
+		m_rows += bh->rows;
+		off += bytes;
+	}
+
+	/**
+	 * Rows still in the row log go last, packed like any other block
+	 */
+	int log_fd = ::open(log_path(path).c_str(), O_RDONLY);
+	if (log_fd >= 0) {
+		std::vector<MatchRow> rows;
+		if (read_log(log_fd, m_size, rows) && !rows.empty()) {
+			encode_block(rows.data(), rows.size(), m_tail);
+			m_blocks.push_back(
+				{reinterpret_cast<const uint8_t*>(m_tail.data()), m_rows});
+			m_rows += rows.size();
+		}
+		close(log_fd);
+	}
+	return true;
+}
+
+HistoryResult HistoryReader::run(const HistoryQuery& q, unsigned threads,
+								 size_t limit) const {
+	using Result = HistoryQuery::Result;
+
+	HistoryResult total;
+	total.blocks = m_blocks.size();
+	threads = std::max(1u, std::min<unsigned>(threads, m_blocks.size()));
+
+	// Loop-invariant parts of the predicate, as 0/1 bytes so the row loop
+	// compiles to straight-line vector code
+	const bool any_player = q.player < 0;
+	const uint32_t pid = any_player ? 0 : uint32_t(q.player);
+	const uint8_t allow_x = q.role != 'O', allow_o = q.role != 'X';
+	const uint8_t want_any = q.result == Result::ANY;
+	const uint8_t want_win = q.result == Result::WIN;
+	const uint8_t want_loss = q.result == Result::LOSS;
+	const uint8_t want_draw = q.result == Result::DRAW;
+	const uint8_t lo = q.min_moves, hi = q.max_moves;
+
+	// Can a block with these column bounds contain a match?
+	auto may_match = [&](const BlockHeader* bh) {
+		const ColumnInfo* c = bh->cols;
+		if (c[MOVE_COUNT].max < lo || c[MOVE_COUNT].min > hi)
+			return false;
+		if (!any_player) {
+			bool x = allow_x && pid >= c[PLAYER_X].min && pid <= c[PLAYER_X].max;
+			bool o = allow_o && pid >= c[PLAYER_O].min && pid <= c[PLAYER_O].max;
+			if (!x && !o)
+				return false;
+		}
+		if (want_draw && c[OUTCOME].max < uint64_t(Outcome::DRAW))
+			return false;
+		if ((want_win || want_loss) && c[OUTCOME].min == uint64_t(Outcome::DRAW))
+			return false;
+		return true;
+	};
+
+	std::atomic<size_t> next(0);
+	std::vector<HistoryResult> partial(threads);
+
+	auto worker = [&](HistoryResult& res) {
+		std::vector<uint32_t> px(HISTORY_BLOCK_ROWS), po(HISTORY_BLOCK_ROWS);
+		std::vector<uint8_t> oc(HISTORY_BLOCK_ROWS), mc(HISTORY_BLOCK_ROWS);
+		std::vector<uint8_t> sel(HISTORY_BLOCK_ROWS);
+
+		size_t b;
+		while ((b = next.fetch_add(1)) < m_blocks.size()) {
+			const BlockHeader* bh =
+				reinterpret_cast<const BlockHeader*>(m_blocks[b].data);
+			if (!may_match(bh)) {
+				res.skipped++;
+				continue;
+			}
+
+			// Column start offsets within the block
+			const uint64_t* col[NUM_COLUMNS];
+			const uint64_t* w = reinterpret_cast<const uint64_t*>(bh + 1);
+			for (int c = 0; c < NUM_COLUMNS; c++) {
+				col[c] = w;
+				w += bh->cols[c].words;
+			}
+
+			size_t n = bh->rows;
+			unpack(col[PLAYER_X], bh->cols[PLAYER_X], n, px.data());
+			unpack(col[PLAYER_O], bh->cols[PLAYER_O], n, po.data());
+			unpack(col[OUTCOME], bh->cols[OUTCOME], n, oc.data());
+			unpack(col[MOVE_COUNT], bh->cols[MOVE_COUNT], n, mc.data());
+
+			uint64_t count = 0;
+			for (size_t i = 0; i < n; i++) {
+				uint8_t isx = uint8_t((px[i] == pid) | any_player) & allow_x;
+				uint8_t iso = uint8_t((po[i] == pid) | any_player) & allow_o;
+				uint8_t xw = oc[i] == uint8_t(Outcome::X_WIN);
+				uint8_t ow = oc[i] == uint8_t(Outcome::O_WIN);
+				uint8_t dr = oc[i] == uint8_t(Outcome::DRAW);
+
+				uint8_t win = (isx & xw) | (iso & ow);
+				uint8_t loss = (isx & ow) | (iso & xw);
+				uint8_t either = isx | iso;
+				uint8_t res_ok = (win & want_win) | (loss & want_loss) |
+								 (either & dr & want_draw) | (either & want_any);
+
+				sel[i] = res_ok & (mc[i] >= lo) & (mc[i] <= hi);
+				count += sel[i];
+			}
+			res.matched += count;
+			res.scanned += n;
+
+			// Materialize sample rows, decoding moves only for matches
+			for (size_t i = 0; i < n && count && res.rows.size() < limit; i++) {
+				if (!sel[i])
+					continue;
+				MatchRow r{px[i], po[i], Outcome(oc[i]), mc[i],
+						   unpack_one(col[MOVES], bh->cols[MOVES], i)};
+				res.rows.push_back({m_blocks[b].first_row + i, r});
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; t++)
+		pool.emplace_back(worker, std::ref(partial[t]));
+	if (!partial.empty())
+		worker(partial[0]);
+	for (auto& t : pool)
+		t.join();
+
+	for (auto& p : partial) {
+		total.matched += p.matched;
+		total.scanned += p.scanned;
+		total.skipped += p.skipped;
+		total.rows.insert(total.rows.end(), p.rows.begin(), p.rows.end());
+	}
+	std::sort(total.rows.begin(), total.rows.end(),
+			  [](const auto& a, const auto& b) { return a.first < b.first; });
+	if (total.rows.size() > limit)
+		total.rows.resize(limit);
+	return total;
+}
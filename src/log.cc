@@ -0,0 +1,263 @@
+#include "log.hh"
+#include "perthread.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace logger {
+
+std::atomic<uint8_t> min_level(uint8_t(Level::INFO));
+std::atomic<uint32_t> subsys_mask(~0u);
+
+namespace {
+
+struct Record {
+	uint64_t ts_ns;
+	const char* fmt;
+	Level level;
+	Subsys subsys;
+	uint8_t nargs;
+	Arg args[MAX_ARGS];
+};
+
+// Records buffered per thread before new ones are dropped
+constexpr uint64_t RING_SIZE = 1024;
+
+/**
+ * Single-producer, single-consumer ring. The owning thread advances `head`
+ * after writing a record; the writer thread advances `tail` after reading
+ */
+struct Ring {
+	Record records[RING_SIZE];
+	std::atomic<uint64_t> head{0};
+	std::atomic<uint64_t> tail{0};
+	std::atomic<uint64_t> dropped{0};
+	// False while a live thread owns the ring
+	std::atomic<bool> free{false};
+
+	// Only recycled once the writer has drained it
+	bool reusable() const { return tail.load() == head.load(); }
+};
+
+const char* LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+const char* SUBSYS_NAMES[] = {"net", "game", "queue", "shard", "restart",
+							  "trace", "route"};
+
+PerThread<Ring> rings;
+
+// Serializes draining between the writer thread and flush()
+std::mutex drain_mutex;
+// Process the writer thread was started in
+std::atomic<pid_t> writer_pid(0);
+uint64_t start_ns = 0;
+
+// Append a formatted record to `out`, substituting {} with arguments
+void format(const Record& r, std::string& out) {
+	char buf[64];
+	uint64_t rel = r.ts_ns > start_ns ? r.ts_ns - start_ns : 0;
+	std::snprintf(buf, sizeof(buf), "[%llu.%06llu] %-5s %s: ",
+				  (unsigned long long)(rel / 1000000000ull),
+				  (unsigned long long)(rel / 1000 % 1000000),
+				  LEVEL_NAMES[uint8_t(r.level)],
+				  SUBSYS_NAMES[uint8_t(r.subsys)]);
+	out += buf;
+
+	int next = 0;
+	for (const char* p = r.fmt; *p; p++) {
+		if (p[0] == '{' && p[1] == '}' && next < r.nargs) {
+			const Arg& a = r.args[next++];
+			switch (a.kind) {
+			case Arg::INT:
+				std::snprintf(buf, sizeof(buf), "%lld", (long long)a.i);
+				break;
+			case Arg::UINT:
+				std::snprintf(buf, sizeof(buf), "%llu",
+							  (unsigned long long)a.u);
+				break;
+			case Arg::DOUBLE:
+				std::snprintf(buf, sizeof(buf), "%g", a.d);
+				break;
+			case Arg::STR:
+				out += a.s ? a.s : "(null)";
+				buf[0] = '\0';
+				break;
+			}
+			out += buf;
+			p++;
+		} else {
+			out += *p;
+		}
+	}
+	out += '\n';
+}
+
+/**
+ * Move every buffered record out of the rings, order them by time and
+ * write them in one batch per stream
+ */
+void drain() {
+	static std::vector<Record> batch;
+	static std::string out_text, err_text;
+
+	std::lock_guard<std::mutex> drain_lock(drain_mutex);
+	batch.clear();
+	uint64_t dropped = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(rings.mutex());
+		for (auto& r : rings.items()) {
+			uint64_t tail = r->tail.load(std::memory_order_relaxed);
+			uint64_t head = r->head.load(std::memory_order_acquire);
+			for (; tail < head; tail++)
+				batch.push_back(r->records[tail % RING_SIZE]);
+			r->tail.store(tail, std::memory_order_release);
+			dropped += r->dropped.exchange(0);
+		}
+	}
+
+	if (batch.empty() && dropped == 0)
+		return;
+
+	std::stable_sort(batch.begin(), batch.end(),
+					 [](const Record& a, const Record& b) {
+						 return a.ts_ns < b.ts_ns;
+					 });
+
+	out_text.clear();
+	err_text.clear();
+	for (const Record& r : batch)
+		format(r, r.level >= Level::WARN ? err_text : out_text);
+	if (dropped > 0)
+		err_text += "[log] " + std::to_string(dropped) +
+					" record(s) dropped, writer falling behind\n";
+
+	if (!out_text.empty()) {
+		std::fwrite(out_text.data(), 1, out_text.size(), stdout);
+		std::fflush(stdout);
+	}
+	if (!err_text.empty()) {
+		std::fwrite(err_text.data(), 1, err_text.size(), stderr);
+		std::fflush(stderr);
+	}
+}
+
+/**
+ * fork() copies only the calling thread. Both locks are held across it, so
+ * the child never inherits one taken by the parent's writer mid-drain. The
+ * child then drops the records still buffered, which the parent writes,
+ * and frees the rings of the threads it did not inherit
+ */
+void before_fork() {
+	drain_mutex.lock();
+	rings.mutex().lock();
+}
+
+void after_fork_parent() {
+	rings.mutex().unlock();
+	drain_mutex.unlock();
+}
+
+void after_fork_child() {
+	for (auto& r : rings.items()) {
+		r->tail.store(r->head.load());
+		r->dropped.store(0);
+		if (r.get() != rings.current())
+			r->free.store(true);
+	}
+	rings.mutex().unlock();
+	drain_mutex.unlock();
+}
+
+void writer_loop() {
+	// Signal handlers may call flush(); keep them off this thread
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		drain();
+	}
+}
+
+} // namespace
+
+bool set_level(const std::string& name) {
+	for (int i = 0; i < 4; i++) {
+		std::string lower = LEVEL_NAMES[i];
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		if (name == lower) {
+			min_level = uint8_t(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool set_filter(const std::string& names) {
+	uint32_t mask = 0;
+	size_t pos = 0;
+	while (pos <= names.size()) {
+		size_t end = names.find(',', pos);
+		if (end == std::string::npos)
+			end = names.size();
+		std::string name = names.substr(pos, end - pos);
+
+		bool found = false;
+		for (int i = 0; i < int(Subsys::COUNT); i++) {
+			if (name == SUBSYS_NAMES[i]) {
+				mask |= 1u << i;
+				found = true;
+			}
+		}
+		if (!found)
+			return false;
+		pos = end + 1;
+	}
+	subsys_mask = mask;
+	return true;
+}
+
+void start() {
+	pid_t pid = getpid();
+	if (writer_pid.exchange(pid) == pid)
+		return;
+	if (start_ns == 0) {
+		start_ns = monotonic_ns();
+		pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+	}
+	std::thread(writer_loop).detach();
+}
+
+void flush() { drain(); }
+
+void write(Level l, Subsys s, const char* fmt, const Arg* args, int nargs) {
+	Ring& r = rings.local();
+
+	uint64_t head = r.head.load(std::memory_order_relaxed);
+	if (head - r.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+		r.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Record& rec = r.records[head % RING_SIZE];
+	rec.ts_ns = monotonic_ns();
+	rec.fmt = fmt;
+	rec.level = l;
+	rec.subsys = s;
+	rec.nargs = uint8_t(nargs);
+	if (nargs > 0)
+		std::memcpy(static_cast<void*>(rec.args), args, sizeof(Arg) * nargs);
+	r.head.store(head + 1, std::memory_order_release);
+}
+
+} // namespace logger
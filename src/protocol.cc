@@ -5,20 +5,19 @@ namespace TTT_PROTO {
 
 int serialize(MsgType type, const void* payload, size_t size,
 			  std::vector<uint8_t>& out) {
-
 	using enum ProtoErr;
 
 	// Validate size is no larger than 255 bytes
-	if (size > 255)
+	if (size > MAX_PAYLOAD)
 		return (int)INVALID_SIZE;
 
 	// Ensure valid payload
 	if (payload == nullptr && size > 0)
 		return (int)NULL_PAYLOAD;
 
-	// Clear output + reserve space for contents
-	out.clear();
-	out.reserve(sizeof(MsgHeader) + size);
+	// Size the output for header + payload. Reusing the same vector keeps
+	// its capacity, so this only allocates the first time
+	out.resize(sizeof(MsgHeader) + size);
 
 	// Build header
 	MsgHeader h;
@@ -26,14 +25,11 @@ int serialize(MsgType type, const void* payload, size_t size,
 	h.size = static_cast<uint8_t>(size);
 
 	// Write header bytes
-	out.insert(out.end(), reinterpret_cast<uint8_t*>(&h),
-			   reinterpret_cast<uint8_t*>(&h) + sizeof(h));
+	std::memcpy(out.data(), &h, sizeof(h));
 
 	// Write payload bytes
-	if (size > 0) {
-		out.insert(out.end(), reinterpret_cast<const uint8_t*>(payload),
-				   reinterpret_cast<const uint8_t*>(payload) + size);
-	}
+	if (size > 0)
+		std::memcpy(out.data() + sizeof(h), payload, size);
 
 	// Sucessful write, return 0
 	return (int)OK;
@@ -41,7 +37,6 @@ int serialize(MsgType type, const void* payload, size_t size,
 
 int deserialize(const std::vector<uint8_t>& bytes, MsgHeader& header_r,
 				std::vector<uint8_t>& payload_r) {
-
 	using enum ProtoErr;
 
 	// Ensure bytes is the proper size
@@ -63,4 +58,4 @@ int deserialize(const std::vector<uint8_t>& bytes, MsgHeader& header_r,
 	return (int)OK;
 }
 
-} // namespace TTT_PROTO
\ No newline at end of file
+} // namespace TTT_PROTO
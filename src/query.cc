@@ -0,0 +1,260 @@
+#include "game.hh"
+#include "history.hh"
+#include "ratings.hh"
+#include "utils.hh"
+#include "validate.hh"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Command-line query tool for match-history files written by
+ * `server --history=FILE`
+ */
+
+static const char* USAGE =
+	"Usage: query FILE... [--player=ID|NAME] [--ratings=FILE] [--as=X|O]\n"
+	"             [--result=win|loss|draw] [--min-moves=N] [--max-moves=N]\n"
+	"             [--limit=N] [--threads=N] [--validate]\n"
+	"       query FILE --generate=N   (append N random games, for benchmarks)";
+
+// Append `n` random, legal games between 1000 players to `path`
+static void generate(const std::string& path, uint64_t n) {
+	HistoryWriter w;
+	if (!w.open(path, 0))
+		fatal_error(1, "Error opening history file");
+
+	std::mt19937_64 rng(42);
+	for (uint64_t i = 0; i < n; i++) {
+		Game g;
+		MatchRow r{uint32_t(rng() % 1000), uint32_t(rng() % 1000),
+				   Outcome::DRAW, 0, 0};
+		while (true) {
+			int pos;
+			do {
+				pos = int(rng() % 9);
+			} while (!g.isValidMove(pos));
+
+			Player p = g.activePlayer();
+			g.move(pos, p);
+			r.moves |= uint64_t(pos) << (4 * r.move_count++);
+
+			if (g.checkWin(p)) {
+				r.outcome = (p == Player::P1 ? Outcome::X_WIN : Outcome::O_WIN);
+				break;
+			}
+			if (g.isDraw())
+				break;
+			g.switchPlayer();
+		}
+		w.append(r);
+	}
+	w.flush();
+}
+
+// Player name for display, falling back to the numeric id
+static std::string player_name(const RatingStore& ratings, uint32_t id) {
+	if (id == NO_PLAYER)
+		return "anonymous";
+	RatingRecord rec;
+	if (ratings.get(int32_t(id), rec))
+		return rec.name;
+	return "#" + std::to_string(id);
+}
+
+/**
+ * Audit the games matching `q` in `f`: replay them with the batch
+ * validator and print the verdict counts plus up to `limit` bad games.
+ * Returns the number of bad games
+ */
+static uint64_t validate_file(const std::string& f, const HistoryQuery& q,
+							  unsigned threads, size_t limit) {
+	using std::cout, std::endl;
+
+	HistoryReader reader;
+	if (!reader.open(f))
+		fatal_error(1, ("Error opening history file " + f).c_str());
+	HistoryResult res = reader.run(q, threads, reader.rows());
+	std::sort(res.rows.begin(), res.rows.end(),
+			  [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	std::vector<MatchRow> rows(res.rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
+		rows[i] = res.rows[i].second;
+	std::vector<Verdict> verdicts(rows.size());
+
+	auto start = std::chrono::steady_clock::now();
+	validate_games(rows.data(), rows.size(), verdicts.data());
+	double secs = std::chrono::duration<double>(
+					  std::chrono::steady_clock::now() - start)
+					  .count();
+
+	uint64_t counts[size_t(Verdict::COUNT)] = {};
+	for (size_t i = 0; i < rows.size(); i++) {
+		counts[size_t(verdicts[i])]++;
+		if (verdicts[i] != Verdict::OK && limit > 0) {
+			limit--;
+			cout << f << " #" << res.rows[i].first << ": "
+				 << verdict_name(verdicts[i]) << ", moves:";
+			for (int k = 0; k < rows[i].move_count && k < 16; k++)
+				cout << " " << move_at(rows[i].moves, k) + 1;
+			cout << endl;
+		}
+	}
+
+	cout << f << ": " << rows.size() << " games validated with "
+		 << kernel_name(best_kernel()) << " in " << secs * 1000 << " ms";
+	for (size_t v = 1; v < size_t(Verdict::COUNT); v++)
+		cout << ", " << counts[v] << " " << verdict_name(Verdict(v));
+	cout << endl;
+	return rows.size() - counts[size_t(Verdict::OK)];
+}
+
+int main(int argc, char* argv[]) {
+	using std::cout, std::endl;
+	using std::string;
+
+	std::vector<string> files;
+	HistoryQuery q;
+	string player, ratings_path;
+	size_t limit = 10;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t gen = 0;
+	bool validate = false, max_moves_set = false;
+
+	/**
+	 * Parse command-line arguments
+	 */
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		auto value = [&](const char* flag) -> const char* {
+			size_t n = strlen(flag);
+			return arg.compare(0, n, flag) == 0 ? argv[i] + n : nullptr;
+		};
+
+		if (const char* v = value("--player=")) {
+			player = v;
+		} else if (const char* v = value("--ratings=")) {
+			ratings_path = v;
+		} else if (const char* v = value("--as=")) {
+			q.role = char(toupper(v[0]));
+			if (q.role != 'X' && q.role != 'O')
+				fatal_error(1, USAGE);
+		} else if (const char* v = value("--result=")) {
+			string r = v;
+			if (r == "win")
+				q.result = HistoryQuery::Result::WIN;
+			else if (r == "loss")
+				q.result = HistoryQuery::Result::LOSS;
+			else if (r == "draw")
+				q.result = HistoryQuery::Result::DRAW;
+			else
+				fatal_error(1, USAGE);
+		} else if (const char* v = value("--min-moves=")) {
+			q.min_moves = uint8_t(std::stoi(v));
+		} else if (const char* v = value("--max-moves=")) {
+			q.max_moves = uint8_t(std::stoi(v));
+			max_moves_set = true;
+		} else if (const char* v = value("--limit=")) {
+			limit = std::stoul(v);
+		} else if (const char* v = value("--threads=")) {
+			threads = unsigned(std::stoul(v));
+		} else if (const char* v = value("--generate=")) {
+			gen = std::stoull(v);
+		} else if (arg == "--validate") {
+			validate = true;
+		} else if (arg.rfind("--", 0) == 0) {
+			fatal_error(1, USAGE);
+		} else {
+			files.push_back(arg);
+		}
+	}
+	if (files.empty())
+		fatal_error(1, USAGE);
+
+	if (gen > 0) {
+		generate(files[0], gen);
+		cout << "Appended " << gen << " games to " << files[0] << endl;
+		return 0;
+	}
+
+	RatingStore ratings;
+	if (!ratings_path.empty() && !ratings.open(ratings_path))
+		fatal_error(1, "Error opening ratings file");
+
+	/**
+	 * Resolve the player: a numeric id, or a name looked up in --ratings
+	 */
+	if (!player.empty()) {
+		bool numeric = std::all_of(player.begin(), player.end(), ::isdigit);
+		q.player = numeric ? std::stoll(player) : ratings.find(player);
+		if (q.player < 0)
+			fatal_error(1, "Unknown player (pass --ratings=FILE for names)");
+	}
+
+	/**
+	 * Audit mode: validate every matching game, including corrupt ones
+	 * longer than nine moves
+	 */
+	if (validate) {
+		if (!max_moves_set)
+			q.max_moves = 255;
+		uint64_t bad = 0;
+		for (const string& f : files)
+			bad += validate_file(f, q, threads, limit);
+		return bad > 0 ? 2 : 0;
+	}
+
+	/**
+	 * Run the query over every file
+	 */
+	uint64_t matched = 0, scanned = 0, rows = 0, blocks = 0, skipped = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (const string& f : files) {
+		HistoryReader reader;
+		if (!reader.open(f))
+			fatal_error(1, ("Error opening history file " + f).c_str());
+
+		HistoryResult res = reader.run(q, threads, limit);
+		matched += res.matched;
+		scanned += res.scanned;
+		blocks += res.blocks;
+		skipped += res.skipped;
+		rows += reader.rows();
+
+		for (const auto& [row, m] : res.rows) {
+			if (limit == 0)
+				break;
+			limit--;
+
+			const char* outcome = m.outcome == Outcome::X_WIN   ? "X wins"
+								  : m.outcome == Outcome::O_WIN ? "O wins"
+																: "draw";
+			cout << f << " #" << row << ": X=" << player_name(ratings, m.player_x)
+				 << " O=" << player_name(ratings, m.player_o) << " " << outcome
+				 << " in " << int(m.move_count) << " moves:";
+			for (int i = 0; i < m.move_count; i++)
+				cout << " " << move_at(m.moves, i) + 1;
+			cout << endl;
+		}
+	}
+
+	double secs = std::chrono::duration<double>(
+					  std::chrono::steady_clock::now() - start)
+					  .count();
+	cout << matched << " of " << rows << " games matched (" << scanned
+		 << " scanned, " << skipped << "/" << blocks << " blocks skipped) in "
+		 << secs * 1000 << " ms";
+	if (secs > 0)
+		cout << ", " << uint64_t(scanned / secs) << " rows/s";
+	cout << endl;
+	return 0;
+}
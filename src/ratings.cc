@@ -0,0 +1,191 @@
+#include "ratings.hh"
+
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Elo K-factor
+static constexpr float K_FACTOR = 32.0f;
+
+static constexpr char MAGIC[4] = {'T', 'T', 'T', 'R'};
+static constexpr uint32_t VERSION = 1;
+
+RatingStore::~RatingStore() {
+	if (m_header)
+		munmap(m_header, m_mapped);
+	if (m_fd != -1)
+		close(m_fd);
+}
+
+bool RatingStore::open(const std::string& path) {
+	std::unique_lock lock(m_mutex);
+
+	m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(m_fd, &st) < 0)
+		return false;
+
+	/**
+	 * New file: write a header with room for a first batch of players
+	 */
+	if (st.st_size == 0) {
+		FileHeader h{};
+		std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+		h.version = VERSION;
+		h.capacity = 1024;
+		if (pwrite(m_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+			return false;
+	}
+
+	FileHeader h;
+	if (pread(m_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+		std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		h.version != VERSION || h.count > h.capacity)
+		return false;
+
+	if (!map(h.capacity))
+		return false;
+
+	/**
+	 * Rebuild the in-memory indexes straight from the mapped records
+	 */
+	for (uint32_t id = 0; id < m_header->count; id++) {
+		RatingRecord* r = rec(id);
+		r->name[NAME_LEN - 1] = '\0';
+		m_by_name.emplace(r->name, id);
+		m_ranks.insert({r->rating, id});
+	}
+	return true;
+}
+
+bool RatingStore::map(uint32_t capacity) {
+	size_t bytes = sizeof(FileHeader) + sizeof(RatingRecord) * capacity;
+	if (ftruncate(m_fd, (off_t)bytes) < 0)
+		return false;
+
+	if (m_header)
+		munmap(m_header, m_mapped);
+
+	void* mem =
+		mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (mem == MAP_FAILED) {
+		m_header = nullptr;
+		return false;
+	}
+	m_header = static_cast<FileHeader*>(mem);
+	m_header->capacity = capacity;
+	m_mapped = bytes;
+	return true;
+}
+
+RatingRecord* RatingStore::rec(uint32_t id) const {
+	return reinterpret_cast<RatingRecord*>(m_header + 1) + id;
+}
+
+int32_t RatingStore::player(const std::string& name) {
+	std::string key = name.substr(0, NAME_LEN - 1);
+
+	{
+		std::shared_lock lock(m_mutex);
+		if (!m_header)
+			return -1;
+		auto it = m_by_name.find(key);
+		if (it != m_by_name.end())
+			return int32_t(it->second);
+	}
+
+	std::unique_lock lock(m_mutex);
+	auto it = m_by_name.find(key);
+	if (it != m_by_name.end())
+		return int32_t(it->second);
+
+	// Grow the file when full
+	if (m_header->count == m_header->capacity &&
+		!map(m_header->capacity * 2))
+		return -1;
+
+	uint32_t id = m_header->count;
+	RatingRecord* r = rec(id);
+	std::memset(r, 0, sizeof(*r));
+	std::memcpy(r->name, key.data(), key.size());
+	r->rating = INITIAL_RATING;
+	m_header->count = id + 1;
+
+	m_by_name.emplace(key, id);
+	m_ranks.insert({r->rating, id});
+	return int32_t(id);
+}
+
+int32_t RatingStore::find(const std::string& name) const {
+	std::shared_lock lock(m_mutex);
+	auto it = m_by_name.find(name.substr(0, NAME_LEN - 1));
+	return it == m_by_name.end() ? -1 : int32_t(it->second);
+}
+
+void RatingStore::record_match(int32_t a, int32_t b, float score_a) {
+	std::unique_lock lock(m_mutex);
+	if (!m_header || a < 0 || b < 0 || a == b ||
+		uint32_t(a) >= m_header->count || uint32_t(b) >= m_header->count)
+		return;
+
+	RatingRecord* ra = rec(uint32_t(a));
+	RatingRecord* rb = rec(uint32_t(b));
+
+	// Standard Elo update
+	float expected_a =
+		1.0f / (1.0f + std::pow(10.0f, (rb->rating - ra->rating) / 400.0f));
+	float delta = K_FACTOR * (score_a - expected_a);
+
+	m_ranks.erase({ra->rating, uint32_t(a)});
+	m_ranks.erase({rb->rating, uint32_t(b)});
+	ra->rating += delta;
+	rb->rating -= delta;
+	m_ranks.insert({ra->rating, uint32_t(a)});
+	m_ranks.insert({rb->rating, uint32_t(b)});
+
+	ra->games++;
+	rb->games++;
+	if (score_a == 1.0f) {
+		ra->wins++;
+		rb->losses++;
+	} else if (score_a == 0.0f) {
+		ra->losses++;
+		rb->wins++;
+	} else {
+		ra->draws++;
+		rb->draws++;
+	}
+}
+
+uint32_t RatingStore::rank(int32_t id) const {
+	std::shared_lock lock(m_mutex);
+	if (!m_header || id < 0 || uint32_t(id) >= m_header->count)
+		return 0;
+	return uint32_t(m_ranks.order_of_key({rec(uint32_t(id))->rating,
+										  uint32_t(id)})) +
+		   1;
+}
+
+bool RatingStore::get(int32_t id, RatingRecord& out) const {
+	std::shared_lock lock(m_mutex);
+	if (!m_header || id < 0 || uint32_t(id) >= m_header->count)
+		return false;
+	out = *rec(uint32_t(id));
+	return true;
+}
+
+std::vector<RatingRecord> RatingStore::top(size_t n) const {
+	std::shared_lock lock(m_mutex);
+	std::vector<RatingRecord> out;
+	for (auto it = m_ranks.begin(); it != m_ranks.end() && out.size() < n;
+		 ++it)
+		out.push_back(*rec(it->second));
+	return out;
+}
@@ -0,0 +1,426 @@
+#include "capture.hh"
+#include "message.hh"
+#include "protocol.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Re-drive a server from a wire capture written by `server --capture=FILE`.
+ * Each captured connection is reopened and its client frames are sent in
+ * capture order, at the captured pace scaled by --speed (or back to back
+ * with --speed=max), so per-connection ordering is preserved. Replies are
+ * matched to the request that prompted them to report the latency
+ * distribution. Pings are answered live rather than replayed, so the
+ * server's RTT estimates stay meaningful
+ */
+
+static const char* USAGE =
+	"Usage: replay FILE [address] [port] [--speed=N|max] [--drain-ms=MS]";
+
+using namespace TTT_PROTO;
+using Clock = std::chrono::steady_clock;
+
+// Requests whose reply latency is measured
+enum Req { CONNECT, MOVE, LEADERBOARD, STATS, RESUME, REQ_COUNT };
+static const char* REQ_NAMES[] = {"connect", "move", "leaderboard", "stats",
+								  "resume"};
+
+// Request kind of a client frame, or REQ_COUNT if it expects no reply
+static Req request_of(MsgType type) {
+	switch (type) {
+	case MsgType::MOVE_REQUEST:
+		return MOVE;
+	case MsgType::LEADERBOARD_REQUEST:
+		return LEADERBOARD;
+	case MsgType::STATS_REQUEST:
+		return STATS;
+	case MsgType::RESUME:
+		return RESUME;
+	default:
+		return REQ_COUNT;
+	}
+}
+
+// One captured client event to replay
+struct Event {
+	uint64_t ts_ns;
+	size_t conn;
+	capture::Dir dir;
+	const uint8_t* frame;
+	uint16_t len;
+};
+
+// A replayed connection
+struct Conn {
+	int fd = -1;
+	// Serializes sends from the dispatcher and the reader's pongs
+	std::mutex send_mutex;
+
+	// Send times of requests still waiting for their reply, per kind
+	std::mutex mutex;
+	std::array<std::deque<Clock::time_point>, REQ_COUNT> pending;
+	std::array<std::vector<uint64_t>, REQ_COUNT> latency_us;
+	uint64_t errors = 0;
+
+	std::thread reader;
+};
+
+static bool recv_all(int fd, void* buf, size_t len) {
+	uint8_t* p = static_cast<uint8_t*>(buf);
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = recv(fd, p + total, len - total, 0);
+		if (n <= 0)
+			return false;
+		total += size_t(n);
+	}
+	return true;
+}
+
+static bool send_frame(Conn& c, const uint8_t* frame, size_t len) {
+	std::lock_guard<std::mutex> lock(c.send_mutex);
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = send(c.fd, frame + total, len - total, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		total += size_t(n);
+	}
+	return true;
+}
+
+// Pop the oldest pending request of `kind` and record its latency
+static bool complete(Conn& c, Req kind, Clock::time_point now) {
+	if (c.pending[kind].empty())
+		return false;
+	auto sent = c.pending[kind].front();
+	c.pending[kind].pop_front();
+	c.latency_us[kind].push_back(uint64_t(
+		std::chrono::duration_cast<std::chrono::microseconds>(now - sent)
+			.count()));
+	return true;
+}
+
+// Read server frames until the connection closes, answering pings and
+// matching replies to pending requests
+static void reader_loop(Conn& c) {
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+	while (true) {
+		MsgHeader hdr;
+		if (!recv_all(c.fd, &hdr, sizeof(hdr)) ||
+			(hdr.size > 0 && !recv_all(c.fd, pl.data(), hdr.size)))
+			break;
+		auto now = Clock::now();
+
+		MsgType type = static_cast<MsgType>(hdr.type);
+		if (type == MsgType::PING) {
+			PL_Ping ping;
+			if (decode<MsgType::PING>(pl.data(), hdr.size, ping)) {
+				auto f = encode<MsgType::PONG>(ping);
+				send_frame(c, f.data(), f.size());
+			}
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(c.mutex);
+		switch (type) {
+		case MsgType::WELCOME:
+			// A resumed seat is welcomed in answer to RESUME
+			if (complete(c, RESUME, now))
+				c.pending[CONNECT].clear();
+			else
+				complete(c, CONNECT, now);
+			break;
+		case MsgType::MOVE_RESULT:
+			complete(c, MOVE, now);
+			break;
+		case MsgType::LEADERBOARD:
+			complete(c, LEADERBOARD, now);
+			break;
+		case MsgType::STATS:
+			complete(c, STATS, now);
+			break;
+		case MsgType::ERROR:
+			c.errors++;
+			if (!complete(c, MOVE, now))
+				complete(c, RESUME, now);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Connect a new socket to the server. Returns the fd or -1
+static int connect_server(const sockaddr_in& addr) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Value at quantile `q` of sorted `v`
+static uint64_t percentile(const std::vector<uint64_t>& v, double q) {
+	return v[std::min(v.size() - 1, size_t(q * double(v.size())))];
+}
+
+int main(int argc, char* argv[]) {
+	using std::cout, std::endl;
+	using std::string;
+
+	string path, address = "127.0.0.1";
+	int portno = 8080;
+	// Playback speed multiplier; 0 sends back to back
+	double speed = 1.0;
+	int drain_ms = 2000;
+
+	/**
+	 * Parse command-line arguments
+	 */
+	int positional = 0;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.rfind("--speed=", 0) == 0) {
+			string v = arg.substr(8);
+			speed = v == "max" ? 0.0 : std::stod(v);
+			if (speed < 0)
+				fatal_error(1, USAGE);
+		} else if (arg.rfind("--drain-ms=", 0) == 0) {
+			drain_ms = std::stoi(arg.substr(11));
+		} else if (arg.rfind("--", 0) == 0) {
+			fatal_error(1, USAGE);
+		} else if (positional == 0) {
+			path = arg;
+			positional++;
+		} else if (positional == 1) {
+			address = arg;
+			positional++;
+		} else if (positional == 2) {
+			portno = std::stoi(arg);
+			positional++;
+		} else {
+			fatal_error(1, USAGE);
+		}
+	}
+	if (path.empty())
+		fatal_error(1, USAGE);
+
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(portno);
+	if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) <= 0)
+		fatal_error(1, "Invalid or unsupported address");
+
+	/**
+	 * Load the capture. Connection ids restart at every EPOCH (a server
+	 * process starting to capture), and connections without an OPEN were
+	 * taken over mid-match, so they cannot be replayed from the start
+	 */
+	capture::Reader reader;
+	if (!reader.open(path))
+		fatal_error(1, "Error opening capture file");
+
+	// Every record, keyed by (epoch, connection id). The writer orders
+	// records within each batch it drains, so sort them all by time first
+	struct Captured {
+		uint64_t key;
+		capture::Record rec;
+		const uint8_t* frame;
+	};
+	std::vector<Captured> records;
+	uint64_t epoch = 0;
+
+	capture::Record rec;
+	const uint8_t* frame;
+	while (reader.next(rec, frame)) {
+		if (rec.dir == capture::Dir::EPOCH)
+			epoch++;
+		else
+			records.push_back(Captured{epoch << 32 | rec.conn, rec, frame});
+	}
+	std::stable_sort(records.begin(), records.end(),
+					 [](const Captured& a, const Captured& b) {
+						 return a.rec.ts_ns < b.rec.ts_ns;
+					 });
+
+	std::unordered_map<uint64_t, size_t> conn_index;
+	std::vector<bool> opened;
+	std::vector<Event> events;
+	uint64_t captured_out = 0, skipped = 0;
+
+	for (const Captured& r : records) {
+		auto it = conn_index.find(r.key);
+		if (it == conn_index.end()) {
+			it = conn_index.emplace(r.key, opened.size()).first;
+			opened.push_back(r.rec.dir == capture::Dir::OPEN);
+			if (!opened.back())
+				skipped++;
+		}
+		if (!opened[it->second])
+			continue;
+
+		if (r.rec.dir == capture::Dir::OUT) {
+			captured_out++;
+			continue;
+		}
+		// Pongs echo the original server's clock; pings are answered live
+		if (r.rec.dir == capture::Dir::IN &&
+			(r.rec.len < sizeof(MsgHeader) ||
+			 static_cast<MsgType>(r.frame[0]) == MsgType::PONG))
+			continue;
+		events.push_back(
+			Event{r.rec.ts_ns, it->second, r.rec.dir, r.frame, r.rec.len});
+	}
+	if (events.empty())
+		fatal_error(1, "Nothing to replay in the capture");
+
+	std::vector<std::unique_ptr<Conn>> conns;
+	for (size_t i = 0; i < opened.size(); i++)
+		conns.push_back(std::make_unique<Conn>());
+
+	/**
+	 * Replay every event at its scheduled time, tracking how far the
+	 * dispatcher fell behind schedule
+	 */
+	uint64_t t0 = events.front().ts_ns;
+	uint64_t frames = 0, connect_failures = 0, send_failures = 0;
+	uint64_t max_slip_us = 0;
+	auto start = Clock::now();
+
+	for (const Event& ev : events) {
+		Conn& c = *conns[ev.conn];
+		if (speed > 0) {
+			auto due = start + std::chrono::nanoseconds(
+								   uint64_t(double(ev.ts_ns - t0) / speed));
+			std::this_thread::sleep_until(due);
+			auto slip = std::chrono::duration_cast<std::chrono::microseconds>(
+				Clock::now() - due);
+			max_slip_us = std::max<uint64_t>(max_slip_us, slip.count());
+		}
+
+		if (ev.dir == capture::Dir::OPEN) {
+			auto now = Clock::now();
+			if ((c.fd = connect_server(addr)) < 0) {
+				connect_failures++;
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock(c.mutex);
+				c.pending[CONNECT].push_back(now);
+			}
+			c.reader = std::thread(reader_loop, std::ref(c));
+		} else if (c.fd < 0) {
+			continue;
+		} else if (ev.dir == capture::Dir::IN) {
+			Req kind = request_of(static_cast<MsgType>(ev.frame[0]));
+			if (kind != REQ_COUNT) {
+				std::lock_guard<std::mutex> lock(c.mutex);
+				c.pending[kind].push_back(Clock::now());
+			}
+			if (!send_frame(c, ev.frame, ev.len))
+				send_failures++;
+			frames++;
+		} else if (ev.dir == capture::Dir::CLOSE) {
+			shutdown(c.fd, SHUT_WR);
+		}
+	}
+	auto sent_all = Clock::now();
+
+	/**
+	 * Give the server `drain_ms` to answer what is still pending, then
+	 * close everything
+	 */
+	auto drain_until = sent_all + std::chrono::milliseconds(drain_ms);
+	while (Clock::now() < drain_until) {
+		size_t waiting = 0;
+		for (auto& c : conns) {
+			std::lock_guard<std::mutex> lock(c->mutex);
+			for (auto& p : c->pending)
+				waiting += p.size();
+		}
+		if (waiting == 0)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	for (auto& c : conns) {
+		if (c->fd < 0)
+			continue;
+		shutdown(c->fd, SHUT_RDWR);
+		c->reader.join();
+		close(c->fd);
+	}
+
+	/**
+	 * Report
+	 */
+	std::array<std::vector<uint64_t>, REQ_COUNT> latency_us;
+	std::vector<uint64_t> all_us;
+	uint64_t unanswered = 0, errors = 0;
+	for (auto& c : conns) {
+		for (int k = 0; k < REQ_COUNT; k++) {
+			auto& l = c->latency_us[k];
+			latency_us[k].insert(latency_us[k].end(), l.begin(), l.end());
+			if (k != CONNECT)
+				all_us.insert(all_us.end(), l.begin(), l.end());
+			unanswered += c->pending[k].size();
+		}
+		errors += c->errors;
+	}
+
+	auto ms = [](auto d) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+	};
+	cout << "Replayed " << frames << " frame(s) on " << conns.size() - skipped
+		 << " connection(s) in " << ms(sent_all - start) << " ms (captured "
+		 << (events.back().ts_ns - t0) / 1000000 << " ms, ";
+	if (speed > 0)
+		cout << speed << "x speed)" << endl;
+	else
+		cout << "max speed)" << endl;
+	if (skipped)
+		cout << "Skipped " << skipped
+			 << " connection(s) already open when capture started" << endl;
+	cout << "Captured " << captured_out << " server frame(s)" << endl;
+
+	auto report = [&](const char* name, std::vector<uint64_t>& v) {
+		if (v.empty())
+			return;
+		std::sort(v.begin(), v.end());
+		cout << "  " << name << ": " << v.size() << " replies, p50 "
+			 << percentile(v, 0.50) << " us, p90 " << percentile(v, 0.90)
+			 << " us, p99 " << percentile(v, 0.99) << " us, p99.9 "
+			 << percentile(v, 0.999) << " us, max " << v.back() << " us"
+			 << endl;
+	};
+	cout << "Reply latency:" << endl;
+	report("all requests", all_us);
+	for (int k = 0; k < REQ_COUNT; k++)
+		report(REQ_NAMES[k], latency_us[k]);
+
+	cout << unanswered << " unanswered, " << errors << " error(s), "
+		 << connect_failures << " connect failure(s), " << send_failures
+		 << " send failure(s)" << endl;
+	if (speed > 0)
+		cout << "Max schedule slip: " << max_slip_us << " us" << endl;
+	return 0;
+}
@@ -0,0 +1,667 @@
+#include "hashring.hh"
+#include "log.hh"
+#include "message.hh"
+#include "protocol.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Front-end for several server processes. Clients connect here and are
+ * paired into matches; each match is assigned to a backend by consistent
+ * hashing on its match id, skipping backends that are down or already host
+ * a match. Once a session is placed its frames are forwarded in
+ * both directions with splice(), so they never enter user space. A RESUME
+ * is routed to the backend that issued its token
+ */
+
+using namespace TTT_PROTO;
+using Clock = std::chrono::steady_clock;
+
+// How long a new connection gets to show a RESUME as its first frame
+constexpr int RESUME_PEEK_MS = 100;
+// How long a backend gets to welcome a new player
+constexpr int WELCOME_WAIT_MS = 3000;
+// How long a backend that refused a player is skipped for new matches
+constexpr auto FULL_BACKOFF = std::chrono::seconds(5);
+// How often backends marked down are probed
+constexpr auto PROBE_INTERVAL = std::chrono::seconds(2);
+// How long a resume token is remembered
+constexpr auto TOKEN_TTL = std::chrono::minutes(10);
+
+struct Backend {
+	// "host:port", also its name on the ring
+	std::string name;
+	sockaddr_in addr;
+	// On the ring while listed in the configuration and reachable
+	bool listed = true;
+	bool up = true;
+	// Skipped for new matches until then, after refusing a player
+	Clock::time_point full_until{};
+	// Matches currently routed here, and sessions forwarded here in total
+	uint32_t matches = 0;
+	uint64_t sessions = 0;
+};
+
+struct Match {
+	uint32_t backend;
+	// Live client sessions in this match
+	uint32_t sessions;
+};
+
+struct TokenEntry {
+	uint64_t match;
+	uint32_t backend;
+	Clock::time_point issued;
+};
+
+/**
+ * Routing state, all guarded by state_mutex. Backend ids index `backends`
+ * and are never reused, so a removed backend keeps its id if it returns
+ */
+std::mutex state_mutex;
+std::vector<std::unique_ptr<Backend>> backends;
+HashRing ring;
+std::unordered_map<uint64_t, Match> matches;
+uint64_t next_match = 1;
+// Matches whose first player is welcomed and waiting for an opponent
+std::deque<uint64_t> waiting;
+std::unordered_map<uint64_t, TokenEntry> tokens;
+
+// File listing the backends, re-read on SIGHUP (empty if none)
+std::string backends_path;
+// Router listener fd
+int serv_fd = -1;
+// Bytes forwarded between clients and backends
+std::atomic<uint64_t> bytes_forwarded(0);
+
+static bool recv_all(int fd, void* buf, size_t len) {
+	uint8_t* p = static_cast<uint8_t*>(buf);
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = recv(fd, p + total, len - total, 0);
+		if (n <= 0)
+			return false;
+		total += size_t(n);
+	}
+	return true;
+}
+
+static bool send_all(int fd, const uint8_t* data, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		ssize_t n = send(fd, data + total, len - total, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		total += size_t(n);
+	}
+	return true;
+}
+
+template <typename F> static bool send_frame(int fd, const F& frame) {
+	return send_all(fd, frame.data(), frame.size());
+}
+
+// Frames are small and each answers the peer at once; without this, Nagle
+// holds every frame spliced after the first until the peer ACKs
+static void set_nodelay(int fd) {
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+// Parse "host:port". Returns false if malformed
+static bool parse_backend(const std::string& name, sockaddr_in& addr) {
+	size_t colon = name.rfind(':');
+	if (colon == std::string::npos)
+		return false;
+	addr = sockaddr_in{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(uint16_t(std::atoi(name.c_str() + colon + 1)));
+	return addr.sin_port != 0 &&
+		   inet_pton(AF_INET, name.substr(0, colon).c_str(), &addr.sin_addr) == 1;
+}
+
+/**
+ * Backends
+ */
+
+// Make `names` the configured backends: new ones join the ring, missing
+// ones leave it. Matches already on a removed backend play on there
+static void set_backends(const std::vector<std::string>& names) {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	for (uint32_t id = 0; id < backends.size(); id++) {
+		Backend& b = *backends[id];
+		bool listed = std::find(names.begin(), names.end(), b.name) != names.end();
+		if (b.listed && !listed) {
+			ring.remove(id);
+			LOG_INFO(ROUTE, "Backend {} removed, draining {} match(es)",
+					 b.name.c_str(), b.matches);
+		} else if (!b.listed && listed && b.up) {
+			ring.add(id, b.name);
+			LOG_INFO(ROUTE, "Backend {} added back", b.name.c_str());
+		}
+		b.listed = listed;
+	}
+
+	for (const std::string& name : names) {
+		bool known = false;
+		for (auto& b : backends)
+			known |= b->name == name;
+		if (known)
+			continue;
+
+		auto b = std::make_unique<Backend>();
+		b->name = name;
+		if (!parse_backend(name, b->addr)) {
+			LOG_ERROR(ROUTE, "Ignoring a malformed backend (want HOST:PORT)");
+			continue;
+		}
+		uint32_t id = uint32_t(backends.size());
+		backends.push_back(std::move(b));
+		ring.add(id, name);
+		// Names are kept alive by `backends`, so logging them is safe
+		LOG_INFO(ROUTE, "Backend {} added", backends[id]->name.c_str());
+	}
+}
+
+// Read the backend list file, one "host:port" per line
+static bool load_backends(const std::string& path,
+						  std::vector<std::string>& names) {
+	std::ifstream in(path);
+	if (!in)
+		return false;
+	std::string line;
+	while (std::getline(in, line)) {
+		line.erase(0, line.find_first_not_of(" \t"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (!line.empty() && line[0] != '#')
+			names.push_back(line);
+	}
+	return true;
+}
+
+// Take an unreachable backend off the ring until a probe reaches it
+static void mark_down(uint32_t id) {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	Backend& b = *backends[id];
+	if (!b.up)
+		return;
+	b.up = false;
+	ring.remove(id);
+	LOG_WARN(ROUTE, "Backend {} is down", b.name.c_str());
+}
+
+// Name of backend `id`. Backends are never freed, so it stays valid for the
+// logger after state_mutex is released
+static const char* backend_name(uint32_t id) {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	return backends[id]->name.c_str();
+}
+
+// Connect to backend `id`. Returns the fd or -1
+static int connect_backend(uint32_t id) {
+	sockaddr_in addr;
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		addr = backends[id]->addr;
+	}
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	set_nodelay(fd);
+	return fd;
+}
+
+// Put backends that came back up on the ring again. A probe is an ordinary
+// connection, which an idle server seats and frees again at once; one that
+// still hosts a routed match (a player waiting there when a connect to it
+// failed) could seat the probe as the opponent, so it is not probed until
+// that match ends
+static void probe_loop() {
+	while (true) {
+		std::this_thread::sleep_for(PROBE_INTERVAL);
+
+		std::vector<uint32_t> down;
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			for (uint32_t id = 0; id < backends.size(); id++) {
+				const Backend& b = *backends[id];
+				if (b.listed && !b.up && b.matches == 0)
+					down.push_back(id);
+			}
+		}
+		for (uint32_t id : down) {
+			int fd = connect_backend(id);
+			if (fd < 0)
+				continue;
+			close(fd);
+
+			std::lock_guard<std::mutex> lock(state_mutex);
+			Backend& b = *backends[id];
+			b.up = true;
+			if (b.listed)
+				ring.add(id, b.name);
+			LOG_INFO(ROUTE, "Backend {} is back up", b.name.c_str());
+		}
+	}
+}
+
+/**
+ * Matches
+ */
+
+// Backend for a new match: the first one on the ring from the match id
+// that is up, has no match and is not in `tried`, or -1. A server hosts
+// one match and seats whoever connects next as the waiting player's
+// opponent, so a second match on a backend would join the first one's.
+// Caller holds state_mutex
+static int64_t choose_backend(uint64_t match, const std::vector<uint32_t>& tried) {
+	auto now = Clock::now();
+	return ring.place(match, [&](uint32_t id) {
+		const Backend& b = *backends[id];
+		return b.matches == 0 && b.full_until <= now &&
+			   std::find(tried.begin(), tried.end(), id) == tried.end();
+	});
+}
+
+// Add a session to `match`, creating it on `backend` if needed. Caller
+// holds state_mutex
+static void attach(uint64_t match, uint32_t backend) {
+	auto [it, created] = matches.try_emplace(match, Match{backend, 0});
+	if (created)
+		backends[backend]->matches++;
+	it->second.sessions++;
+}
+
+// Remove a session from `match`, ending the match with its last session
+static void detach(uint64_t match) {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	auto it = matches.find(match);
+	if (it == matches.end() || --it->second.sessions > 0)
+		return;
+	backends[it->second.backend]->matches--;
+	matches.erase(it);
+	std::erase(waiting, match);
+}
+
+// Remember which match and backend a resume token belongs to
+static void remember_token(uint64_t token, uint64_t match, uint32_t backend) {
+	std::lock_guard<std::mutex> lock(state_mutex);
+	auto now = Clock::now();
+	if (tokens.size() % 1024 == 1023)
+		std::erase_if(tokens, [&](const auto& t) {
+			return now - t.second.issued > TOKEN_TTL;
+		});
+	tokens[token] = TokenEntry{match, backend, now};
+}
+
+/**
+ * Sessions
+ */
+
+// Wait briefly for the client's first frame. Returns true, with its token,
+// if it is a RESUME. The frame stays queued on the socket for the backend
+static bool peek_resume(int cfd, uint64_t& token) {
+	auto deadline = Clock::now() + std::chrono::milliseconds(RESUME_PEEK_MS);
+	uint8_t buf[sizeof(MsgHeader) + sizeof(PL_Resume)];
+	while (true) {
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+						deadline - Clock::now())
+						.count();
+		pollfd pfd{cfd, POLLIN, 0};
+		if (left <= 0 || poll(&pfd, 1, int(left)) != 1)
+			return false;
+		ssize_t n = recv(cfd, buf, sizeof(buf), MSG_PEEK);
+		if (n <= 0 || buf[0] != uint8_t(MsgType::RESUME))
+			return false;
+
+		PL_Resume req;
+		if (n == ssize_t(sizeof(buf))) {
+			if (!decode<MsgType::RESUME>(buf + sizeof(MsgHeader), buf[1], req))
+				return false;
+			token = req.token;
+			return true;
+		}
+		// Only part of the frame has arrived
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Read the backend's first frame into `frame`. Returns false if the backend
+// closed the connection (it is full) or stayed silent
+static bool read_welcome(int bfd, std::vector<uint8_t>& frame) {
+	pollfd pfd{bfd, POLLIN, 0};
+	if (poll(&pfd, 1, WELCOME_WAIT_MS) != 1)
+		return false;
+
+	MsgHeader hdr;
+	if (!recv_all(bfd, &hdr, sizeof(hdr)))
+		return false;
+	frame.resize(sizeof(hdr) + hdr.size);
+	std::memcpy(frame.data(), &hdr, sizeof(hdr));
+	return recv_all(bfd, frame.data() + sizeof(hdr), hdr.size) &&
+		   static_cast<MsgType>(hdr.type) == MsgType::WELCOME;
+}
+
+/**
+ * Move bytes from `from` to `to` until `from` closes, through a pipe with
+ * splice() so they stay in the kernel (plain read/write if splice is not
+ * available). Then pass the close on, and with `stop_fd` also stop reading
+ * from it, which ends the opposite direction
+ */
+static void pump(int from, int to, int stop_fd) {
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) == 0) {
+		while (true) {
+			ssize_t n =
+				splice(from, nullptr, p[1], nullptr, 1 << 16, SPLICE_F_MOVE);
+			if (n <= 0)
+				break;
+			bytes_forwarded.fetch_add(uint64_t(n), std::memory_order_relaxed);
+			while (n > 0) {
+				// No SPLICE_F_MORE: it would cork small frames on the socket
+				ssize_t m = splice(p[0], nullptr, to, nullptr, size_t(n),
+								   SPLICE_F_MOVE);
+				if (m <= 0)
+					break;
+				n -= m;
+			}
+			if (n > 0)
+				break;
+		}
+		close(p[0]);
+		close(p[1]);
+	} else {
+		uint8_t buf[4096];
+		ssize_t n;
+		while ((n = recv(from, buf, sizeof(buf), 0)) > 0) {
+			bytes_forwarded.fetch_add(uint64_t(n), std::memory_order_relaxed);
+			if (!send_all(to, buf, size_t(n)))
+				break;
+		}
+	}
+
+	shutdown(to, SHUT_WR);
+	if (stop_fd != -1)
+		shutdown(stop_fd, SHUT_RD);
+}
+
+// Forward between a placed client and backend `backend` until either side
+// is done, then close both
+static void forward(int cfd, int bfd, uint32_t backend) {
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		backends[backend]->sessions++;
+	}
+	std::thread back(pump, bfd, cfd, cfd);
+	pump(cfd, bfd, -1);
+	back.join();
+	close(cfd);
+	close(bfd);
+}
+
+// Resume a dropped session on the backend that issued `token`
+static void resume_session(int cfd, uint64_t token) {
+	auto reject = [cfd] {
+		send_frame(cfd, encode<MsgType::ERROR>(
+							PL_Error{uint8_t(GameErr::RESUME_REJECTED), {}, 0}));
+		close(cfd);
+	};
+
+	uint64_t match;
+	uint32_t backend;
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		auto it = tokens.find(token);
+		if (it == tokens.end() || !backends[it->second.backend]->up) {
+			reject();
+			return;
+		}
+		match = it->second.match;
+		backend = it->second.backend;
+		attach(match, backend);
+	}
+
+	int bfd = connect_backend(backend);
+	if (bfd < 0) {
+		mark_down(backend);
+		detach(match);
+		reject();
+		return;
+	}
+	LOG_INFO(ROUTE, "Match {} resumed on {}", match, backend_name(backend));
+	forward(cfd, bfd, backend);
+	detach(match);
+}
+
+/**
+ * Place a new player: join the oldest match waiting for an opponent, or
+ * open a new match on the backend its id hashes to, falling back along the
+ * ring while backends are down or full
+ */
+static void new_session(int cfd) {
+	std::vector<uint32_t> tried;
+	std::vector<uint8_t> welcome;
+	uint64_t match = 0;
+
+	while (true) {
+		bool joining = false;
+		uint32_t backend;
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			if (tried.empty() && !waiting.empty()) {
+				match = waiting.front();
+				waiting.pop_front();
+				joining = true;
+				backend = matches.at(match).backend;
+			} else {
+				if (match == 0)
+					match = next_match++;
+				int64_t id = choose_backend(match, tried);
+				if (id < 0) {
+					LOG_WARN(ROUTE, "No backend has room for match {}", match);
+					send_frame(cfd, encode<MsgType::SERVER_FULL>());
+					close(cfd);
+					return;
+				}
+				backend = uint32_t(id);
+			}
+			attach(match, backend);
+		}
+
+		int bfd = connect_backend(backend);
+		if (bfd < 0) {
+			mark_down(backend);
+		} else if (read_welcome(bfd, welcome)) {
+			PL_Welcome w;
+			if (decode<MsgType::WELCOME>(welcome.data() + sizeof(MsgHeader),
+										 welcome.size() - sizeof(MsgHeader), w))
+				remember_token(w.resume_token, match, backend);
+			if (!joining) {
+				std::lock_guard<std::mutex> lock(state_mutex);
+				waiting.push_back(match);
+			}
+			LOG_INFO(ROUTE, "Match {} player {} on {}", match, int(w.p_id),
+					 backend_name(backend));
+
+			send_all(cfd, welcome.data(), welcome.size());
+			forward(cfd, bfd, backend);
+			detach(match);
+			return;
+		} else {
+			close(bfd);
+			std::lock_guard<std::mutex> lock(state_mutex);
+			backends[backend]->full_until = Clock::now() + FULL_BACKOFF;
+			LOG_WARN(ROUTE, "Backend {} refused match {}",
+					 backends[backend]->name.c_str(), match);
+		}
+
+		// The opponent is placed already, so there is nowhere else to go
+		detach(match);
+		if (joining) {
+			send_frame(cfd, encode<MsgType::SERVER_FULL>());
+			close(cfd);
+			return;
+		}
+		tried.push_back(backend);
+	}
+}
+
+static void handle_client(int cfd) {
+	uint64_t token;
+	if (peek_resume(cfd, token))
+		resume_session(cfd, token);
+	else
+		new_session(cfd);
+}
+
+/**
+ * Signals
+ */
+
+// Close the listener, flush the log and exit
+static void quit_router() {
+	if (serv_fd != -1)
+		close(serv_fd);
+	LOG_INFO(ROUTE, "Shutting down router");
+	logger::flush();
+	exit(0);
+}
+
+// Print per-backend load on SIGUSR1, re-read the backend list on SIGHUP
+// and shut down on SIGINT/SIGTERM. All are blocked in every other thread,
+// so none of this runs in a signal handler
+static void signal_loop(sigset_t set) {
+	int sig;
+	while (sigwait(&set, &sig) == 0) {
+		if (sig == SIGINT || sig == SIGTERM)
+			quit_router();
+		if (sig == SIGHUP) {
+			std::vector<std::string> names;
+			if (backends_path.empty() || !load_backends(backends_path, names))
+				LOG_ERROR(ROUTE, "Could not re-read the backend list");
+			else
+				set_backends(names);
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(state_mutex);
+		for (auto& b : backends)
+			LOG_INFO(ROUTE, "{}: {}, {} match(es), {} session(s) routed",
+					 b->name.c_str(),
+					 !b->listed ? "removed" : b->up ? "up" : "down",
+					 b->matches, b->sessions);
+		LOG_INFO(ROUTE, "{} bytes forwarded", bytes_forwarded.load());
+	}
+}
+
+// Main method
+int main(int argc, char* argv[]) {
+	using std::string;
+
+	/**
+	 * Parse command-line arguments:
+	 * [port] [address] [--backend=HOST:PORT]... [--backends=FILE]
+	 * [--log-level=LEVEL] [--log=SUBSYS,...]
+	 */
+	int portno = 8080;
+	string address = "127.0.0.1";
+	std::vector<string> names;
+
+	int positional = 0;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.rfind("--backend=", 0) == 0) {
+			names.push_back(arg.substr(10));
+		} else if (arg.rfind("--backends=", 0) == 0) {
+			backends_path = arg.substr(11);
+		} else if (arg.rfind("--log-level=", 0) == 0) {
+			if (!logger::set_level(arg.substr(12)))
+				fatal_error(1, "Unknown log level");
+		} else if (arg.rfind("--log=", 0) == 0) {
+			if (!logger::set_filter(arg.substr(6)))
+				fatal_error(1, "Unknown log subsystem");
+		} else if (positional == 0) {
+			portno = std::stoi(arg);
+			positional++;
+		} else if (positional == 1) {
+			address = arg;
+			positional++;
+		} else {
+			fatal_error(1, "Usage: router [port] [address] "
+						   "[--backend=HOST:PORT]... [--backends=FILE] "
+						   "[--log-level=LEVEL] [--log=SUBSYS,...]");
+		}
+	}
+	if (!backends_path.empty() && !load_backends(backends_path, names))
+		fatal_error(1, "Error reading the backend list");
+	if (names.empty())
+		fatal_error(1, "No backends given (--backend=HOST:PORT or --backends=FILE)");
+
+	logger::start();
+	set_backends(names);
+
+	{
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGUSR1);
+		sigaddset(&set, SIGHUP);
+		sigaddset(&set, SIGINT);
+		sigaddset(&set, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &set, nullptr);
+		std::thread(signal_loop, set).detach();
+	}
+	std::thread(probe_loop).detach();
+
+	/**
+	 * Listen for clients
+	 */
+	sockaddr_in serv_addr{};
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_port = htons(portno);
+	if (inet_pton(AF_INET, address.c_str(), &serv_addr.sin_addr) <= 0)
+		fatal_error(1, "Invalid or unsupported address");
+	if ((serv_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		fatal_error(1, "Error opening socket");
+	int opt = 1;
+	setsockopt(serv_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (bind(serv_fd, (sockaddr*)&serv_addr, sizeof(serv_addr)) < 0)
+		fatal_error(1, "Error on binding");
+	if (listen(serv_fd, SOMAXCONN) < 0)
+		fatal_error(1, "Error on listen");
+
+	LOG_INFO(ROUTE, "Routing {}:{} across {} backend(s)", address.c_str(),
+			 portno, names.size());
+
+	while (true) {
+		int cfd = accept(serv_fd, nullptr, nullptr);
+		if (cfd < 0)
+			fatal_error(1, "Error on accept");
+		set_nodelay(cfd);
+		std::thread(handle_client, cfd).detach();
+	}
+}
@@ -0,0 +1,227 @@
+#include "sendqueue.hh"
+#include "capture.hh"
+#include "log.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+
+using namespace TTT_PROTO;
+
+SendQueue::SendQueue(int sockfd, SlowPolicy policy, size_t byte_cap,
+					 uint32_t capture_conn, size_t slots)
+	: m_fd(sockfd), m_policy(policy),
+	  m_cap(std::clamp(byte_cap, 4 * MAX_FRAME, slots * MAX_FRAME)),
+	  m_capture_conn(capture_conn), m_slots(slots), m_ring(slots) {
+	m_thread = std::thread(&SendQueue::run, this);
+}
+
+SendQueue::~SendQueue() { stop(0); }
+
+bool SendQueue::push(const uint8_t* frame, size_t len) {
+	if (len < sizeof(MsgHeader) || len > MAX_FRAME)
+		return false;
+	if (m_capture_conn)
+		capture::record(m_capture_conn, capture::Dir::OUT, frame, len);
+
+	Frame f;
+	f.len = uint16_t(len);
+	std::memcpy(f.bytes, frame, len);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_dead || m_stop)
+		return false;
+
+	if (m_count == m_slots || m_stats.depth_bytes + f.len > m_cap) {
+		m_stats.overflows++;
+		if (!overflow(f))
+			return false;
+	}
+
+	append(f);
+
+	// Report a peer once each time it falls more than half a cap behind
+	if (!m_lagging && m_stats.depth_bytes > m_cap / 2) {
+		m_lagging = true;
+		LOG_WARN(QUEUE, "Socket {} lagging: {} bytes queued", m_fd,
+				 m_stats.depth_bytes);
+	}
+
+	m_cv.notify_all();
+	return true;
+}
+
+bool SendQueue::flush(int timeout_ms) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+		return m_dead || (m_count == 0 && !m_sending);
+	});
+}
+
+void SendQueue::stop(int linger_ms) {
+	if (!m_thread.joinable())
+		return;
+
+	if (linger_ms > 0)
+		flush(linger_ms);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+		// Unblock a writer stuck in send() on a full window. A parked
+		// writer is idle, and its socket now belongs to someone else
+		if (!m_parked && (m_count > 0 || m_sending))
+			shutdown(m_fd, SHUT_WR);
+	}
+	m_cv.notify_all();
+	m_thread.join();
+}
+
+bool SendQueue::park(int timeout_ms) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+			return m_dead || (m_count == 0 && !m_sending);
+		}))
+		return false;
+	m_parked = true;
+	return true;
+}
+
+void SendQueue::unpark() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_parked = false;
+	}
+	m_cv.notify_all();
+}
+
+QueueStats SendQueue::stats() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+void SendQueue::run() {
+	Frame f;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_sending = false;
+			m_cv.notify_all();
+			m_cv.wait(lock,
+					  [this] { return m_stop || (m_count > 0 && !m_parked); });
+			if (m_stop || m_dead)
+				return;
+
+			// Pop the front frame; it is sent outside the lock
+			f = m_ring[m_head];
+			m_head = (m_head + 1) % m_slots;
+			m_count--;
+			m_stats.depth_bytes -= f.len;
+			if (m_stats.depth_bytes <= m_cap / 4)
+				m_lagging = false;
+			m_sending = true;
+		}
+
+		size_t total = 0;
+		{
+			TTT_TRACE_SPAN("send");
+			while (total < f.len) {
+				ssize_t n =
+					send(m_fd, f.bytes + total, f.len - total, MSG_NOSIGNAL);
+				if (n <= 0)
+					break;
+				total += size_t(n);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (total < f.len) {
+			// Peer is gone; the reader side will notice and end the session
+			m_dead = true;
+			m_sending = false;
+			m_cv.notify_all();
+			return;
+		}
+		m_stats.sent++;
+	}
+}
+
+void SendQueue::append(const Frame& f) {
+	m_ring[(m_head + m_count) % m_slots] = f;
+	m_count++;
+	m_stats.depth_bytes += f.len;
+	m_stats.high_water = std::max(m_stats.high_water, m_stats.depth_bytes);
+}
+
+void SendQueue::remove_type(MsgType type, bool keep_last) {
+	// Index of the newest matching frame, which `keep_last` spares
+	size_t last = m_count;
+	if (keep_last) {
+		for (size_t i = 0; i < m_count; i++) {
+			if (static_cast<MsgType>(m_ring[(m_head + i) % m_slots].bytes[0]) ==
+				type)
+				last = i;
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < m_count; i++) {
+		const Frame& f = m_ring[(m_head + i) % m_slots];
+		if (static_cast<MsgType>(f.bytes[0]) == type && i != last) {
+			m_stats.depth_bytes -= f.len;
+			m_stats.dropped++;
+			continue;
+		}
+		m_ring[(m_head + kept) % m_slots] = f;
+		kept++;
+	}
+	m_count = kept;
+}
+
+bool SendQueue::overflow(const Frame& incoming) {
+	MsgType type = static_cast<MsgType>(incoming.bytes[0]);
+
+	switch (m_policy) {
+	case SlowPolicy::DISCONNECT:
+		disconnect();
+		return false;
+
+	case SlowPolicy::DROP_TO_SNAPSHOT:
+		// Older boards and turns are superseded by the newest ones, which
+		// stay where they were queued; the incoming frame supersedes all
+		// of its type. Everything else must still reach the peer
+		remove_type(MsgType::BOARD_UPDATE, type != MsgType::BOARD_UPDATE);
+		remove_type(MsgType::TURN, type != MsgType::TURN);
+		if (m_count == m_slots || m_stats.depth_bytes + incoming.len > m_cap) {
+			disconnect();
+			return false;
+		}
+		return true;
+
+	case SlowPolicy::COALESCE_BOARD:
+		// Only the newest board matters. It stays where it was queued,
+		// ahead of the frames that followed it, unless the incoming board
+		// supersedes it; everything else keeps its order
+		remove_type(MsgType::BOARD_UPDATE, type != MsgType::BOARD_UPDATE);
+		if (m_count == m_slots || m_stats.depth_bytes + incoming.len > m_cap) {
+			disconnect();
+			return false;
+		}
+		return true;
+	}
+	return true;
+}
+
+void SendQueue::disconnect() {
+	LOG_WARN(QUEUE, "Socket {} too slow, disconnecting", m_fd);
+	m_stats.dropped += m_count;
+	m_count = 0;
+	m_stats.depth_bytes = 0;
+	m_dead = true;
+	if (!m_parked)
+		shutdown(m_fd, SHUT_RDWR);
+	m_cv.notify_all();
+}
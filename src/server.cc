@@ -1,21 +1,43 @@
 #include "game.hh"
+#include "analytics.hh"
+#include "capture.hh"
+#include "eventlog.hh"
+#include "handoff.hh"
+#include "heartbeat.hh"
+#include "history.hh"
+#include "log.hh"
+#include "message.hh"
+#include "perthread.hh"
 #include "protocol.hh"
+#include "ratings.hh"
+#include "sendqueue.hh"
+#include "shard.hh"
+#include "trace.hh"
 #include "utils.hh"
 
+#include <algorithm>
+#include <array>
 #include <arpa/inet.h>
 #include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
 #include <cerrno>
 #include <csignal>
 #include <cstring>
-#include <iostream>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <string>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <thread>
 #include <unistd.h>
+#include <unordered_map>
 
 // Number of currently connected clients
 std::atomic<int> current_connections(0);
@@ -25,13 +47,96 @@ Game g;
 std::mutex game_mutex;
 // Server sockfd
 int serv_fd = -1;
+// Listener for multiplexed connections (-1 if disabled)
+int mux_fd = -1;
 // Array to hold both player sockfd's
 int player_socket[] = {-1, -1};
+// Outbound queue of each connected player (guarded by game_mutex)
+SendQueue* player_queue[] = {nullptr, nullptr};
+// Rating id of each seated player, -1 if anonymous (guarded by game_mutex)
+int32_t player_rating[] = {-1, -1};
+// Moves played so far, packed 4 bits per cell (guarded by game_mutex)
+uint64_t move_log = 0;
+uint8_t move_count = 0;
+// Move events of the current match, replayed to resuming clients (guarded
+// by game_mutex)
+EventLog events;
+// Resume token issued to each seat, 0 if none (guarded by game_mutex)
+uint64_t seat_token[] = {0, 0};
+// Set while a dropped player's seat is held for them to resume, with a
+// generation bumped per hold so a stale forfeit timer can tell (guarded by
+// game_mutex)
+bool seat_held[] = {false, false};
+uint32_t hold_gen[] = {0, 0};
+// Set once both players got the opening board, and once the match has a
+// result (guarded by game_mutex)
+bool match_started = false;
+bool match_finished = false;
+// Player who moved first in the current match; each rematch hands the
+// first move to the other player (guarded by game_mutex)
+Player first_player = Player::P1;
+// Set for each seat whose player asked for a rematch of the finished match
+// (guarded by game_mutex)
+bool rematch_wanted[] = {false, false};
+// How long a dropped player's seat is held (0 disables resumption)
+uint32_t resume_grace_ms = 30000;
+// How long a connection arriving while a seat is held gets to send its
+// first frame (RESUME or HELLO)
+constexpr int FIRST_FRAME_WAIT_MS = 2000;
+// How long a shard waits for a new connection's first frame, to see if it
+// is a RESUME for another shard, while any shard holds a seat
+constexpr int RESUME_PEEK_MS = 100;
+// Persistent player ratings, and the file they are kept in (enabled with
+// --ratings=FILE)
+RatingStore ratings;
+std::string ratings_path;
+// Columnar log of finished matches, and its file (enabled with
+// --history=FILE)
+HistoryWriter history;
+std::string history_path;
+// Slow-consumer policy and per-connection byte cap for outbound queues
+SlowPolicy slow_policy = SlowPolicy::DROP_TO_SNAPSHOT;
+size_t queue_cap = 4096;
+// Unix socket path used for hot restarts (empty if disabled)
+std::string handoff_path;
+// File the trace is written to on SIGUSR1 and at shutdown (empty if disabled)
+std::string trace_path;
+// Frames read from a client but not yet fully handled
+std::atomic<uint32_t> inflight_frames(0);
+// Parks the session readers at a frame boundary for a hot restart (used
+// only with --handoff)
+ReaderGate reader_gate;
+// Bit i set while taken over seat i has not published its queue yet
+// (guarded by game_mutex)
+uint8_t handoff_pending = 0;
+std::condition_variable handoff_cv;
+// Longest a hot restart waits for a reader to finish the frame it is on
+constexpr int HANDOFF_PARK_WAIT_MS = 1000;
+
+// Marks one received frame as in flight for the rest of its scope
+struct InflightGuard {
+	InflightGuard() { inflight_frames.fetch_add(1); }
+	~InflightGuard() { inflight_frames.fetch_sub(1); }
+};
 
 using namespace TTT_PROTO;
 
+// How a client session begins
+struct SessionStart {
+	enum Kind {
+		NEW,	 // fresh player: welcome, then wait for the opponent
+		HANDOFF, // taken over from a previous server process mid-game
+		RESUME	 // player reclaiming a held seat after a dropped connection
+	} kind = NEW;
+	// Rating id of a NEW player already identified by HELLO
+	int32_t rating_id = -1;
+	// RESUME: last event sequence number the client saw
+	uint16_t last_seq = 0;
+};
+
 // Helper method to recv all bytes from a vector to a socket at
 static bool recv_all(int sockfd, void* buf, size_t len) {
+	TTT_TRACE_SPAN("recv_all");
 	u_int8_t* p = reinterpret_cast<uint8_t*>(buf);
 	size_t total = 0;
 	ssize_t n;
@@ -39,7 +144,7 @@ static bool recv_all(int sockfd, void* buf, size_t len) {
 		if ((n = recv(sockfd, p + total, len - total, 0)) <= 0) {
 			// Check for timeout (EAGAIN/EWOULDBLOCK)
 			if (errno == EAGAIN || errno == EWOULDBLOCK) {
-				std::cerr << "Socket timeout: No data received" << std::endl;
+				LOG_WARN(NET, "Socket {} timeout: no data received", sockfd);
 			}
 			return false; // disconnection, timeout, or error
 		}
@@ -48,250 +153,883 @@ static bool recv_all(int sockfd, void* buf, size_t len) {
 	return true;
 }
 
-// Helper method to send all bytes from a vector to a socket at
-static bool send_all(int sockfd, const std::vector<uint8_t>& data) {
-	size_t total = 0, len = data.size();
-	ssize_t n;
-	while (total < len) {
-		if ((n = send(sockfd, data.data() + total, len - total, 0)) <= 0)
-			return false;
-		total += static_cast<size_t>(n);
-	}
-	return true;
+// Lock game_mutex, recording the time spent waiting as a trace span
+static std::unique_lock<std::mutex> lock_game() {
+	TTT_TRACE_SPAN("game_mutex wait");
+	return std::unique_lock<std::mutex>(game_mutex);
+}
+
+// Queue a frame for player `idx` (0 or 1), if connected. Caller holds
+// game_mutex; never blocks on the socket
+template <typename F> static void send_to(int idx, const F& frame) {
+	if (player_queue[idx])
+		player_queue[idx]->push(frame);
+}
+
+// Queue a frame for both players. Caller holds game_mutex
+template <typename F> static void broadcast(const F& frame) {
+	send_to(0, frame);
+	send_to(1, frame);
 }
 
-// Helper method to send board data to a socket
-static bool send_board(int sockfd) {
-	PL_Board pl;
+// Encode the board of `game`, played as match `match`. Caller holds the
+// game's lock
+static FrameOf<MsgType::BOARD_UPDATE> board_frame(const Game& game,
+												  uint32_t match) {
+	PL_Board pl{};
+	pl.match = htonl(match);
 
-	const auto& b = g.board();
+	const auto& b = game.board();
 	for (int i = 0; i < 9; i++)
 		pl.cells[i] = static_cast<uint8_t>(b[i]);
-	std::vector<uint8_t> out;
-	if (serialize(MsgType::BOARD_UPDATE, &pl, sizeof(pl), out)) {
-		std::cerr << "Error serializing board" << std::endl;
-		return false;
-	}
-	if (!send_all(sockfd, out)) {
-		std::cerr << "Error sending board" << std::endl;
-		return false;
-	}
+	return encode<MsgType::BOARD_UPDATE>(pl);
+}
 
-	return true;
+// Encode whose turn it is in `game`, played as match `match`. Caller holds
+// the game's lock
+static FrameOf<MsgType::TURN> turn_frame(const Game& game, uint32_t match) {
+	PL_Turn t{uint8_t(game.activePlayer() == Player::P1 ? 1 : 2), {},
+			  htonl(match)};
+	return encode<MsgType::TURN>(t);
+}
+
+// Queue an error code for one client, about match `match`
+static void send_error(SendQueue& queue, GameErr code, uint32_t match = 0) {
+	queue.push(encode<MsgType::ERROR>(PL_Error{uint8_t(code), {}, htonl(match)}));
+}
+
+// Encode a rematch status
+static FrameOf<MsgType::REMATCH> rematch_frame(RematchStatus status) {
+	return encode<MsgType::REMATCH>(PL_Rematch{uint8_t(status)});
+}
+
+// Start a match between the seated players with `first` to move: reset the
+// board and match state and send both the opening board. Caller holds
+// game_mutex
+static void start_match(Player first) {
+	g.reset(first);
+	first_player = first;
+	move_log = 0;
+	move_count = 0;
+	events.clear();
+	rematch_wanted[0] = rematch_wanted[1] = false;
+	match_started = true;
+	match_finished = false;
+	broadcast(board_frame(g, 0));
+	broadcast(turn_frame(g, 0));
 }
 
-void handle_quit(int) {
+// Close the listeners, write out the trace, history, capture and log, and
+// exit. Called on the signal thread for SIGINT/SIGTERM, or by a session on
+// QUIT_REQUEST; never from a signal handler, as all of these take locks
+static void quit_server() {
 	if (serv_fd != -1)
 		close(serv_fd);
-	std::cout << "\nShutting down server" << std::endl;
+	if (mux_fd != -1)
+		close(mux_fd);
+	if (!handoff_path.empty())
+		unlink(handoff_path.c_str());
+	if (!trace_path.empty())
+		trace::dump_chrome_json(trace_path.c_str());
+	LOG_INFO(NET, "Shutting down server");
+	history.flush();
+	capture::flush();
+	logger::flush();
 	exit(0);
 }
 
-// Method used to handle logic for individual clients
-void handle_client(int sockfd, int player_id) {
-	using std::cout, std::endl;
+// Rating id stored in a history row, back to the rating store's form
+static int32_t player_rating_of(uint32_t id) {
+	return id == NO_PLAYER ? -1 : int32_t(id);
+}
 
-	cout << "Player " << player_id << " connected on socket " << sockfd << endl;
+// Snapshot the match that just ended, won by player `winner` (1 or 2, 0
+// for a draw), for the rating store and history. Those count the player
+// who moved first as X, so a rematch opened by player 2 still replays and
+// validates like any other game. Caller holds game_mutex
+static MatchRow finished_match(int winner) {
+	int x = (first_player == Player::P1 ? 0 : 1);
+	MatchRow row;
+	row.player_x = player_rating[x] < 0 ? NO_PLAYER : uint32_t(player_rating[x]);
+	row.player_o =
+		player_rating[1 - x] < 0 ? NO_PLAYER : uint32_t(player_rating[1 - x]);
+	row.outcome = winner == 0			? Outcome::DRAW
+				  : winner == x + 1 ? Outcome::X_WIN
+									: Outcome::O_WIN;
+	row.move_count = move_count;
+	row.moves = move_log;
+	return row;
+}
 
-	/**
-	 * Welcome the player
-	 */
-	{
-		PL_Welcome pl{(u_int8_t)player_id};
-		std::vector<uint8_t> out;
-		serialize(MsgType::WELCOME, &pl, sizeof(pl), out);
-		send_all(sockfd, out);
+// Rate and record a finished match. Called outside the game lock
+static void record_result(const MatchRow& result) {
+	float x_score = result.outcome == Outcome::X_WIN   ? 1.0f
+					: result.outcome == Outcome::O_WIN ? 0.0f
+													   : 0.5f;
+	ratings.record_match(player_rating_of(result.player_x),
+						 player_rating_of(result.player_o), x_score);
+	history.append(result);
+	analytics::record_result(result.outcome,
+							 result.move_count ? move_at(result.moves, 0) : -1,
+							 result.move_count);
+}
+
+// Rating id for the name in a `size`-byte HELLO payload, -1 if there is none
+static int32_t hello_rating(const PL_Hello& hello, size_t size) {
+	if (size == 0)
+		return -1;
+	std::string name(hello.name,
+					 strnlen(hello.name, std::min(size, PLAYER_NAME_LEN - 1)));
+	return ratings.player(name);
+}
+
+// Queue what a resuming player missed: the move events after `last_seq`,
+// or the whole board if those are no longer logged, then the current turn.
+// If the match ended while they were away they get its result instead of
+// the turn, and the opponent's rematch offer if there is one. Caller holds
+// game_mutex
+static void replay_missed(SendQueue& queue, int idx, uint16_t last_seq) {
+	std::vector<PL_MoveEvent> missed;
+	if (events.since(last_seq, missed)) {
+		for (PL_MoveEvent ev : missed) {
+			ev.seq = htons(ev.seq);
+			queue.push(encode<MsgType::MOVE_EVENT>(ev));
+		}
+		LOG_INFO(GAME, "Replayed {} missed event(s) after seq {}",
+				 missed.size(), last_seq);
+	} else {
+		queue.push(board_frame(g, 0));
+		LOG_INFO(GAME, "Seq {} is no longer logged, sent the board instead",
+				 last_seq);
 	}
 
-	/**
-	 * After both players join, send the empty board + turn
-	 */
+	int result = events.result();
+	if (result < 0) {
+		queue.push(turn_frame(g, 0));
+		return;
+	}
+	if (result == 0)
+		queue.push(encode<MsgType::DRAW>(PL_Draw{}));
+	else
+		queue.push(encode<MsgType::WIN>(PL_Win{uint8_t(result), {}, 0}));
+	if (rematch_wanted[1 - idx])
+		queue.push(rematch_frame(RematchStatus::OFFERED));
+}
+
+// End the match in progress as a forfeit by seat `idx`, whose player is gone
+// for good. The winner stays seated for the next opponent, but gets no
+// rematch. Returns the result to record once the lock is dropped. Caller
+// holds game_mutex
+static MatchRow forfeit_seat(int idx) {
+	match_finished = true;
+	seat_token[idx] = 0;
+
+	uint8_t winner = uint8_t(2 - idx);
+	events.finish(winner);
+	broadcast(encode<MsgType::WIN>(PL_Win{winner, {}, 0}));
+	send_to(1 - idx, rematch_frame(RematchStatus::DECLINED));
+	shard_stats->matches++;
+	return finished_match(winner);
+}
+
+// Release seat `idx` if its player has not resumed within the grace window:
+// forfeit the match if it is still being played, or just free the seat if
+// it ended while they were away
+static void expire_hold(int idx, uint32_t gen) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(resume_grace_ms));
+
+	MatchRow result;
 	{
 		std::lock_guard<std::mutex> lock(game_mutex);
-		if (player_socket[0] != -1 && player_socket[1] != -1) {
-			if (player_id == 2) {
-				send_board(player_socket[0]);
-				send_board(player_socket[1]);
-
-				uint8_t active_pl = (g.activePlayer() == Player::P1 ? 1 : 2);
-				std::vector<uint8_t> buf;
-				serialize(MsgType::TURN, &active_pl, sizeof(active_pl), buf);
-				send_all(player_socket[0], buf);
-				send_all(player_socket[1], buf);
-			}
+		if (!seat_held[idx] || hold_gen[idx] != gen)
+			return;
+		seat_held[idx] = false;
+		shard_stats->held--;
+		if (match_finished) {
+			seat_token[idx] = 0;
+			rematch_wanted[idx] = false;
+			send_to(1 - idx, rematch_frame(RematchStatus::DECLINED));
+			LOG_INFO(GAME, "Player {} did not return, seat freed", idx + 1);
+			return;
 		}
+		result = forfeit_seat(idx);
 	}
 
+	LOG_INFO(GAME, "Player {} did not resume in time, player {} wins",
+			 idx + 1, 2 - idx);
+	record_result(result);
+}
+
+// Hold seat `idx` for its dropped player and arm the forfeit timer. Caller
+// holds game_mutex
+static void hold_seat(int idx) {
+	player_socket[idx] = -1;
+	seat_held[idx] = true;
+	shard_stats->held++;
+	std::thread(expire_hold, idx, ++hold_gen[idx]).detach();
+}
+
+// Build and queue a leaderboard reply of up to `count` entries. Only reads
+// the rating store, so it never takes the game lock
+static void send_leaderboard(SendQueue& queue, int32_t rating_id,
+							 size_t count) {
+	PL_Leaderboard lb{};
+	RatingRecord self;
+	if (ratings.get(rating_id, self)) {
+		lb.self_rank = htonl(ratings.rank(rating_id));
+		lb.self_rating = htons(uint16_t(std::lround(self.rating)));
+	}
+
+	auto top = ratings.top(std::min(count, LEADERBOARD_MAX));
+	lb.count = uint8_t(top.size());
+	for (size_t i = 0; i < top.size(); i++) {
+		std::memcpy(lb.entries[i].name, top[i].name, PLAYER_NAME_LEN);
+		lb.entries[i].rating = htons(uint16_t(std::lround(top[i].rating)));
+		lb.entries[i].games = htons(uint16_t(std::min(top[i].games, 65535u)));
+	}
+
+	size_t size = offsetof(PL_Leaderboard, entries) +
+				  lb.count * sizeof(PL_RatingEntry);
+	queue.push(encode<MsgType::LEADERBOARD>(lb, size));
+}
+
+// Saturate a counter to 32 bits, in network byte order
+static uint32_t net32(uint64_t v) {
+	return htonl(uint32_t(std::min<uint64_t>(v, UINT32_MAX)));
+}
+
+// Build and queue a snapshot of the live analytics. Merges the per-thread
+// counters without taking the game lock
+static void send_stats(SendQueue& queue) {
+	analytics::Snapshot s = analytics::snapshot();
+
+	PL_Stats st;
+	st.moves = net32(s.moves);
+	st.length_sum = net32(s.length_sum);
+	for (int o = 0; o < 3; o++)
+		st.outcomes[o] = net32(s.outcomes[o]);
+	for (int i = 0; i < 9; i++) {
+		st.cells[i] = net32(s.cells[i]);
+		st.opening[i] = net32(s.opening[i]);
+		for (int o = 0; o < 3; o++)
+			st.by_opening[i][o] = net32(s.by_opening[i][o]);
+	}
+	queue.push(encode<MsgType::STATS>(st));
+}
+
+// Method used to handle logic for individual clients. `start` tells
+// whether this is a new player, one taken over from a previous server
+// process, or one resuming after a dropped connection. `conn` is the
+// connection's wire capture id
+void handle_client(int sockfd, int player_id, SessionStart start,
+				   uint32_t conn) {
+	LOG_INFO(NET, "Player {} {} on socket {}", player_id,
+			 start.kind == SessionStart::NEW		? "connected"
+			 : start.kind == SessionStart::RESUME ? "resumed"
+												  : "taken over",
+			 sockfd);
+	int idx = player_id - 1;
+
 	/**
-	 * Main game loop
+	 * Receive buffer for one payload. Replies are encoded into stack frames,
+	 * so the steady-state game loop never touches the heap
 	 */
-	while (true) {
+	std::array<uint8_t, MAX_PAYLOAD> pl;
 
-		/**
-		 * Read header + payload, break if either don't send,
-		 * indicating a disconnection
-		 */
-		MsgHeader hdr;
-		if (!recv_all(sockfd, &hdr, sizeof(hdr))) {
-			cout << "Player " << player_id
-				 << " disconnected (header read failed)\n";
-			break;
+	// Outbound frames for this player, drained by the queue's own writer
+	SendQueue queue(sockfd, slow_policy, queue_cap, conn);
+	// Pings, RTT estimate and dead-peer detection for this connection
+	PeerHealth health(sockfd, queue);
+	heartbeat_add(&health);
+
+	// This player's rating id
+	int32_t rating_id = -1;
+
+	/**
+	 * Publish this player's queue and bring the client up to date. A new
+	 * player is welcomed with a fresh resume token, and whoever completes
+	 * the pair sends the empty board + turn to both players. A resuming
+	 * player is welcomed back and sent only what it missed. A taken over
+	 * client is already up to date
+	 */
+	{
+		std::unique_lock<std::mutex> lock(game_mutex);
+		player_queue[idx] = &queue;
+		// Taken over sessions start together: a move read by one before the
+		// other's queue is published would never reach the other player
+		if (start.kind == SessionStart::HANDOFF) {
+			handoff_pending &= uint8_t(~(1 << idx));
+			handoff_cv.notify_all();
+			handoff_cv.wait(lock, [] { return handoff_pending == 0; });
+		}
+		if (start.kind == SessionStart::NEW) {
+			seat_token[idx] = shard_token(new_resume_token());
+			player_rating[idx] = start.rating_id;
 		}
+		rating_id = player_rating[idx];
 
-		std::vector<uint8_t> pl(hdr.size);
-		if (hdr.size > 0) {
-			if (!recv_all(sockfd, pl.data(), hdr.size)) {
-				cout << "Player " << player_id
-					 << " disconnected (payload read failed)\n";
-				break;
-			}
+		if (start.kind != SessionStart::HANDOFF) {
+			PL_Welcome w{};
+			w.p_id = uint8_t(player_id);
+			w.resume_token = seat_token[idx];
+			queue.push(encode<MsgType::WELCOME>(w));
 		}
 
-		/**
-		 * Read user request (either to move or to quit)
-		 */
-		MsgType type = static_cast<MsgType>(hdr.type);
-
-		// Ensure move request is not malformed
-		if (type == MsgType::MOVE_REQUEST) {
-			if (pl.size() < sizeof(PL_MovReq)) {
-				PL_Error err{(uint8_t)GameErr::MALFORMED_MOVE_REQUEST};
-				std::vector<uint8_t> out;
-				serialize(MsgType::ERROR, &err, sizeof(err), out);
-				send_all(sockfd, out);
-				continue;
+		if (start.kind == SessionStart::RESUME) {
+			replay_missed(queue, idx, start.last_seq);
+		} else if (start.kind == SessionStart::NEW && player_queue[0] &&
+				   player_queue[1]) {
+			start_match(Player::P1);
+		}
+	}
+
+	/**
+	 * Main game loop. Each frame is decoded and dispatched to the matching
+	 * `if constexpr` branch of `on_message`. The session outlives the match,
+	 * so the same connection can go on to rematches
+	 */
+	auto on_message = [&](auto tag, const auto& req, size_t size) {
+		constexpr MsgType type = decltype(tag)::value;
+
+		if constexpr (type == MsgType::MOVE_REQUEST) {
+			int pos = req.pos;
+			// This connection only plays match 0
+			if (req.match != 0) {
+				send_error(queue, GameErr::UNKNOWN_MATCH, ntohl(req.match));
+				return;
 			}
 
-			PL_MovReq mv_req;
-			std::memcpy(&mv_req, pl.data(), sizeof(mv_req));
-			int pos = mv_req.pos;
+			auto lock = lock_game();
+			TTT_TRACE_SPAN("apply move");
 
-			std::lock_guard<std::mutex> lock(game_mutex);
+			if (match_finished) {
+				send_error(queue, GameErr::GAME_ALREADY_FINISHED);
+				return;
+			}
 
-			// Ensure player doesn't send request out of turn
+			// Ensure player doesn't send request out of turn. Nobody may
+			// move before the opponent arrives
 			int active = (g.activePlayer() == Player::P1 ? 1 : 2);
-			if (player_id != active) {
-				PL_Error err{(uint8_t)GameErr::MOVE_OUT_OF_TURN};
-				std::vector<uint8_t> out;
-				serialize(MsgType::ERROR, &err, sizeof(err), out);
-				send_all(sockfd, out);
-				continue;
+			if (!match_started || player_id != active) {
+				send_error(queue, GameErr::MOVE_OUT_OF_TURN);
+				return;
 			}
 
 			// Check move request to ensure it's valid. Send result to client
 			Player p = (player_id == 1 ? Player::P1 : Player::P2);
 			bool valid = g.move(pos, p);
-			{
-				PL_MovRes mv_res;
-				mv_res.status = valid ? 0 : 1;
-				std::vector<uint8_t> out;
-				serialize(MsgType::MOVE_RESULT, &mv_res, sizeof(mv_res), out);
-				send_all(player_socket[player_id - 1], out);
+			if (valid) {
+				analytics::record_move(pos, move_count);
+				move_log |= uint64_t(pos) << (4 * move_count++);
 			}
+			queue.push(encode<MsgType::MOVE_RESULT>(
+				PL_MovRes{uint8_t(valid ? 0 : 1), {}, 0}));
 			if (!valid) {
-				cout << "Player " << player_id << " attempted invalid move at position " << pos << endl;
-				continue;
+				LOG_DEBUG(GAME, "Player {} attempted invalid move at position {}",
+						  player_id, pos);
+				return;
 			}
 
-			// Display board
-			send_board(player_socket[0]);
-			send_board(player_socket[1]);
+			// Log the move for resumption, then display board
+			{
+				PL_MoveEvent ev{htons(events.append(uint8_t(pos),
+												   uint8_t(player_id))),
+								uint8_t(pos), uint8_t(player_id)};
+				broadcast(encode<MsgType::MOVE_EVENT>(ev));
+			}
+			broadcast(board_frame(g, 0));
 
 			/**
-			 * Check win/draw conditions
+			 * Check win/draw conditions. Either ends the match, which is
+			 * rated and recorded once the lock is dropped
 			 */
-
-			// Win
-			if (g.checkWin(p)) {
-				uint8_t r = player_id;
-				std::vector<uint8_t> out;
-				serialize(MsgType::WIN, &r, sizeof(r), out);
-				send_all(player_socket[0], out);
-				send_all(player_socket[1], out);
-				break;
-			}
-
-			// Draw
-			if (g.isDraw()) {
-				std::vector<uint8_t> out;
-				serialize(MsgType::DRAW, nullptr, 0, out);
-				send_all(player_socket[0], out);
-				send_all(player_socket[1], out);
-				break;
+			bool won = g.checkWin(p);
+			if (won || g.isDraw()) {
+				if (won) {
+					broadcast(
+						encode<MsgType::WIN>(PL_Win{uint8_t(player_id), {}, 0}));
+					LOG_INFO(GAME, "Player {} wins", player_id);
+				} else {
+					broadcast(encode<MsgType::DRAW>(PL_Draw{}));
+					LOG_INFO(GAME, "Match drawn");
+				}
+				shard_stats->matches++;
+				match_finished = true;
+				events.finish(uint8_t(won ? player_id : 0));
+				MatchRow result = finished_match(won ? player_id : 0);
+				lock.unlock();
+				record_result(result);
+				return;
 			}
 
 			/**
 			 * Valid move, switch and send turn notification
 			 */
 			g.switchPlayer();
-			{
-				uint8_t p = (g.activePlayer() == Player::P1 ? 1 : 2);
-				std::vector<uint8_t> out;
-				serialize(MsgType::TURN, &p, sizeof(p), out);
-				send_all(player_socket[0], out);
-				send_all(player_socket[1], out);
+			broadcast(turn_frame(g, 0));
+
+		} else if constexpr (type == MsgType::HELLO) {
+			// Identify the player; the rating store has its own lock
+			if (size == 0)
+				return;
+			rating_id = hello_rating(req, size);
+
+			std::lock_guard<std::mutex> lock(game_mutex);
+			player_rating[player_id - 1] = rating_id;
+			LOG_INFO(GAME, "Player {} identified as rated player #{}",
+					 player_id, rating_id);
+
+		} else if constexpr (type == MsgType::LEADERBOARD_REQUEST) {
+			size_t count = size == 0 ? LEADERBOARD_MAX : req.count;
+			send_leaderboard(queue, rating_id, count);
+
+		} else if constexpr (type == MsgType::STATS_REQUEST) {
+			send_stats(queue);
+
+		} else if constexpr (type == MsgType::PONG) {
+			health.pong(req.stamp_ns);
+
+		} else if constexpr (type == MsgType::REMATCH_REQUEST) {
+			std::lock_guard<std::mutex> lock(game_mutex);
+			if (!match_finished) {
+				send_error(queue, GameErr::UNEXPECTED_MESSAGE);
+				return;
+			}
+			// The opponent already left
+			if (!player_queue[1 - idx]) {
+				queue.push(rematch_frame(RematchStatus::DECLINED));
+				return;
+			}
+
+			rematch_wanted[idx] = true;
+			if (!rematch_wanted[1 - idx]) {
+				send_to(1 - idx, rematch_frame(RematchStatus::OFFERED));
+				return;
 			}
+			broadcast(rematch_frame(RematchStatus::STARTED));
+			start_match(first_player == Player::P1 ? Player::P2 : Player::P1);
+			LOG_DEBUG(GAME, "Rematch started, player {} moves first",
+					  first_player == Player::P1 ? 1 : 2);
 
-		} else if (type == MsgType::QUIT_REQUEST) {
-			cout << "QUIT REQUEST RECEIVED" << endl;
-			handle_quit(0);
+		} else if constexpr (type == MsgType::QUIT_REQUEST) {
+			LOG_INFO(NET, "Player {} sent quit request", player_id);
+			quit_server();
 		} else {
-			std::string m = "Unexpected message type";
-			std::vector<uint8_t> out;
-			serialize(MsgType::ERROR, m.data(), m.size(), out);
-			send_all(sockfd, out);
+			send_error(queue, GameErr::UNEXPECTED_MESSAGE);
+		}
+	};
+
+	bool gated = !handoff_path.empty();
+	if (gated)
+		reader_gate.enter();
+
+	while (true) {
+		// A hot restart stops the reader here, between frames
+		if (gated)
+			reader_gate.wait(sockfd);
+
+		/**
+		 * Read header + payload, break if either don't send,
+		 * indicating a disconnection
+		 */
+		MsgHeader hdr;
+		if (!recv_all(sockfd, &hdr, sizeof(hdr))) {
+			LOG_INFO(NET, "Player {} disconnected (header read failed)",
+					 player_id);
+			break;
+		}
+		InflightGuard inflight;
+		health.heard();
+
+		if (hdr.size > 0) {
+			if (!recv_all(sockfd, pl.data(), hdr.size)) {
+				LOG_INFO(NET, "Player {} disconnected (payload read failed)",
+						 player_id);
+				break;
+			}
+		}
+		capture::record(conn, capture::Dir::IN, hdr, pl.data());
+
+		// Reject unknown types and payloads of the wrong size
+		if (dispatch(hdr, pl.data(), on_message) != 0) {
+			MsgType type = static_cast<MsgType>(hdr.type);
+			send_error(queue, type == MsgType::MOVE_REQUEST
+								  ? GameErr::MALFORMED_MOVE_REQUEST
+								  : GameErr::UNEXPECTED_MESSAGE);
 		}
 	} // main loop
+	if (gated)
+		reader_gate.leave();
 
 	/**
-	 * Cleanup after game: close client socket and clear
-	 * socket slot
+	 * Cleanup after the session: unpublish the queue, give it a moment to
+	 * deliver the final frames, then close the client socket. A player
+	 * dropped mid-match keeps their seat for the grace window so they can
+	 * resume, or forfeits at once if resumption is disabled; one who leaves
+	 * before the match started or after it finished frees it for the next
+	 * player, and declines any rematch
 	 */
+	heartbeat_remove(&health);
+	bool forfeited = false;
+	MatchRow result;
+	{
+		std::lock_guard<std::mutex> lock(game_mutex);
+		player_queue[idx] = nullptr;
+		if (!match_started || match_finished) {
+			player_socket[idx] = -1;
+			seat_token[idx] = 0;
+			rematch_wanted[idx] = false;
+			if (match_finished)
+				send_to(1 - idx, rematch_frame(RematchStatus::DECLINED));
+		} else if (resume_grace_ms > 0) {
+			hold_seat(idx);
+			LOG_INFO(NET, "Holding seat {} for {} ms", player_id,
+					 resume_grace_ms);
+		} else {
+			// Resumption is disabled, so the opponent wins at once
+			player_socket[idx] = -1;
+			result = forfeit_seat(idx);
+			forfeited = true;
+		}
+	}
+	if (forfeited) {
+		LOG_INFO(GAME, "Player {} left mid-match, player {} wins", player_id,
+				 3 - player_id);
+		record_result(result);
+	}
+	queue.stop(1000);
+
+	QueueStats qs = queue.stats();
+	LOG_INFO(QUEUE, "Player {} send queue: {} sent, high water {} bytes",
+			 player_id, qs.sent, qs.high_water);
+	if (qs.overflows > 0)
+		LOG_WARN(QUEUE, "Player {} send queue: {} dropped, {} overflows",
+				 player_id, qs.dropped, qs.overflows);
+	LOG_INFO(NET, "Player {} RTT: srtt {} us, jitter {} us over {} samples",
+			 player_id, health.srtt_us(), health.jitter_us(), health.samples());
+
 	close(sockfd);
 }
 
-// Main method
-int main(int argc, char* argv[]) {
-	// Install signal handlers
-	signal(SIGINT, handle_quit);
-	signal(SIGTERM, handle_quit);
+/**
+ * Multiplexed matches (--mux-port). A connection to the mux listener holds
+ * seats in any number of matches at once: each JOIN_REQUEST seats it in the
+ * oldest match waiting for an opponent or opens a new one, and every game
+ * message names its match. Matches have no thread of their own; each is
+ * driven by the two sessions seated in it, under its own lock, so matches
+ * never contend with each other or with the classic match
+ */
+struct MuxMatch {
+	uint32_t id;
+	std::mutex mutex;
+	Game game;
+	// Queue of each seat's connection, nullptr once it left. Seat 0 is set
+	// before the match is published in mux_open and not cleared until it
+	// has been taken out again, so pairing can read it under mux_mutex
+	SendQueue* queue[2] = {nullptr, nullptr};
+	// Rating id of each seat's player, -1 if anonymous
+	int32_t rating[2] = {-1, -1};
+	// Moves played so far, packed 4 bits per cell
+	uint64_t move_log = 0;
+	uint8_t move_count = 0;
+	// Set once both seats are taken, and once the match has a result. The
+	// result is read without the lock to prune finished matches
+	bool started = false;
+	std::atomic<bool> finished{false};
+};
 
-	// Very common members from std namespace
-	using std::cout, std::endl, std::cerr;
-	using std::string;
+// Matches waiting for a second player, oldest first (guarded by mux_mutex)
+std::mutex mux_mutex;
+std::deque<std::shared_ptr<MuxMatch>> mux_open;
+// Id of the next multiplexed match; 0 is the classic match
+std::atomic<uint32_t> next_match_id(1);
+// Most matches one mux connection may be seated in at once
+constexpr size_t MUX_MAX_SEATS = 1024;
+// Frames a mux connection can have queued: one burst per seat
+constexpr size_t MUX_QUEUE_SLOTS = 4096;
 
-	// Parse command-line arguments
-	int portno = 8080;
-	string address = "127.0.0.1";
-	
-	if (argc > 1) {
-		portno = std::stoi(argv[1]);
+// Queue a frame for both seats of `m`. Caller holds m.mutex
+template <typename F> static void mux_broadcast(MuxMatch& m, const F& frame) {
+	for (SendQueue* q : m.queue) {
+		if (q)
+			q->push(frame);
 	}
-	if (argc > 2) {
-		address = argv[2];
+}
+
+// Result of a multiplexed match for the rating store and history, won by
+// player `winner` (1 or 2, 0 for a draw). Caller holds m.mutex
+static MatchRow mux_result(const MuxMatch& m, int winner) {
+	MatchRow row;
+	row.player_x = m.rating[0] < 0 ? NO_PLAYER : uint32_t(m.rating[0]);
+	row.player_o = m.rating[1] < 0 ? NO_PLAYER : uint32_t(m.rating[1]);
+	row.outcome = winner == 0	? Outcome::DRAW
+				  : winner == 1 ? Outcome::X_WIN
+								: Outcome::O_WIN;
+	row.move_count = m.move_count;
+	row.moves = m.move_log;
+	return row;
+}
+
+/**
+ * Seat the connection owning `queue` in the oldest waiting match it is not
+ * already seated in, or open a new match. Replies JOINED, and starts the
+ * match if this completed it. Returns the match and the seat taken
+ */
+static std::pair<std::shared_ptr<MuxMatch>, int> mux_join(SendQueue& queue,
+														  int32_t rating_id) {
+	while (true) {
+		std::shared_ptr<MuxMatch> m;
+		{
+			std::lock_guard<std::mutex> lock(mux_mutex);
+			auto it = std::find_if(mux_open.begin(), mux_open.end(),
+								   [&](const auto& o) { return o->queue[0] != &queue; });
+			if (it != mux_open.end()) {
+				m = *it;
+				mux_open.erase(it);
+			} else {
+				m = std::make_shared<MuxMatch>();
+				m->id = next_match_id.fetch_add(1);
+				m->queue[0] = &queue;
+				m->rating[0] = rating_id;
+				// Reply before an opponent can start the match
+				queue.push(encode<MsgType::JOINED>(
+					PL_Joined{1, {}, htonl(m->id)}));
+				mux_open.push_back(m);
+				return {m, 0};
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m->mutex);
+		// The first player left while we were taking the seat
+		if (m->finished)
+			continue;
+
+		queue.push(encode<MsgType::JOINED>(PL_Joined{2, {}, htonl(m->id)}));
+		m->queue[1] = &queue;
+		m->rating[1] = rating_id;
+		m->started = true;
+		mux_broadcast(*m, board_frame(m->game, m->id));
+		mux_broadcast(*m, turn_frame(m->game, m->id));
+		return {m, 1};
 	}
-	
-	// Print server info
-	cout << "Starting Tic-Tac-Toe server on " << address << ":" << portno << endl;
+}
 
-	int newsockfd;
-	socklen_t cliLen;
-	struct sockaddr_in serv_addr, cli_addr;
+// Apply a move by `seat` to match `m`, replying on `queue`. Returns true if
+// the match is over
+static bool mux_move(MuxMatch& m, int seat, int pos, SendQueue& queue) {
+	std::unique_lock<std::mutex> lock(m.mutex);
+	if (m.finished) {
+		send_error(queue, GameErr::GAME_ALREADY_FINISHED, m.id);
+		return true;
+	}
+	// Nobody may move before the opponent arrives
+	int active = (m.game.activePlayer() == Player::P1 ? 0 : 1);
+	if (!m.started || seat != active) {
+		send_error(queue, GameErr::MOVE_OUT_OF_TURN, m.id);
+		return false;
+	}
+
+	Player p = (seat == 0 ? Player::P1 : Player::P2);
+	bool valid = m.game.move(pos, p);
+	if (valid) {
+		analytics::record_move(pos, m.move_count);
+		m.move_log |= uint64_t(pos) << (4 * m.move_count++);
+	}
+	queue.push(encode<MsgType::MOVE_RESULT>(
+		PL_MovRes{uint8_t(valid ? 0 : 1), {}, htonl(m.id)}));
+	if (!valid)
+		return false;
+	mux_broadcast(m, board_frame(m.game, m.id));
+
+	bool won = m.game.checkWin(p);
+	if (won || m.game.isDraw()) {
+		if (won)
+			mux_broadcast(m, encode<MsgType::WIN>(
+								 PL_Win{uint8_t(seat + 1), {}, htonl(m.id)}));
+		else
+			mux_broadcast(m, encode<MsgType::DRAW>(PL_Draw{htonl(m.id)}));
+		shard_stats->matches++;
+		m.finished = true;
+		MatchRow result = mux_result(m, won ? seat + 1 : 0);
+		lock.unlock();
+		record_result(result);
+		return true;
+	}
+
+	m.game.switchPlayer();
+	mux_broadcast(m, turn_frame(m.game, m.id));
+	return false;
+}
+
+// Give up `seat` of match `m` as its connection closes. A match in progress
+// is forfeited to the opponent; one still waiting is withdrawn
+static void mux_leave(const std::shared_ptr<MuxMatch>& m, int seat) {
+	{
+		std::lock_guard<std::mutex> lock(mux_mutex);
+		std::erase(mux_open, m);
+	}
+
+	MatchRow result;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		m->queue[seat] = nullptr;
+		if (m->finished)
+			return;
+		m->finished = true;
+		if (!m->started)
+			return;
+		uint8_t winner = uint8_t(2 - seat);
+		mux_broadcast(*m,
+					  encode<MsgType::WIN>(PL_Win{winner, {}, htonl(m->id)}));
+		shard_stats->matches++;
+		result = mux_result(*m, winner);
+	}
+	record_result(result);
+}
+
+// Run one connection of the mux listener. `conn` is the connection's wire
+// capture id
+static void handle_mux_client(int sockfd, uint32_t conn) {
+	LOG_INFO(NET, "Multiplexed connection on socket {}", sockfd);
+
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+	// Many matches share this queue, so a slow reader is disconnected
+	// rather than coalesced down to one match's board
+	SendQueue queue(sockfd, SlowPolicy::DISCONNECT,
+					MUX_QUEUE_SLOTS * MAX_FRAME, conn, MUX_QUEUE_SLOTS);
+	PeerHealth health(sockfd, queue);
+	heartbeat_add(&health);
+
+	// Rating id given to the seats taken from now on
+	int32_t rating_id = -1;
+	// Matches this connection is seated in, by id, with the seat it holds.
+	// Only this session touches it, so routing a frame takes no shared lock
+	std::unordered_map<uint32_t, std::pair<std::shared_ptr<MuxMatch>, int>>
+		seats;
+	uint64_t joined = 0;
+
+	bool end_session = false;
+	auto on_message = [&](auto tag, const auto& req, size_t size) {
+		constexpr MsgType type = decltype(tag)::value;
+
+		if constexpr (type == MsgType::JOIN_REQUEST) {
+			// Matches the opponent finished stay here until now
+			if (seats.size() >= MUX_MAX_SEATS)
+				std::erase_if(seats, [](const auto& s) {
+					return s.second.first->finished.load();
+				});
+			if (seats.size() >= MUX_MAX_SEATS) {
+				send_error(queue, GameErr::TOO_MANY_MATCHES);
+				return;
+			}
+			auto seat = mux_join(queue, rating_id);
+			seats.emplace(seat.first->id, seat);
+			joined++;
+
+		} else if constexpr (type == MsgType::MOVE_REQUEST) {
+			uint32_t match = ntohl(req.match);
+			auto it = seats.find(match);
+			if (it == seats.end()) {
+				send_error(queue, GameErr::UNKNOWN_MATCH, match);
+				return;
+			}
+			if (mux_move(*it->second.first, it->second.second, req.pos, queue))
+				seats.erase(it);
+
+		} else if constexpr (type == MsgType::HELLO) {
+			if (size > 0)
+				rating_id = hello_rating(req, size);
+
+		} else if constexpr (type == MsgType::LEADERBOARD_REQUEST) {
+			size_t count = size == 0 ? LEADERBOARD_MAX : req.count;
+			send_leaderboard(queue, rating_id, count);
+
+		} else if constexpr (type == MsgType::STATS_REQUEST) {
+			send_stats(queue);
+
+		} else if constexpr (type == MsgType::PONG) {
+			health.pong(req.stamp_ns);
+
+		} else if constexpr (type == MsgType::QUIT_REQUEST) {
+			// Only this connection leaves; other players keep the server
+			end_session = true;
+
+		} else {
+			send_error(queue, GameErr::UNEXPECTED_MESSAGE);
+		}
+	};
+
+	while (!end_session) {
+		MsgHeader hdr;
+		if (!recv_all(sockfd, &hdr, sizeof(hdr)) ||
+			(hdr.size > 0 && !recv_all(sockfd, pl.data(), hdr.size)))
+			break;
+		health.heard();
+		capture::record(conn, capture::Dir::IN, hdr, pl.data());
+
+		if (dispatch(hdr, pl.data(), on_message) != 0) {
+			MsgType type = static_cast<MsgType>(hdr.type);
+			send_error(queue, type == MsgType::MOVE_REQUEST
+								  ? GameErr::MALFORMED_MOVE_REQUEST
+								  : GameErr::UNEXPECTED_MESSAGE);
+		}
+	}
+
+	// Forfeit or withdraw every match still open, before the queue the
+	// opponents may push to goes away
+	heartbeat_remove(&health);
+	for (auto& [id, seat] : seats)
+		mux_leave(seat.first, seat.second);
+	queue.stop(1000);
+
+	QueueStats qs = queue.stats();
+	LOG_INFO(NET, "Multiplexed connection on socket {} closed: {} match(es) "
+				  "joined, {} frame(s) sent",
+			 sockfd, joined, qs.sent);
+	if (qs.overflows > 0)
+		LOG_WARN(QUEUE, "Socket {} send queue: {} dropped, {} overflows",
+				 sockfd, qs.dropped, qs.overflows);
+	close(sockfd);
+}
+
+// Accept connections on mux_fd forever, each on its own session thread
+static void mux_accept_loop() {
+	while (true) {
+		int fd = accept(mux_fd, nullptr, nullptr);
+		if (fd < 0)
+			fatal_error(1, "Error on accept");
+		int nodelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+		shard_stats->accepted++;
+
+		uint32_t conn = capture::new_conn();
+		capture::record(conn, capture::Dir::OPEN);
+		std::thread([fd, conn] {
+			handle_mux_client(fd, conn);
+			capture::record(conn, capture::Dir::CLOSE);
+		}).detach();
+	}
+}
+
+// Open, bind and listen on a TCP socket. With `reuseport`, several
+// processes can each bind their own listener to the same address and the
+// kernel load-balances incoming connections between them
+static int open_listener(const std::string& address, int portno,
+						 bool reuseport) {
+	int fd;
+	struct sockaddr_in serv_addr;
 
 	/**
 	 * Open socket
 	 */
-	if ((serv_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
 		fatal_error(1, "Error opening socket");
-	
+
 	int opt = 1;
-	setsockopt(serv_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-	
-	// Set socket timeout (30 seconds)
-	struct timeval tv;
-	tv.tv_sec = 30;
-	tv.tv_usec = 0;
-	setsockopt(serv_fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (reuseport &&
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+		fatal_error(1, "Error setting SO_REUSEPORT");
 
 	/**
 	 * Set address and port number to given values (fixed to localhost:8080 in
@@ -305,16 +1043,307 @@ int main(int argc, char* argv[]) {
 	/**
 	 * Bind the host address
 	 */
-	if (bind(serv_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0)
+	if (bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0)
 		fatal_error(1, "Error on binding");
 
 	/**
 	 * Begin listening for clients, this process will sleep and
 	 * await incoming connections.
 	 */
-	if (listen(serv_fd, 5) < 0)
+	if (listen(fd, SOMAXCONN) < 0)
 		fatal_error(1, "Error on listen");
-	cliLen = sizeof(cli_addr);
+
+	return fd;
+}
+
+/**
+ * Handle signals for the whole process: report the RTT distribution and
+ * write the trace (if enabled) every time SIGUSR1 arrives, and shut down on
+ * SIGINT/SIGTERM. They are blocked in every other thread, so all of this
+ * runs here rather than in a signal handler
+ */
+static void signal_loop(sigset_t set) {
+	int sig;
+	while (sigwait(&set, &sig) == 0) {
+		if (sig == SIGINT || sig == SIGTERM)
+			quit_server();
+
+		RttSummary rtt = rtt_summary();
+		LOG_INFO(NET, "RTT over {} samples: p50 {} us, p90 {} us, p99 {} us",
+				 rtt.samples, rtt.p50_us, rtt.p90_us, rtt.p99_us);
+		LOG_INFO(NET, "RTT max {} us", rtt.max_us);
+		if (capture::enabled)
+			LOG_INFO(NET, "Capture: {} record(s) dropped", capture::dropped());
+
+		if (trace_path.empty())
+			continue;
+		if (trace::dump_chrome_json(trace_path.c_str()))
+			LOG_INFO(TRACE, "Trace written to {}", trace_path.c_str());
+		else
+			LOG_ERROR(TRACE, "Error writing trace to {}", trace_path.c_str());
+	}
+}
+
+// Block SIGINT, SIGTERM and SIGUSR1 and start the thread that waits for
+// them. Runs in each shard process (threads do not survive fork), before
+// the threads it starts
+static void start_signal_thread() {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, nullptr);
+	std::thread(signal_loop, set).detach();
+}
+
+/**
+ * Seat a connection that arrived while a seat is held. Its first frame
+ * decides: RESUME with a held seat's token reclaims that seat, anything else
+ * takes a free seat as a new player. Returns the player id, or 0 if the
+ * connection is refused
+ */
+static int claim_seat(int sockfd, uint32_t conn, SessionStart& start) {
+	MsgHeader hdr{};
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+	pollfd pfd{sockfd, POLLIN, 0};
+	if (poll(&pfd, 1, FIRST_FRAME_WAIT_MS) == 1 &&
+		recv_all(sockfd, &hdr, sizeof(hdr))) {
+		if (hdr.size > 0 && !recv_all(sockfd, pl.data(), hdr.size))
+			return 0;
+		capture::record(conn, capture::Dir::IN, hdr, pl.data());
+	}
+
+	PL_Resume req{};
+	bool resume = false;
+	dispatch(hdr, pl.data(), [&](auto tag, const auto& p, size_t size) {
+		constexpr MsgType type = decltype(tag)::value;
+		if constexpr (type == MsgType::RESUME) {
+			req = p;
+			resume = true;
+		} else if constexpr (type == MsgType::HELLO) {
+			start.rating_id = hello_rating(p, size);
+		}
+	});
+
+	std::lock_guard<std::mutex> lock(game_mutex);
+	for (int i = 0; i < 2; i++) {
+		if (resume && seat_held[i] && seat_token[i] == req.token) {
+			seat_held[i] = false;
+			shard_stats->held--;
+			player_socket[i] = sockfd;
+			start.kind = SessionStart::RESUME;
+			start.last_seq = ntohs(req.last_seq);
+			return i + 1;
+		}
+		if (!resume && player_socket[i] == -1 && !seat_held[i]) {
+			player_socket[i] = sockfd;
+			return i + 1;
+		}
+	}
+
+	if (resume) {
+		auto f = encode<MsgType::ERROR>(
+			PL_Error{uint8_t(GameErr::RESUME_REJECTED), {}, 0});
+		capture::record(conn, capture::Dir::OUT, f.data(), f.size());
+		send(sockfd, f.data(), f.size(), MSG_NOSIGNAL);
+	}
+	return 0;
+}
+
+// Run a client session on its own thread, tracking the connection count.
+// A `player_id` of 0 leaves the seat to claim_seat()
+static void start_session(int sockfd, int player_id, SessionStart start) {
+	current_connections.fetch_add(1);
+	// A taken over connection was opened before this process; leaving out
+	// its OPEN tells replay it cannot be reproduced from the start
+	uint32_t conn = capture::new_conn();
+	if (start.kind != SessionStart::HANDOFF)
+		capture::record(conn, capture::Dir::OPEN);
+
+	std::thread([sockfd, player_id, start, conn]() mutable {
+		if (player_id == 0) {
+			player_id = claim_seat(sockfd, conn, start);
+			if (player_id == 0) {
+				LOG_WARN(NET, "Connection refused: no seat to claim");
+				shard_stats->refused++;
+				close(sockfd);
+				capture::record(conn, capture::Dir::CLOSE);
+				current_connections.fetch_sub(1);
+				return;
+			}
+			shard_stats->accepted++;
+		}
+		handle_client(sockfd, player_id, start, conn);
+		capture::record(conn, capture::Dir::CLOSE);
+		current_connections.fetch_sub(1);
+	}).detach();
+}
+
+// True if a new player could sit down now. Caller holds game_mutex
+static bool seat_free() {
+	for (int i = 0; i < 2; i++) {
+		if (player_socket[i] == -1 && !seat_held[i])
+			return true;
+	}
+	return false;
+}
+
+// Seat an accepted connection into this process's match, or refuse it
+static void seat_conn(int newsockfd) {
+	// Ignore new connection if two clients are already connected
+	if (current_connections >= 2) {
+		LOG_WARN(NET, "Connection refused: 2 clients are already connected");
+		shard_stats->refused++;
+		close(newsockfd);
+		return;
+	}
+
+	// Assign player id
+	int player_id = 0;
+	bool claim = false;
+	{
+		std::lock_guard<std::mutex> lock(game_mutex);
+		if (seat_held[0] || seat_held[1]) { // Maybe a player resuming
+			claim = true;
+		} else if (player_socket[0] == -1) { // Player 1 joins
+			player_socket[0] = newsockfd;
+			player_id = 1;
+		} else if (player_socket[1] == -1) { // Player 2 joins
+			player_socket[1] = newsockfd;
+			player_id = 2;
+		} else { // Race condition fallback
+			shard_stats->refused++;
+			close(newsockfd);
+			return;
+		}
+	}
+
+	if (claim) {
+		start_session(newsockfd, 0, SessionStart{});
+		return;
+	}
+
+	shard_stats->accepted++;
+	start_session(newsockfd, player_id, SessionStart{});
+}
+
+// Wait briefly for the connection's first frame. Returns true, with its
+// token, if it is a RESUME. The frame stays queued on the socket
+static bool peek_resume(int fd, uint64_t& token) {
+	auto deadline = std::chrono::steady_clock::now() +
+					std::chrono::milliseconds(RESUME_PEEK_MS);
+	uint8_t buf[sizeof(MsgHeader) + sizeof(PL_Resume)];
+	while (true) {
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+						deadline - std::chrono::steady_clock::now())
+						.count();
+		pollfd pfd{fd, POLLIN, 0};
+		if (left <= 0 || poll(&pfd, 1, int(left)) != 1)
+			return false;
+		ssize_t n = recv(fd, buf, sizeof(buf), MSG_PEEK);
+		if (n <= 0 || buf[0] != uint8_t(MsgType::RESUME))
+			return false;
+
+		PL_Resume req;
+		if (n == ssize_t(sizeof(buf))) {
+			if (!decode<MsgType::RESUME>(buf + sizeof(MsgHeader), buf[1], req))
+				return false;
+			token = req.token;
+			return true;
+		}
+		// Only part of the frame has arrived
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+// Serializes placement between the accept loop and passed connections
+std::mutex place_mutex;
+
+/**
+ * Sharded mode: seat a new player here, or pass them to the shard where
+ * they belong. The lobby shard, with a player waiting, gets them if that
+ * is another shard; an empty shard seats them and becomes the lobby; a
+ * full one passes them on to the next shard, until every shard has seen
+ * them. `hops` counts the shards that passed the connection on
+ */
+static void place_player(int fd, uint8_t hops) {
+	std::lock_guard<std::mutex> place(place_mutex);
+	bool can_pass = hops + 1 < shard_count();
+
+	int lobby = lobby_shard();
+	if (lobby >= 0 && lobby != shard_index && can_pass) {
+		pass_conn(lobby, fd, hops + 1);
+		return;
+	}
+
+	bool free, empty;
+	{
+		std::lock_guard<std::mutex> lock(game_mutex);
+		free = seat_free();
+		empty = player_socket[0] == -1 && player_socket[1] == -1 &&
+				!seat_held[0] && !seat_held[1];
+	}
+	if (empty) {
+		lobby = join_lobby();
+		if (lobby != shard_index && can_pass) {
+			pass_conn(lobby, fd, hops + 1);
+			return;
+		}
+	} else if (!free && can_pass) {
+		pass_conn((shard_index + 1) % shard_count(), fd, hops + 1);
+		return;
+	}
+
+	seat_conn(fd);
+
+	// Once the match has both players, the next one waits elsewhere
+	std::lock_guard<std::mutex> lock(game_mutex);
+	if (!seat_free())
+		leave_lobby();
+}
+
+// Sharded mode: route a connection accepted by, or passed to, this shard.
+// While a seat is held anywhere it may be a RESUME, which goes to the shard
+// that issued its token; the wait for its first frame happens off the
+// accept thread
+static void place_conn(int fd, uint8_t hops) {
+	if (!seats_held()) {
+		place_player(fd, hops);
+		return;
+	}
+	std::thread([fd, hops] {
+		uint64_t token;
+		if (!peek_resume(fd, token))
+			place_player(fd, hops);
+		else if (token_shard(token) != shard_index)
+			pass_conn(token_shard(token), fd, hops + 1);
+		else
+			seat_conn(fd);
+	}).detach();
+}
+
+// Sharded mode: place the connections other shards pass to this one
+static void passed_conn_loop() {
+	while (true) {
+		uint8_t hops;
+		int fd = recv_conn(hops);
+		if (fd >= 0)
+			place_conn(fd, hops);
+	}
+}
+
+// Accept clients on serv_fd forever, seating them into the match (or, in a
+// shard, wherever place_conn() sends them)
+static void accept_loop() {
+	int newsockfd;
+	struct sockaddr_in cli_addr;
+	socklen_t cliLen = sizeof(cli_addr);
+
+	// Liveness of connected players is checked by the heartbeat thread
+	heartbeat_start();
+	if (shard_index >= 0)
+		std::thread(passed_conn_loop).detach();
 
 	// Loop to accept incoming connections
 	while (true) {
@@ -322,40 +1351,385 @@ int main(int argc, char* argv[]) {
 				 accept(serv_fd, (struct sockaddr*)&cli_addr, &cliLen)) < 0)
 			fatal_error(1, "Error on accept");
 
-		// Ignore new connection if two clients are already connected
-		if (current_connections >= 2) {
-			std::cerr << "Connection refused: 2 clients are already connected"
-					  << std::endl;
-			close(newsockfd);
+		// Frames are small and each answers the peer at once; without this,
+		// Nagle holds every frame after the first until the client ACKs
+		int nodelay = 1;
+		setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+				   sizeof(nodelay));
+
+		if (shard_index >= 0)
+			place_conn(newsockfd, 0);
+		else
+			seat_conn(newsockfd);
+
+	} // Incoming connection loop
+}
+
+/**
+ * Hand the listener, both client sockets and the match state to a newly
+ * started server connecting on handoff_path, then exit. The session readers
+ * are first parked between frames, so every frame read so far is applied
+ * and the rest stay whole in the sockets for the new process. The match
+ * then stays frozen (game_mutex held) from the snapshot until this process
+ * is gone, so the new process is the only one that applies moves afterwards
+ */
+static void handoff_loop(int unix_fd) {
+	while (true) {
+		int peer = accept(unix_fd, nullptr, nullptr);
+		if (peer < 0)
+			continue;
+
+		if (!reader_gate.stop(HANDOFF_PARK_WAIT_MS)) {
+			LOG_ERROR(RESTART, "A reader is stuck mid-frame, refusing hot restart");
+			reader_gate.resume();
+			close(peer);
 			continue;
 		}
+		game_mutex.lock();
 
-		// Assign player id
-		int player_id = 0;
-		{
-			std::lock_guard<std::mutex> lock(game_mutex);
-			if (player_socket[0] == -1) { // Player 1 joins
-				player_socket[0] = newsockfd;
-				player_id = 1;
-			} else if (player_socket[1] == -1) { // Player 2 joins
-				player_socket[1] = newsockfd;
-				player_id = 2;
-			} else { // Race condition fallback
-				close(newsockfd);
-				continue;
+		// Let queued frames reach the sockets before they change hands, then
+		// stop the writers and heartbeats: from here on nothing in this
+		// process writes to or shuts down a socket the new process owns
+		heartbeat_pause(true);
+		bool parked = true;
+		for (SendQueue* q : player_queue) {
+			if (q && !q->park(200))
+				parked = false;
+		}
+		// Undo the above if the handoff does not go through
+		auto carry_on = [&] {
+			for (SendQueue* q : player_queue) {
+				if (q)
+					q->unpark();
 			}
+			heartbeat_pause(false);
+			close(peer);
+			game_mutex.unlock();
+			reader_gate.resume();
+		};
+		if (!parked) {
+			LOG_ERROR(RESTART, "A client is not reading, refusing hot restart");
+			carry_on();
+			continue;
 		}
 
-		current_connections.fetch_add(1);
+		HandoffState st{};
+		st.frozen_ns = monotonic_ns();
+		const auto& b = g.board();
+		for (int i = 0; i < 9; i++)
+			st.cells[i] = static_cast<uint8_t>(b[i]);
+		st.active = (g.activePlayer() == Player::P1 ? 1 : 2);
+		st.rating_id[0] = player_rating[0];
+		st.rating_id[1] = player_rating[1];
+		st.move_log = move_log;
+		st.move_count = move_count;
+		st.token[0] = seat_token[0];
+		st.token[1] = seat_token[1];
+		st.held = uint8_t(seat_held[0] | seat_held[1] << 1);
+		st.started = match_started;
+		st.finished = match_finished;
+		st.first = (first_player == Player::P1 ? 1 : 2);
+		st.rematch = uint8_t(rematch_wanted[0] | rematch_wanted[1] << 1);
+		st.events = events;
+		// The new process picks up the history row log once it has this
+		history.flush();
 
-		std::thread([newsockfd, player_id]() {
-			handle_client(newsockfd, player_id);
-			current_connections.fetch_sub(1);
-		}).detach();
+		int fds[HANDOFF_MAX_FDS];
+		int nfds = 0;
+		fds[nfds++] = serv_fd;
+		for (int i = 0; i < 2; i++) {
+			if (player_socket[i] != -1) {
+				fds[nfds++] = player_socket[i];
+				st.seats |= uint8_t(1 << i);
+			}
+		}
+		st.inflight = inflight_frames.load();
 
-	} // Incoming connection loop
+		// Wait for the new process to confirm it owns the sockets
+		char ack = 0;
+		if (!handoff_send(peer, st, fds, nfds) ||
+			recv(peer, &ack, 1, 0) != 1) {
+			LOG_ERROR(RESTART, "Hot restart handoff failed, continuing to serve");
+			carry_on();
+			continue;
+		}
+
+		LOG_INFO(RESTART, "Handed off listener and {} client(s), exiting",
+				 nfds - 1);
+		// Just drop our references; shutdown() would end the connections
+		// for the new process too
+		for (int i = 0; i < nfds; i++)
+			close(fds[i]);
+		capture::flush();
+		logger::flush();
+		_exit(0);
+	}
+}
+
+// Map the rating file and open the history file, if enabled. Shards each
+// append to their own history FILE.<shard> instead (opened after fork)
+static void open_stores() {
+	if (!ratings_path.empty() && !ratings.open(ratings_path))
+		fatal_error(1, "Error opening ratings file");
+	if (!history_path.empty() && !history.open(history_path))
+		fatal_error(1, "Error opening history file");
+}
+
+// Take over from a server already listening on handoff_path. Returns false
+// if there is none, in which case the caller starts fresh
+static bool take_over() {
+	int fd = handoff_connect(handoff_path);
+	if (fd < 0)
+		return false;
+
+	uint64_t start = monotonic_ns();
+	HandoffState st;
+	int fds[HANDOFF_MAX_FDS];
+	int nfds = handoff_recv(fd, st, fds);
+	if (nfds < 1)
+		fatal_error(1, "Hot restart handoff failed");
+
+	// The old process rated and logged every match up to its snapshot, so
+	// open the files only now, and before a session can record a result
+	open_stores();
+
+	/**
+	 * Restore the listener, match state and player sockets
+	 */
+	serv_fd = fds[0];
+
+	first_player = (st.first == 2 ? Player::P2 : Player::P1);
+	g.reset(st.active == 2 ? Player::P2 : Player::P1);
+	auto& b = g.board();
+	for (int i = 0; i < 9; i++)
+		b[i] = static_cast<Cell>(st.cells[i]);
+	player_rating[0] = st.rating_id[0];
+	player_rating[1] = st.rating_id[1];
+	move_log = st.move_log;
+	move_count = st.move_count;
+	seat_token[0] = st.token[0];
+	seat_token[1] = st.token[1];
+	match_started = st.started;
+	match_finished = st.finished;
+	rematch_wanted[0] = st.rematch & 1;
+	rematch_wanted[1] = st.rematch & 2;
+	events = st.events;
+
+	int next = 1;
+	for (int i = 0; i < 2 && next < nfds; i++) {
+		if (st.seats & (1 << i))
+			player_socket[i] = fds[next++];
+	}
+
+	char ack = 1;
+	send(fd, &ack, 1, 0);
+	close(fd);
+
+	/**
+	 * Resume the sessions and report the handover cost
+	 */
+	{
+		std::lock_guard<std::mutex> lock(game_mutex);
+		for (int i = 0; i < 2; i++) {
+			if (player_socket[i] != -1)
+				handoff_pending |= uint8_t(1 << i);
+		}
+	}
+	for (int i = 0; i < 2; i++) {
+		if (player_socket[i] != -1) {
+			SessionStart start;
+			start.kind = SessionStart::HANDOFF;
+			start_session(player_socket[i], i + 1, start);
+		} else if (st.held & (1 << i)) {
+			std::lock_guard<std::mutex> lock(game_mutex);
+			hold_seat(i);
+		}
+	}
+
+	uint64_t done = monotonic_ns();
+	LOG_INFO(RESTART,
+			 "Took over {} client(s) in {} us (service gap {} us, {} "
+			 "in-flight frame(s) dropped)",
+			 nfds - 1, (done - start) / 1000, (done - st.frozen_ns) / 1000,
+			 st.inflight);
+	return true;
+}
+
+// Main method
+int main(int argc, char* argv[]) {
+	// Very common members from std namespace
+	using std::string;
+
+	/**
+	 * Parse command-line arguments:
+	 * [port] [address] [--shards=N] [--handoff=PATH]
+	 * [--slow-policy=disconnect|snapshot|coalesce] [--queue-cap=BYTES]
+	 * [--trace=FILE] [--log-level=LEVEL] [--log=SUBSYS,...]
+	 * [--ratings=FILE] [--history=FILE] [--capture=FILE]
+	 * [--ping-interval=MS] [--dead-after=MS] [--resume-grace=MS]
+	 * [--mux-port=PORT]
+	 */
+	int portno = 8080;
+	string address = "127.0.0.1";
+	int shards = 0;
+	string capture_path;
+	int mux_port = 0;
+
+	int positional = 0;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.rfind("--shards=", 0) == 0) {
+			shards = std::stoi(arg.substr(9));
+		} else if (arg.rfind("--handoff=", 0) == 0) {
+			handoff_path = arg.substr(10);
+		} else if (arg.rfind("--slow-policy=", 0) == 0) {
+			string policy = arg.substr(14);
+			if (policy == "disconnect")
+				slow_policy = SlowPolicy::DISCONNECT;
+			else if (policy == "snapshot")
+				slow_policy = SlowPolicy::DROP_TO_SNAPSHOT;
+			else if (policy == "coalesce")
+				slow_policy = SlowPolicy::COALESCE_BOARD;
+			else
+				fatal_error(1, "Unknown slow-consumer policy");
+		} else if (arg.rfind("--queue-cap=", 0) == 0) {
+			queue_cap = std::stoul(arg.substr(12));
+		} else if (arg.rfind("--trace=", 0) == 0) {
+			trace_path = arg.substr(8);
+		} else if (arg.rfind("--ratings=", 0) == 0) {
+			ratings_path = arg.substr(10);
+		} else if (arg.rfind("--history=", 0) == 0) {
+			history_path = arg.substr(10);
+		} else if (arg.rfind("--mux-port=", 0) == 0) {
+			mux_port = std::stoi(arg.substr(11));
+		} else if (arg.rfind("--capture=", 0) == 0) {
+			capture_path = arg.substr(10);
+		} else if (arg.rfind("--ping-interval=", 0) == 0) {
+			heartbeat_config.interval_ms = std::stoul(arg.substr(16));
+		} else if (arg.rfind("--dead-after=", 0) == 0) {
+			heartbeat_config.dead_after_ms = std::stoul(arg.substr(13));
+		} else if (arg.rfind("--resume-grace=", 0) == 0) {
+			resume_grace_ms = std::stoul(arg.substr(15));
+		} else if (arg.rfind("--log-level=", 0) == 0) {
+			if (!logger::set_level(arg.substr(12)))
+				fatal_error(1, "Unknown log level");
+		} else if (arg.rfind("--log=", 0) == 0) {
+			if (!logger::set_filter(arg.substr(6)))
+				fatal_error(1, "Unknown log subsystem");
+		} else if (positional == 0) {
+			portno = std::stoi(arg);
+			positional++;
+		} else if (positional == 1) {
+			address = arg;
+			positional++;
+		} else {
+			fatal_error(1, "Usage: server [port] [address] [--shards=N] "
+						   "[--handoff=PATH] [--slow-policy=POLICY] "
+						   "[--queue-cap=BYTES] [--trace=FILE] "
+						   "[--log-level=LEVEL] [--log=SUBSYS,...] "
+						   "[--ratings=FILE] [--history=FILE] "
+						   "[--capture=FILE] [--ping-interval=MS] [--dead-after=MS] "
+						   "[--resume-grace=MS] [--mux-port=PORT]");
+		}
+	}
+	// Resume tokens name their shard in one byte
+	if (shards > 256)
+		fatal_error(1, "--shards must be at most 256");
+	if (shards > 0 && !handoff_path.empty())
+		fatal_error(1, "--handoff cannot be combined with --shards");
+	if (shards > 0 && !ratings_path.empty())
+		fatal_error(1, "--ratings cannot be combined with --shards");
+	if (mux_port > 0 && !handoff_path.empty())
+		fatal_error(1, "--mux-port cannot be combined with --handoff");
+	if (heartbeat_config.interval_ms == 0 ||
+		heartbeat_config.dead_after_ms <= heartbeat_config.interval_ms)
+		fatal_error(1, "--dead-after must be longer than --ping-interval");
+
+	if (shards == 0 && !capture_path.empty() && !capture::open(capture_path))
+		fatal_error(1, "Error opening capture file");
+
+	logger::start();
+
+	/**
+	 * Tracing: enable spans. They are dumped together with the RTT
+	 * distribution on SIGUSR1
+	 */
+	if (!trace_path.empty()) {
+#ifndef TTT_TRACE
+		LOG_WARN(TRACE, "Tracing is compiled out, rebuild with `make TRACE=1`");
+#endif
+		trace::enabled = true;
+	}
+
+	// Print server info
+	LOG_INFO(NET, "Starting Tic-Tac-Toe server on {}:{}", address.c_str(),
+			 portno);
+	if (shards > 0)
+		LOG_INFO(SHARD, "Running {} shards", shards);
+
+	/**
+	 * Sharded mode: every shard is its own process with its own
+	 * SO_REUSEPORT listener, pinned CPU and match state. Shards pass
+	 * connections to each other so both players of a match meet on one
+	 * shard (see place_conn())
+	 */
+	if (shards > 0) {
+		// Mux connections each carry many matches, which pair within one
+		// process, so the mux port has a single listener opened here and
+		// served by shard 0. Its backlog survives a restart of that shard
+		if (mux_port > 0) {
+			mux_fd = open_listener(address, mux_port, false);
+			LOG_INFO(NET, "Multiplexed matches on port {}", mux_port);
+		}
+		run_shards(shards, [&](int idx) {
+			start_signal_thread();
+			logger::start();
+			if (!history_path.empty() &&
+				!history.open(history_path + "." + std::to_string(idx)))
+				fatal_error(1, "Error opening history file");
+			if (!capture_path.empty() &&
+				!capture::open(capture_path + "." + std::to_string(idx)))
+				fatal_error(1, "Error opening capture file");
+			serv_fd = open_listener(address, portno, true);
+			if (mux_fd != -1 && idx == 0) {
+				std::thread(mux_accept_loop).detach();
+			} else if (mux_fd != -1) {
+				close(mux_fd);
+				mux_fd = -1;
+			}
+			LOG_INFO(SHARD, "Shard {} (pid {}) listening", idx, getpid());
+			accept_loop();
+		});
+	}
+
+	// Handle signals on their own thread
+	start_signal_thread();
+
+	/**
+	 * With hot restart enabled, take over from a running server if there is
+	 * one, then wait for the next binary to take over from us
+	 */
+	if (handoff_path.empty() || !take_over()) {
+		open_stores();
+		serv_fd = open_listener(address, portno, false);
+	}
+
+	if (!handoff_path.empty()) {
+		int unix_fd = handoff_listen(handoff_path);
+		if (unix_fd < 0)
+			fatal_error(1, "Error listening for hot restarts");
+		std::thread(handoff_loop, unix_fd).detach();
+	}
+
+	if (mux_port > 0) {
+		mux_fd = open_listener(address, mux_port, false);
+		LOG_INFO(NET, "Multiplexed matches on port {}", mux_port);
+		std::thread(mux_accept_loop).detach();
+	}
+
+	accept_loop();
 
 	// Close socket when done
 	close(serv_fd);
 	return 0;
-}
\ No newline at end of file
+}
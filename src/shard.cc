@@ -0,0 +1,265 @@
+#include "shard.hh"
+#include "log.hh"
+#include "utils.hh"
+
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Process-local counters used when not running sharded
+static ShardStats local_stats;
+ShardStats* shard_stats = &local_stats;
+int shard_index = -1;
+
+// Every shard's counters, and the lobby shard (-1 for none), shared by all
+static ShardStats* all_stats = nullptr;
+static std::atomic<int>* lobby = nullptr;
+static int nshards = 0;
+// Datagram socket pair per shard: others send on [1], the shard receives
+// on [0]. Created before fork, so restarted shards keep theirs
+static std::vector<std::array<int, 2>> conn_socks;
+
+// Set by SIGINT/SIGTERM in the supervisor
+static volatile sig_atomic_t stopping = 0;
+// Set by SIGUSR1 in the supervisor
+static volatile sig_atomic_t reporting = 0;
+
+static void handle_stop(int) { stopping = 1; }
+static void handle_report(int) { reporting = 1; }
+
+bool pin_to_cpu(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+int shard_count() { return nshards; }
+
+int lobby_shard() { return lobby ? lobby->load() : -1; }
+
+int join_lobby() {
+	int expected = -1;
+	if (lobby->compare_exchange_strong(expected, shard_index))
+		return shard_index;
+	return expected;
+}
+
+void leave_lobby() {
+	int expected = shard_index;
+	lobby->compare_exchange_strong(expected, -1);
+}
+
+bool seats_held() {
+	for (int i = 0; i < nshards; i++) {
+		if (all_stats[i].held > 0)
+			return true;
+	}
+	return false;
+}
+
+uint64_t shard_token(uint64_t token) {
+	if (shard_index < 0)
+		return token;
+	return (token & ~0xffull) | uint8_t(shard_index);
+}
+
+int token_shard(uint64_t token) { return int(token & 0xff); }
+
+bool pass_conn(int idx, int fd, uint8_t hops) {
+	iovec iov{&hops, sizeof(hops)};
+	alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))] = {};
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	std::memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+	bool sent = idx >= 0 && idx < nshards &&
+				sendmsg(conn_socks[idx][1], &msg, MSG_NOSIGNAL) == 1;
+	close(fd);
+	return sent;
+}
+
+int recv_conn(uint8_t& hops) {
+	iovec iov{&hops, sizeof(hops)};
+	alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))];
+	msghdr msg{};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+
+	ssize_t n;
+	while ((n = recvmsg(conn_socks[shard_index][0], &msg, 0)) < 0 &&
+		   errno == EINTR)
+		;
+	cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+	if (n != 1 || !cm || cm->cmsg_type != SCM_RIGHTS)
+		return -1;
+	int fd;
+	std::memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+	return fd;
+}
+
+// Print the per-shard counters plus their totals
+static void print_stats(const ShardStats* stats, int n, double elapsed) {
+	uint64_t accepted = 0, refused = 0, matches = 0;
+	for (int i = 0; i < n; i++) {
+		accepted += stats[i].accepted;
+		refused += stats[i].refused;
+		matches += stats[i].matches;
+	}
+
+	LOG_INFO(SHARD, "{} shards: {} accepted, {} refused, {} matches", n,
+			 accepted, refused, matches);
+	if (elapsed > 0)
+		LOG_INFO(SHARD, "{} matches/s", double(matches) / elapsed);
+
+	for (int i = 0; i < n; i++) {
+		LOG_INFO(SHARD, "  shard {}: {} accepted, {} matches, {} restarts", i,
+				 stats[i].accepted.load(), stats[i].matches.load(),
+				 stats[i].restarts.load());
+	}
+}
+
+// Fork a single shard. The child never returns from this function
+static pid_t spawn_shard(int idx, int ncpus, ShardStats* stats,
+						 const std::function<void(int)>& serve) {
+	// The child starts with the signals it waits for blocked, so one that
+	// arrives before it is ready stays pending rather than killing it
+	sigset_t set, old;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		fatal_error(1, "Error forking shard");
+	if (pid > 0) {
+		pthread_sigmask(SIG_SETMASK, &old, nullptr);
+		stats[idx].pid = pid;
+		return pid;
+	}
+
+	// Child: restore default signal handling, pin, then serve
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGUSR1, SIG_DFL);
+	shard_stats = &stats[idx];
+	shard_index = idx;
+	if (!pin_to_cpu(idx % ncpus))
+		LOG_WARN(SHARD, "Shard {}: could not pin to CPU {}", idx, idx % ncpus);
+	serve(idx);
+	_exit(0);
+}
+
+void run_shards(int n, const std::function<void(int)>& serve) {
+	// Shared counters, one slot per shard, followed by the lobby
+	size_t size = sizeof(ShardStats) * n + sizeof(std::atomic<int>);
+	void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		fatal_error(1, "Error mapping shard stats");
+	ShardStats* stats = new (mem) ShardStats[n]();
+	lobby = new (stats + n) std::atomic<int>(-1);
+	all_stats = stats;
+	nshards = n;
+
+	conn_socks.resize(n);
+	for (auto& p : conn_socks) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, p.data()) < 0)
+			fatal_error(1, "Error creating shard sockets");
+	}
+
+	int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 1)
+		ncpus = 1;
+
+	struct sigaction sa {};
+	sa.sa_handler = handle_stop;
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+	sa.sa_handler = handle_report;
+	sigaction(SIGUSR1, &sa, nullptr);
+
+	std::vector<pid_t> pids(n);
+	for (int i = 0; i < n; i++)
+		pids[i] = spawn_shard(i, ncpus, stats, serve);
+
+	time_t start = time(nullptr), last_report = start;
+	uint64_t last_matches = 0;
+
+	/**
+	 * Supervise: reap dead shards and restart them, reporting aggregate
+	 * stats every 10 seconds whenever something changed
+	 */
+	while (!stopping) {
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid > 0) {
+			for (int i = 0; i < n; i++) {
+				if (pids[i] != pid)
+					continue;
+				LOG_WARN(SHARD, "Shard {} (pid {}) {}, restarting", i, pid,
+						 WIFSIGNALED(status) ? "crashed" : "exited");
+				stats[i].restarts++;
+				// Its waiting player is gone with it
+				stats[i].held = 0;
+				int waiting = i;
+				lobby->compare_exchange_strong(waiting, -1);
+				pids[i] = spawn_shard(i, ncpus, stats, serve);
+			}
+		}
+
+		// Report now, and have every shard report its own stats
+		if (reporting) {
+			reporting = 0;
+			print_stats(stats, n, double(time(nullptr) - start));
+			for (pid_t p : pids)
+				kill(p, SIGUSR1);
+		}
+
+		// Also bounds how fast a crash-looping shard is restarted
+		sleep(1);
+
+		time_t now = time(nullptr);
+		uint64_t matches = 0;
+		for (int i = 0; i < n; i++)
+			matches += stats[i].matches;
+		if (now - last_report >= 10 && matches != last_matches) {
+			print_stats(stats, n, double(now - start));
+			last_report = now;
+			last_matches = matches;
+		}
+	}
+
+	/**
+	 * Shut down every shard, then report final totals
+	 */
+	for (pid_t pid : pids)
+		kill(pid, SIGTERM);
+	while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR)
+		;
+
+	LOG_INFO(SHARD, "Shutting down supervisor");
+	print_stats(stats, n, double(time(nullptr) - start));
+	logger::flush();
+	exit(0);
+}
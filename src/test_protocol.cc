@@ -1,7 +1,59 @@
+#include "analytics.hh"
+#include "capture.hh"
+#include "eventlog.hh"
+#include "game.hh"
+#include "handoff.hh"
+#include "hashring.hh"
+#include "heartbeat.hh"
+#include "history.hh"
+#include "log.hh"
+#include "message.hh"
 #include "protocol.hh"
+#include "ratings.hh"
+#include "sendqueue.hh"
+#include "validate.hh"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <csignal>
+#include <cstdio>
 #include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <netinet/in.h>
+#include <new>
+#include <optional>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Test hook: count every heap allocation made by the process, on any thread
+ */
+static std::atomic<size_t> g_allocs(0);
+
+void* operator new(size_t n) {
+	g_allocs++;
+	if (void* p = std::malloc(n ? n : 1))
+		return p;
+	throw std::bad_alloc();
+}
+// Out of line, like the counting operator new, so GCC does not pair an
+// inlined free() against it and warn about a mismatch
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
 
 /**
  * TEST: Serialize + deserialize a Welcome payload
@@ -9,7 +61,8 @@
 void test_welcome() {
 	using namespace TTT_PROTO;
 
-	PL_Welcome w{1};
+	PL_Welcome w{};
+	w.p_id = 1;
 	std::vector<uint8_t> bytes;
 
 	assert(serialize(MsgType::WELCOME, &w, sizeof(w), bytes) == 0);
@@ -27,8 +80,1346 @@ void test_welcome() {
 	assert(w_out.p_id == 1);
 }
 
+/**
+ * TEST: Once a connection is set up, the hot path allocates nothing: frames
+ * are encoded, pushed through a SendQueue, read back off the socket and
+ * dispatched to a handler
+ */
+void test_no_steady_state_allocs() {
+	using namespace TTT_PROTO;
+	constexpr int ROUNDS = 1000;
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	SendQueue queue(sv[1], SlowPolicy::DISCONNECT, 16 * MAX_FRAME);
+
+	std::atomic<int> frames{0};
+	std::thread reader([&] {
+		MsgHeader h;
+		std::array<uint8_t, MAX_PAYLOAD> pl;
+		auto handler = [&](auto tag, const auto& p, size_t) {
+			constexpr MsgType type = decltype(tag)::value;
+			if constexpr (type == MsgType::BOARD_UPDATE)
+				assert(p.cells[p.match % 9] == 1);
+			else if constexpr (type == MsgType::TURN)
+				assert(p.player == 1 + p.match % 2);
+		};
+		while (recv(sv[0], &h, sizeof(h), MSG_WAITALL) == sizeof(h) &&
+			   recv(sv[0], pl.data(), h.size, MSG_WAITALL) == h.size) {
+			assert(dispatch(h, pl.data(), handler) == 0);
+			frames++;
+		}
+	});
+
+	size_t before = g_allocs;
+	for (uint32_t i = 0; i < ROUNDS; i++) {
+		PL_Board b{};
+		b.cells[i % 9] = 1;
+		b.match = i;
+		assert(queue.push(encode<MsgType::BOARD_UPDATE>(b)));
+		assert(queue.push(encode<MsgType::TURN>(
+			PL_Turn{uint8_t(1 + i % 2), {}, i})));
+		assert(queue.push(encode<MsgType::DRAW>(PL_Draw{i})));
+		assert(queue.flush(1000));
+	}
+	while (frames < 3 * ROUNDS)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	assert(g_allocs == before);
+
+	queue.stop(0);
+	shutdown(sv[1], SHUT_WR);
+	reader.join();
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/**
+ * TEST: Typed frames decode back to the payload they were encoded from,
+ * dispatch rejects unknown types and disallowed sizes, a legacy 1-byte move
+ * lands in match 0, and neither direction allocates
+ */
+void test_typed_messages() {
+	using namespace TTT_PROTO;
+
+	size_t before = g_allocs;
+
+	auto f = encode<MsgType::MOVE_EVENT>(PL_MoveEvent{7, 4, 2});
+	assert(f.size() == sizeof(MsgHeader) + sizeof(PL_MoveEvent));
+	assert(f.data()[0] == (uint8_t)MsgType::MOVE_EVENT);
+
+	MsgHeader h{f.data()[0], f.data()[1]};
+	int seen = 0;
+	auto handler = [&](auto tag, const auto& p, size_t size) {
+		if constexpr (decltype(tag)::value == MsgType::MOVE_EVENT) {
+			assert(p.seq == 7 && p.pos == 4 && p.player == 2);
+			assert(size == sizeof(PL_MoveEvent));
+			seen++;
+		}
+	};
+	assert(dispatch(h, f.data() + sizeof(MsgHeader), handler) == 0);
+	assert(seen == 1);
+
+	// Wrong size and unknown type never reach the handler
+	h.size = sizeof(PL_MoveEvent) - 1;
+	assert(dispatch(h, f.data() + sizeof(MsgHeader), handler) ==
+		   (int)ProtoErr::INVALID_SIZE);
+	h.type = 200;
+	assert(dispatch(h, f.data() + sizeof(MsgHeader), handler) ==
+		   (int)ProtoErr::INVALID_TYPE);
+	assert(seen == 1);
+
+	// Variable-size payloads send a prefix and decode zero-filled
+	PL_Leaderboard lb{};
+	lb.count = 1;
+	lb.entries[0].rating = 1500;
+	size_t size = offsetof(PL_Leaderboard, entries) + sizeof(PL_RatingEntry);
+	auto lf = encode<MsgType::LEADERBOARD>(lb, size);
+	assert(lf.size() == sizeof(MsgHeader) + size);
+	PL_Leaderboard lb_out;
+	assert(decode<MsgType::LEADERBOARD>(lf.data() + sizeof(MsgHeader), size,
+										lb_out));
+	assert(lb_out.count == 1 && lb_out.entries[0].rating == 1500 &&
+		   lb_out.entries[1].rating == 0);
+
+	// A move names its match; the old 1-byte form is the classic match
+	auto mf = encode<MsgType::MOVE_REQUEST>(PL_MovReq{4, {}, htonl(42)},
+											 sizeof(PL_MovReq));
+	PL_MovReq req;
+	assert(decode<MsgType::MOVE_REQUEST>(mf.data() + sizeof(MsgHeader),
+										 sizeof(PL_MovReq), req));
+	assert(req.pos == 4 && ntohl(req.match) == 42);
+	assert(decode<MsgType::MOVE_REQUEST>(mf.data() + sizeof(MsgHeader), 1, req));
+	assert(req.pos == 4 && req.match == 0);
+
+	assert(encode<MsgType::SERVER_FULL>().size() == sizeof(MsgHeader));
+	assert(g_allocs == before);
+}
+
+/**
+ * TEST: The event log replays exactly the missed events, and refuses once
+ * they have been overwritten or belong to an earlier match. The result of a
+ * finished match is kept until the next one starts
+ */
+void test_event_log() {
+	using namespace TTT_PROTO;
+
+	EventLog log;
+	std::vector<PL_MoveEvent> ev;
+	assert(log.since(0, ev) && ev.empty());
+
+	for (int i = 0; i < 5; i++)
+		assert(log.append(uint8_t(i), uint8_t(1 + i % 2)) == i + 1);
+	assert(log.since(2, ev));
+	assert(ev.size() == 3 && ev[0].seq == 3 && ev[0].pos == 2 &&
+		   ev[2].seq == 5 && ev[2].player == 1);
+	ev.clear();
+	assert(!log.since(6, ev));
+
+	for (size_t i = 0; i < EventLog::CAP; i++)
+		log.append(0, 1);
+	assert(!log.since(2, ev) && ev.empty());
+	assert(log.since(log.seq() - EventLog::CAP, ev) &&
+		   ev.size() == EventLog::CAP);
+
+	// A rematch keeps counting; seqs from the last match are refused
+	ev.clear();
+	uint16_t base = log.seq();
+	log.clear();
+	assert(log.since(base, ev) && ev.empty());
+	assert(log.append(4, 2) == base + 1);
+	assert(!log.since(base - 1, ev));
+	assert(log.since(base, ev) && ev.size() == 1 && ev[0].pos == 4);
+
+	// A player resuming after the result is sent the last moves and the
+	// result; a rematch forgets it
+	assert(log.result() == -1);
+	log.append(5, 1);
+	log.finish(1);
+	ev.clear();
+	assert(log.since(base + 1, ev) && ev.size() == 1 && ev[0].pos == 5);
+	assert(log.result() == 1);
+	log.clear();
+	assert(log.result() == -1);
+	log.finish(0);
+	assert(log.result() == 0);
+}
+
+/**
+ * TEST: The logger writes each thread's lines in the order they were
+ * logged, and a line still buffered when the process forks is written
+ * once, by the parent. Runs in a child process with stdout on a file, so
+ * the writer thread it starts does not outlive the test
+ */
+void test_logger() {
+	constexpr int LINES = 200;
+	char path[] = "/tmp/ttt_log_XXXXXX";
+	int out = mkstemp(path);
+	assert(out >= 0);
+
+	std::fflush(stdout);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		dup2(out, STDOUT_FILENO);
+		logger::start();
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 2; t++) {
+			threads.emplace_back([t] {
+				for (int i = 0; i < LINES; i++) {
+					LOG_INFO(NET, "thread {} line {}", t, i);
+					if (i % 16 == 0)
+						std::this_thread::sleep_for(
+							std::chrono::microseconds(500));
+				}
+			});
+		}
+		for (auto& t : threads)
+			t.join();
+
+		// The writer is paused across fork(), so this is still buffered
+		LOG_INFO(NET, "before fork");
+		pid_t child = fork();
+		if (child == 0) {
+			logger::start();
+			LOG_INFO(NET, "in child");
+			logger::flush();
+			_exit(0);
+		}
+		int status;
+		waitpid(child, &status, 0);
+		logger::flush();
+		_exit(WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	// Lines look like "[s.us] INFO  net: thread 1 line 42"
+	FILE* f = fdopen(out, "r");
+	std::rewind(f);
+	char line[256];
+	int next[2] = {0, 0};
+	int before = 0, child = 0;
+	while (std::fgets(line, sizeof(line), f)) {
+		int t, i;
+		if (const char* msg = std::strstr(line, "net: ")) {
+			if (std::sscanf(msg, "net: thread %d line %d", &t, &i) == 2) {
+				assert(t >= 0 && t < 2 && i == next[t]);
+				next[t]++;
+			}
+			before += std::strcmp(msg, "net: before fork\n") == 0;
+			child += std::strcmp(msg, "net: in child\n") == 0;
+		}
+	}
+	std::fclose(f);
+	unlink(path);
+	assert(next[0] == LINES && next[1] == LINES);
+	assert(before == 1 && child == 1);
+}
+
+/**
+ * TEST: Analytics totals keep the counts of threads that have exited,
+ * including threads whose block was recycled by a later thread
+ */
+void test_analytics() {
+	analytics::Snapshot base = analytics::snapshot();
+
+	// One thread at a time, so each reuses the block the last one freed
+	constexpr int THREADS = 4;
+	for (int t = 0; t < THREADS; t++) {
+		std::thread([t] {
+			analytics::record_move(t, 0);
+			analytics::record_move(8, 1);
+			analytics::record_result(Outcome::X_WIN, t, 2);
+		}).join();
+
+		analytics::Snapshot s = analytics::snapshot();
+		assert(s.moves - base.moves == uint64_t(2 * (t + 1)));
+		assert(s.cells[8] - base.cells[8] == uint64_t(t + 1));
+		assert(s.opening[t] - base.opening[t] == 1);
+		assert(s.by_opening[t][size_t(Outcome::X_WIN)] -
+				   base.by_opening[t][size_t(Outcome::X_WIN)] ==
+			   1);
+		assert(s.outcomes[size_t(Outcome::X_WIN)] -
+				   base.outcomes[size_t(Outcome::X_WIN)] ==
+			   uint64_t(t + 1));
+		assert(s.length_sum - base.length_sum == uint64_t(2 * (t + 1)));
+	}
+
+	// Threads running side by side, with their own blocks
+	std::vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++)
+		threads.emplace_back([] {
+			for (int i = 0; i < 1000; i++)
+				analytics::record_move(4, 1);
+			analytics::record_result(Outcome::DRAW, -1, 0);
+		});
+	for (auto& t : threads)
+		t.join();
+	analytics::Snapshot s = analytics::snapshot();
+	assert(s.moves - base.moves == 2 * THREADS + 1000 * THREADS);
+	assert(s.outcomes[size_t(Outcome::DRAW)] -
+			   base.outcomes[size_t(Outcome::DRAW)] ==
+		   THREADS);
+}
+
+/**
+ * TEST: Captured frames read back in order with their connection, direction
+ * and bytes
+ */
+void test_capture() {
+	using namespace TTT_PROTO;
+
+	char path[] = "/tmp/ttt_capture_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	assert(capture::open(path));
+
+	uint32_t conn = capture::new_conn();
+	assert(conn != 0);
+	capture::record(conn, capture::Dir::OPEN);
+	MsgHeader h{(uint8_t)MsgType::MOVE_REQUEST, 1};
+	uint8_t pos = 4;
+	capture::record(conn, capture::Dir::IN, h, &pos);
+	auto f = encode<MsgType::MOVE_RESULT>(PL_MovRes{0, {}, 0});
+	capture::record(conn, capture::Dir::OUT, f.data(), f.size());
+	capture::flush();
+
+	capture::Reader r;
+	assert(r.open(path));
+	capture::Record rec;
+	const uint8_t* frame;
+	assert(r.next(rec, frame) && rec.dir == capture::Dir::EPOCH);
+	assert(r.next(rec, frame) && rec.dir == capture::Dir::OPEN &&
+		   rec.conn == conn && rec.len == 0);
+	uint64_t open_ts = rec.ts_ns;
+	assert(r.next(rec, frame) && rec.dir == capture::Dir::IN &&
+		   rec.len == 3 && frame[0] == (uint8_t)MsgType::MOVE_REQUEST &&
+		   frame[2] == 4 && rec.ts_ns >= open_ts);
+	assert(r.next(rec, frame) && rec.dir == capture::Dir::OUT &&
+		   rec.len == f.size() && std::memcmp(frame, f.data(), f.size()) == 0);
+	assert(!r.next(rec, frame));
+	assert(capture::dropped() == 0);
+	unlink(path);
+}
+
+/**
+ * TEST: A stopped reader gate parks the reader between frames, even while
+ * frames arrive in pieces: every frame it read was whole, and what it left
+ * in the socket is whole frames that it reads once resumed
+ */
+void test_reader_gate() {
+	using namespace TTT_PROTO;
+	constexpr int FRAMES = 40;
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	ReaderGate gate;
+	std::atomic<int> frames{0};
+
+	std::thread reader([&] {
+		gate.enter();
+		while (true) {
+			gate.wait(sv[0]);
+			MsgHeader h;
+			std::array<uint8_t, MAX_PAYLOAD> pl;
+			if (recv(sv[0], &h, sizeof(h), MSG_WAITALL) != sizeof(h) ||
+				recv(sv[0], pl.data(), h.size, MSG_WAITALL) != h.size)
+				break;
+			assert(h.type == (uint8_t)MsgType::MOVE_REQUEST &&
+				   h.size == sizeof(PL_MovReq));
+			frames++;
+		}
+		gate.leave();
+	});
+
+	// Header and payload go out separately, so the reader is often
+	// mid-frame when the gate is stopped
+	auto f = encode<MsgType::MOVE_REQUEST>(PL_MovReq{4, {}, 0},
+										   sizeof(PL_MovReq));
+	std::thread writer([&] {
+		for (int i = 0; i < FRAMES; i++) {
+			send(sv[1], f.data(), sizeof(MsgHeader), 0);
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+			send(sv[1], f.data() + sizeof(MsgHeader),
+				 f.size() - sizeof(MsgHeader), 0);
+		}
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(3));
+	assert(gate.stop(1000));
+	writer.join();
+
+	int pending = 0;
+	assert(ioctl(sv[0], FIONREAD, &pending) == 0);
+	assert(size_t(frames) * f.size() + size_t(pending) == FRAMES * f.size());
+
+	gate.resume();
+	close(sv[1]);
+	reader.join();
+	assert(frames == FRAMES);
+	close(sv[0]);
+}
+
+/**
+ * TEST: A client socket handed to another owner over SCM_RIGHTS mid-stream
+ * loses no frames. The old owner's queue is parked first; what it is still
+ * given afterwards (heartbeat pings, say) is never sent, and neither its
+ * overflow nor its teardown shuts the socket down under the new owner
+ */
+void test_handover() {
+	using namespace TTT_PROTO;
+	constexpr uint32_t FRAMES = 40;
+
+	int sv[2], hv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, hv) == 0);
+
+	// The client reads until the last owner is gone
+	std::vector<uint32_t> seen;
+	std::thread client([&] {
+		MsgHeader h;
+		PL_Board b;
+		while (recv(sv[0], &h, sizeof(h), MSG_WAITALL) == sizeof(h) &&
+			   recv(sv[0], &b, h.size, MSG_WAITALL) == h.size) {
+			assert(h.type == (uint8_t)MsgType::BOARD_UPDATE);
+			seen.push_back(ntohl(b.match));
+		}
+	});
+	auto board = [](uint32_t i) {
+		return encode<MsgType::BOARD_UPDATE>(PL_Board{{}, {}, htonl(i)});
+	};
+
+	std::optional<SendQueue> old_queue;
+	old_queue.emplace(sv[1], SlowPolicy::DISCONNECT,
+					  SendQueue::DEFAULT_SLOTS * MAX_FRAME);
+	for (uint32_t i = 0; i < FRAMES; i++)
+		assert(old_queue->push(board(i)));
+	assert(old_queue->park(1000));
+	// Queued but never sent, then overflowing into a disconnect
+	for (uint32_t i = 0; i < 2 * SendQueue::DEFAULT_SLOTS; i++)
+		old_queue->push(board(FRAMES * 10));
+
+	HandoffState st{};
+	assert(handoff_send(hv[0], st, &sv[1], 1));
+	int fds[HANDOFF_MAX_FDS];
+	assert(handoff_recv(hv[1], st, fds) == 1);
+	close(sv[1]);
+	old_queue.reset();
+
+	SendQueue new_queue(fds[0], SlowPolicy::DISCONNECT,
+						SendQueue::DEFAULT_SLOTS * MAX_FRAME);
+	for (uint32_t i = FRAMES; i < 2 * FRAMES; i++)
+		assert(new_queue.push(board(i)));
+	new_queue.stop(1000);
+	close(fds[0]);
+	client.join();
+
+	assert(seen.size() == 2 * FRAMES);
+	for (uint32_t i = 0; i < 2 * FRAMES; i++)
+		assert(seen[i] == i);
+	close(sv[0]);
+	close(hv[0]);
+	close(hv[1]);
+}
+
+/**
+ * TEST: Heartbeats. Pong samples feed the RFC 6298 RTT estimate and the
+ * power-of-two RTT histogram; the ping interval halves while a ping goes
+ * unanswered, returns to normal on a pong, and a silent peer is shut down
+ * after the dead window. Ticks are driven by hand with made-up times
+ */
+void test_heartbeat() {
+	using namespace TTT_PROTO;
+	constexpr uint64_t MS = 1'000'000;
+	heartbeat_config.interval_ms = 1000;
+	heartbeat_config.dead_after_ms = 10000;
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	SendQueue queue(sv[1], SlowPolicy::DISCONNECT, 16 * MAX_FRAME);
+	// Pings that reached the peer so far
+	auto pings = [&] {
+		queue.flush(1000);
+		int n = 0;
+		MsgHeader h;
+		PL_Ping p;
+		while (recv(sv[0], &h, sizeof(h), MSG_DONTWAIT) == sizeof(h) &&
+			   recv(sv[0], &p, h.size, MSG_WAITALL) == h.size) {
+			assert(h.type == (uint8_t)MsgType::PING);
+			n++;
+		}
+		return n;
+	};
+
+	/**
+	 * RTT: nine 1 ms samples and one 100 ms sample
+	 */
+	{
+		PeerHealth peer(sv[1], queue);
+		uint64_t t = monotonic_ns();
+		peer.pong(t - 8 * MS, t);
+		assert(peer.srtt_us() == 8000 && peer.jitter_us() == 4000);
+		// err = 8 ms: rttvar = (3 * 4 + 8) / 4, srtt = (7 * 8 + 16) / 8
+		peer.pong(t - 16 * MS, t);
+		assert(peer.srtt_us() == 9000 && peer.jitter_us() == 5000);
+		assert(peer.samples() == 2);
+		// Echoes from the future or without a stamp are ignored
+		peer.pong(t + MS, t);
+		peer.pong(0, t);
+		assert(peer.samples() == 2);
+	}
+	RttSummary before = rtt_summary();
+	{
+		PeerHealth peer(sv[1], queue);
+		uint64_t t = monotonic_ns();
+		for (int i = 0; i < 9; i++)
+			peer.pong(t - MS, t);
+		peer.pong(t - 100 * MS, t);
+	}
+	RttSummary s = rtt_summary();
+	assert(before.samples == 2 && s.samples == 12);
+	// Percentiles report bucket upper bounds: 1000 us falls in [512, 1024),
+	// 8000 us in [4096, 8192), 16000 us in [8192, 16384)
+	assert(s.p50_us == 1024 && s.p90_us == 8192 && s.p99_us == 16384);
+	assert(s.max_us == 100000);
+
+	/**
+	 * Schedule: 1 s, then 500, 250, 125 and 100 ms while unanswered
+	 */
+	PeerHealth peer(sv[1], queue);
+	heartbeat_add(&peer);
+	uint64_t t = monotonic_ns() + 1000 * MS;
+	heartbeat_tick(t - MS);
+	assert(pings() == 0);
+	heartbeat_tick(t);
+	assert(pings() == 1);
+	for (uint64_t gap : {1000, 500, 250, 125, 100, 100}) {
+		t += gap * MS;
+		heartbeat_tick(t - MS);
+		assert(pings() == 0);
+		heartbeat_tick(t);
+		assert(pings() == 1);
+	}
+	// A pong restores the normal interval from the next ping on
+	peer.pong(t - MS, t);
+	t += 100 * MS;
+	heartbeat_tick(t);
+	assert(pings() == 1);
+	heartbeat_tick(t + 999 * MS);
+	assert(pings() == 0);
+	heartbeat_tick(t + 1000 * MS);
+	assert(pings() == 1);
+
+	// Dead window, counted from the pong: still pinged just before it,
+	// shut down at its end
+	t -= 100 * MS;
+	heartbeat_tick(t + 10000 * MS - MS);
+	assert(pings() == 1);
+	char c;
+	assert(recv(sv[0], &c, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN);
+	heartbeat_tick(t + 10000 * MS);
+	assert(recv(sv[0], &c, 1, 0) == 0);
+	heartbeat_remove(&peer);
+	queue.stop(0);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+/**
+ * TEST: A peer that stops reading under the snapshot policy loses only the
+ * boards and turns a newer one supersedes; results still arrive, in order.
+ * Coalescing boards keeps the newest queued board where it was, ahead of
+ * the frames queued after it, and never sends a board twice
+ */
+void test_snapshot_policy() {
+	using namespace TTT_PROTO;
+	constexpr uint32_t UPDATES = 200;
+
+	// Stop the queue and read what reaches the peer: each frame's type,
+	// and its match field (boards and turns carry a sequence number there)
+	auto drain = [](SendQueue& queue, int sv[2], std::vector<uint8_t>& types,
+					std::vector<uint32_t>& matches) {
+		std::thread reader([&] {
+			MsgHeader h;
+			PL_Board pl;
+			while (recv(sv[0], &h, sizeof(h), MSG_WAITALL) == sizeof(h) &&
+				   recv(sv[0], &pl, h.size, MSG_WAITALL) == h.size) {
+				types.push_back(h.type);
+				matches.push_back(pl.match);
+			}
+		});
+		queue.stop(1000);
+		shutdown(sv[1], SHUT_WR);
+		reader.join();
+		close(sv[0]);
+		close(sv[1]);
+	};
+
+	int sv[2];
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	SendQueue queue(sv[1], SlowPolicy::DROP_TO_SNAPSHOT, 4 * MAX_FRAME);
+
+	// Fill the socket and then the ring with boards, numbered by match
+	uint32_t seq = 0;
+	auto board = [&] {
+		return encode<MsgType::BOARD_UPDATE>(PL_Board{{}, {}, ++seq});
+	};
+	while (queue.stats().overflows == 0)
+		assert(queue.push(board()));
+
+	assert(queue.push(encode<MsgType::MOVE_RESULT>(PL_MovRes{1, {}, 0})));
+	assert(queue.push(encode<MsgType::WIN>(PL_Win{1, {}, 0})));
+	for (uint32_t i = 0; i < UPDATES; i++) {
+		assert(queue.push(board()));
+		assert(queue.push(encode<MsgType::TURN>(PL_Turn{1, {}, seq})));
+	}
+	assert(queue.stats().dropped > 0);
+
+	std::vector<uint8_t> types;
+	std::vector<uint32_t> matches;
+	drain(queue, sv, types, matches);
+
+	// The result and win follow the boards queued before them, and the
+	// newest board and turn come last
+	size_t n = types.size();
+	assert(n >= 4);
+	assert(std::count(types.begin(), types.end(),
+					  (uint8_t)MsgType::MOVE_RESULT) == 1);
+	assert(std::count(types.begin(), types.end(), (uint8_t)MsgType::WIN) == 1);
+	assert(types[n - 2] == (uint8_t)MsgType::BOARD_UPDATE &&
+		   matches[n - 2] == seq);
+	assert(types[n - 1] == (uint8_t)MsgType::TURN && matches[n - 1] == seq);
+
+	/**
+	 * Coalesce: a ring of 8 frames, so a win arriving behind boards and
+	 * turns is what overflows it
+	 */
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	SendQueue coalesce(sv[1], SlowPolicy::COALESCE_BOARD, 0, 0, 8);
+	while (coalesce.stats().overflows == 0)
+		assert(coalesce.push(board()));
+	// The ring now holds the newest board; add turns and boards up to 8
+	for (int i = 0; i < 7; i++) {
+		if (i % 2 == 0)
+			assert(coalesce.push(encode<MsgType::TURN>(PL_Turn{1, {}, seq})));
+		else
+			assert(coalesce.push(board()));
+	}
+	uint32_t last_board = seq;
+	assert(coalesce.push(encode<MsgType::WIN>(PL_Win{1, {}, 0})));
+	assert(coalesce.stats().overflows == 2);
+
+	types.clear();
+	matches.clear();
+	drain(coalesce, sv, types, matches);
+
+	// Boards arrive oldest first, each once; the newest is followed by the
+	// turn queued after it and then the win
+	uint32_t prev = 0;
+	for (size_t i = 0; i < types.size(); i++) {
+		if (types[i] != (uint8_t)MsgType::BOARD_UPDATE)
+			continue;
+		assert(matches[i] > prev);
+		prev = matches[i];
+	}
+	n = types.size();
+	assert(n >= 3 && prev == last_board);
+	assert(types[n - 3] == (uint8_t)MsgType::BOARD_UPDATE &&
+		   matches[n - 3] == last_board);
+	assert(types[n - 2] == (uint8_t)MsgType::TURN);
+	assert(types[n - 1] == (uint8_t)MsgType::WIN);
+}
+
+/**
+ * TEST: Elo updates are zero-sum, rank() and top() follow the ratings,
+ * names resolve with find(), and reopening the file rebuilds the same
+ * indexes, including past the first growth of the file
+ */
+void test_ratings() {
+	char path[] = "/tmp/ttt_ratings_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	int32_t alice, bob, carol;
+	float alice_rating;
+	{
+		RatingStore store;
+		assert(store.open(path));
+		alice = store.player("alice");
+		bob = store.player("bob");
+		carol = store.player("carol");
+		assert(alice == 0 && bob == 1 && carol == 2);
+		assert(store.player("alice") == alice);
+		assert(store.find("bob") == bob && store.find("dave") == -1);
+
+		// Equal ratings: the winner takes K/2 from the loser
+		RatingRecord a, b, c;
+		store.record_match(alice, bob, 1.0f);
+		assert(store.get(alice, a) && store.get(bob, b));
+		assert(a.rating == INITIAL_RATING + 16.0f &&
+			   b.rating == INITIAL_RATING - 16.0f);
+		assert(a.wins == 1 && b.losses == 1 && a.games == 1 && b.games == 1);
+
+		// The order of the players does not matter, and no rating leaks
+		store.record_match(bob, alice, 0.0f);
+		store.record_match(alice, carol, 0.5f);
+		assert(store.get(alice, a) && store.get(bob, b) &&
+			   store.get(carol, c));
+		assert(std::fabs(a.rating + b.rating + c.rating -
+						 3 * INITIAL_RATING) < 0.01f);
+		assert(c.rating > INITIAL_RATING && a.draws == 1 && c.draws == 1);
+		alice_rating = a.rating;
+
+		assert(store.rank(alice) == 1 && store.rank(carol) == 2 &&
+			   store.rank(bob) == 3 && store.rank(99) == 0);
+		auto top = store.top(2);
+		assert(top.size() == 2 && std::strcmp(top[0].name, "alice") == 0 &&
+			   std::strcmp(top[1].name, "carol") == 0);
+
+		// Names are cut to fit; the long form still finds the player
+		int32_t longer = store.player("a-very-long-player-name");
+		assert(longer == 3 && store.find("a-very-long-player-name") == 3);
+
+		// Grow the file past its first capacity
+		for (int i = 0; i < 1100; i++)
+			assert(store.player("p" + std::to_string(i)) == 4 + i);
+	}
+
+	RatingStore store;
+	assert(store.open(path));
+	assert(store.find("alice") == alice && store.find("carol") == carol &&
+		   store.find("p1099") == 1103 && store.player("bob") == bob);
+	RatingRecord a;
+	assert(store.get(alice, a) && a.rating == alice_rating && a.games == 3);
+	assert(store.rank(alice) == 1 && store.rank(carol) == 2);
+	assert(store.top(1)[0].rating == alice_rating);
+	assert(store.player("erin") == 1104);
+	unlink(path);
+}
+
+/**
+ * TEST: History rows read back exactly as written: through full blocks,
+ * whose frame-of-reference packing covers constant and 32-bit wide
+ * columns, and through the row log that holds the rows past the last
+ * block. Queries skip blocks by their min/max and filter by role, result
+ * and move range exactly like a plain scan
+ */
+void test_history() {
+	char path[] = "/tmp/ttt_history_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	unlink(path);
+	std::string tail = std::string(path) + ".tail";
+
+	// Block 1: players 0-99 plus anonymous ones; block 2: players 1000-1099
+	// and every match 7 moves long; then a partial block in the row log
+	std::vector<MatchRow> rows;
+	uint64_t rng = 12345;
+	auto next = [&] {
+		rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+		return rng >> 33;
+	};
+	for (size_t i = 0; i < 2 * HISTORY_BLOCK_ROWS + 500; i++) {
+		bool second = i >= HISTORY_BLOCK_ROWS;
+		MatchRow r{};
+		uint32_t base = second ? 1000 : 0;
+		r.player_x = !second && i % 7 == 0 ? NO_PLAYER : base + next() % 100;
+		r.player_o = base + next() % 100;
+		r.outcome = Outcome(next() % 3);
+		r.move_count = second && i < 2 * HISTORY_BLOCK_ROWS
+						   ? 7
+						   : uint8_t(next() % 10);
+		r.moves = next() & ((1ull << (4 * r.move_count)) - 1);
+		rows.push_back(r);
+	}
+
+	// Write in two sessions; the second picks up the first one's row log
+	size_t split = HISTORY_BLOCK_ROWS + 100;
+	{
+		HistoryWriter w;
+		assert(w.open(path, 0));
+		for (size_t i = 0; i < split; i++)
+			w.append(rows[i]);
+		w.flush();
+	}
+	{
+		HistoryWriter w;
+		assert(w.open(path, 0));
+		for (size_t i = split; i < rows.size(); i++)
+			w.append(rows[i]);
+		w.flush();
+	}
+
+	HistoryReader reader;
+	assert(reader.open(path));
+	assert(reader.rows() == rows.size());
+
+	auto same = [](const MatchRow& a, const MatchRow& b) {
+		return a.player_x == b.player_x && a.player_o == b.player_o &&
+			   a.outcome == b.outcome && a.move_count == b.move_count &&
+			   a.moves == b.moves;
+	};
+	HistoryResult all = reader.run(HistoryQuery{}, 4, rows.size());
+	assert(all.blocks == 3 && all.skipped == 0);
+	assert(all.matched == rows.size() && all.rows.size() == rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
+		assert(all.rows[i].first == i && same(all.rows[i].second, rows[i]));
+
+	// Every filter agrees with a plain scan
+	using Result = HistoryQuery::Result;
+	auto expect = [&](const HistoryQuery& q) {
+		uint64_t n = 0;
+		for (const MatchRow& r : rows) {
+			bool any = q.player < 0;
+			bool x = (any || r.player_x == q.player) && q.role != 'O';
+			bool o = (any || r.player_o == q.player) && q.role != 'X';
+			bool won = (x && r.outcome == Outcome::X_WIN) ||
+					   (o && r.outcome == Outcome::O_WIN);
+			bool lost = (x && r.outcome == Outcome::O_WIN) ||
+						(o && r.outcome == Outcome::X_WIN);
+			bool ok = q.result == Result::ANY	 ? x || o
+					  : q.result == Result::WIN	 ? won
+					  : q.result == Result::LOSS ? lost
+												 : (x || o) &&
+													   r.outcome ==
+														   Outcome::DRAW;
+			n += ok && r.move_count >= q.min_moves &&
+				 r.move_count <= q.max_moves;
+		}
+		return n;
+	};
+	for (int64_t player : {int64_t(-1), int64_t(42), int64_t(1042)})
+		for (char role : {'\0', 'X', 'O'})
+			for (Result result :
+				 {Result::ANY, Result::WIN, Result::LOSS, Result::DRAW}) {
+				HistoryQuery q;
+				q.player = player;
+				q.role = role;
+				q.result = result;
+				q.min_moves = 3;
+				q.max_moves = 8;
+				assert(reader.run(q, 2, 0).matched == expect(q));
+			}
+
+	// Player 1042 only plays in the second block and the row log; as X the
+	// anonymous players of the first block stretch its range over 1042
+	HistoryQuery q;
+	q.player = 1042;
+	q.role = 'O';
+	HistoryResult r = reader.run(q, 1, 0);
+	assert(r.skipped == 1 && r.scanned == rows.size() - HISTORY_BLOCK_ROWS);
+	// No match in the second block is shorter than 7 moves
+	q = HistoryQuery{};
+	q.max_moves = 6;
+	r = reader.run(q, 1, 0);
+	assert(r.skipped == 1 && r.matched == expect(q));
+
+	unlink(path);
+	unlink(tail.c_str());
+}
+
+/**
+ * TEST: Every validator kernel the CPU supports gives the expected verdict
+ * for each kind of recorded game, including the scalar tail of a batch
+ */
+void test_validate() {
+	// Pack move cells (0-8) into a MatchRow
+	auto game = [](Outcome o, std::initializer_list<int> moves) {
+		MatchRow r{0, 0, o, 0, 0};
+		for (int m : moves)
+			r.moves |= uint64_t(m) << (4 * r.move_count++);
+		return r;
+	};
+	const MatchRow rows[] = {
+		game(Outcome::X_WIN, {0, 3, 1, 4, 2}),				// X takes row 1
+		game(Outcome::O_WIN, {0, 3, 1, 4, 8, 5}),			// O takes row 2
+		game(Outcome::DRAW, {0, 1, 2, 4, 3, 5, 7, 6, 8}),	// Full board
+		game(Outcome::X_WIN, {0, 0}),						// Occupied cell
+		game(Outcome::X_WIN, {0, 3, 1, 4, 9}),				// Off the board
+		game(Outcome::X_WIN, {0, 3, 1, 4, 2, 5}),			// Move after win
+		game(Outcome::O_WIN, {0, 3, 1, 4, 2}),				// X won, not O
+		game(Outcome::X_WIN, {0, 3, 1}),					// Forfeit
+		game(Outcome::DRAW, {0, 1, 2, 4, 3, 5, 7, 6, 8, 0}), // Tenth move
+	};
+	const Verdict expected[] = {
+		Verdict::OK,			 Verdict::OK,
+		Verdict::OK,			 Verdict::ILLEGAL_MOVE,
+		Verdict::ILLEGAL_MOVE,	 Verdict::PLAY_AFTER_END,
+		Verdict::WRONG_OUTCOME, Verdict::UNDECIDED,
+		Verdict::ILLEGAL_MOVE,
+	};
+	constexpr size_t n = sizeof(rows) / sizeof(rows[0]);
+
+	for (ValidateKernel k : {ValidateKernel::SCALAR, ValidateKernel::SSE41,
+							 ValidateKernel::AVX2}) {
+		if (!kernel_supported(k))
+			continue;
+		Verdict out[n];
+		validate_games(rows, n, out, k);
+		for (size_t i = 0; i < n; i++)
+			assert(out[i] == expected[i]);
+	}
+}
+
+/**
+ * TEST: The hash ring spreads keys over every node, and adding or removing
+ * a node moves only the keys that node gains or owned
+ */
+void test_hash_ring() {
+	constexpr uint64_t KEYS = 20000;
+	HashRing ring;
+	for (uint32_t id = 0; id < 4; id++)
+		ring.add(id, "127.0.0.1:" + std::to_string(9000 + id));
+
+	std::vector<uint32_t> order, before(KEYS);
+	size_t per_node[5] = {};
+	for (uint64_t k = 0; k < KEYS; k++) {
+		ring.walk(k, order);
+		assert(order.size() == 4);
+		before[k] = order[0];
+		per_node[order[0]]++;
+	}
+	// Each node owns a quarter of the keys, give or take
+	for (uint32_t id = 0; id < 4; id++)
+		assert(per_node[id] > KEYS / 8 && per_node[id] < KEYS / 2);
+
+	// A fifth node takes about a fifth of the keys, all from the others
+	ring.add(4, "127.0.0.1:9004");
+	size_t moved = 0;
+	for (uint64_t k = 0; k < KEYS; k++) {
+		ring.walk(k, order);
+		if (order[0] != before[k]) {
+			assert(order[0] == 4);
+			moved++;
+		}
+	}
+	assert(moved > KEYS / 10 && moved < KEYS / 3);
+
+	// Removing a node moves its keys only, to the next node on its walk
+	ring.remove(4);
+	ring.remove(2);
+	assert(!ring.contains(2) && ring.contains(1));
+	for (uint64_t k = 0; k < KEYS; k++) {
+		ring.walk(k, order);
+		assert(order.size() == 3);
+		if (before[k] != 2)
+			assert(order[0] == before[k]);
+	}
+
+	// place() falls back along the walk past nodes that cannot take a key
+	for (uint64_t k = 0; k < 100; k++) {
+		ring.walk(k, order);
+		assert(ring.place(k, [](uint32_t) { return true; }) == order[0]);
+		assert(ring.place(k, [&](uint32_t id) { return id != order[0]; }) ==
+			   order[1]);
+		assert(ring.place(k, [](uint32_t) { return false; }) == -1);
+	}
+}
+
+/**
+ * Helpers for tests that run bin/server as a child process
+ */
+
+// A TCP port on localhost that nothing is listening on
+static int free_port() {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+	socklen_t len = sizeof(addr);
+	getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+	close(fd);
+	return ntohs(addr.sin_port);
+}
+
+// Connect to localhost:port, or return -1. Reads time out after 3 s so a
+// missing frame fails the test instead of hanging it
+static int connect_port(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	timeval tv{3, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+// Run `path` with `port` and `args`, its output discarded
+static pid_t spawn(const char* path, int port,
+				   const std::vector<std::string>& args) {
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		std::string port_arg = std::to_string(port);
+		std::vector<char*> argv{const_cast<char*>(path), port_arg.data()};
+		for (auto& a : args)
+			argv.push_back(const_cast<char*>(a.c_str()));
+		argv.push_back(nullptr);
+		execv(path, argv.data());
+		_exit(127);
+	}
+	return pid;
+}
+
+// Run bin/server on `port` with `args`, once it accepts connections
+static pid_t start_server(int port, const std::vector<std::string>& args) {
+	pid_t pid = spawn("bin/server", port, args);
+	// The probe connection is seated and dropped like any client; give the
+	// server time to free its seat before the test's own clients arrive
+	for (int i = 0; i < 100; i++) {
+		int fd = connect_port(port);
+		if (fd >= 0) {
+			close(fd);
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			return pid;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	assert(!"server did not start");
+	return -1;
+}
+
+static void stop_server(pid_t pid) {
+	kill(pid, SIGTERM);
+	int status;
+	waitpid(pid, &status, 0);
+}
+
+// Read frames from `fd` until one of type `type`, copying its payload into
+// `out`. False on timeout or EOF
+template <TTT_PROTO::MsgType T>
+static bool expect_frame(int fd, TTT_PROTO::PayloadOf<T>* out = nullptr) {
+	using namespace TTT_PROTO;
+	MsgHeader h;
+	std::array<uint8_t, MAX_PAYLOAD> pl;
+	while (recv(fd, &h, sizeof(h), MSG_WAITALL) == sizeof(h) &&
+		   (h.size == 0 ||
+			recv(fd, pl.data(), h.size, MSG_WAITALL) == h.size)) {
+		if (h.type != static_cast<uint8_t>(T))
+			continue;
+		if (out)
+			std::memcpy(out, pl.data(), std::min<size_t>(h.size, sizeof(*out)));
+		return true;
+	}
+	return false;
+}
+
+// Run bin/router on `port` with `args`, once it accepts connections. The
+// probe resumes an unknown token, so it is turned away without opening a
+// match and the first player still opens match 1
+static pid_t start_router(int port, const std::vector<std::string>& args) {
+	using namespace TTT_PROTO;
+	pid_t pid = spawn("bin/router", port, args);
+	for (int i = 0; i < 100; i++) {
+		int fd = connect_port(port);
+		if (fd >= 0) {
+			auto f = encode<MsgType::RESUME>(PL_Resume{~0ull, 0, {}});
+			assert(send(fd, f.data(), f.size(), 0) == ssize_t(f.size()));
+			assert(expect_frame<MsgType::ERROR>(fd));
+			close(fd);
+			return pid;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+	assert(!"router did not start");
+	return -1;
+}
+
+/**
+ * TEST: two players rematch GAMES times over their first connections. Each
+ * rematch clears the board and hands the first move, and with it X, to the
+ * other player, while event numbers keep counting. Moves sent while no
+ * match is being played are refused and reach neither the analytics nor
+ * the history
+ */
+void test_rematch() {
+	using namespace TTT_PROTO;
+	constexpr int GAMES = 50;
+	char path[] = "/tmp/ttt_rematch_XXXXXX";
+	int hfd = mkstemp(path);
+	assert(hfd >= 0);
+	close(hfd);
+	unlink(path);
+	int port = free_port();
+	pid_t server = start_server(port, {"--history=" + std::string(path)});
+
+	auto send_frame = [](int fd, const auto& f) {
+		assert(send(fd, f.data(), f.size(), 0) == ssize_t(f.size()));
+	};
+	auto move = [&](int fd, int pos) {
+		send_frame(fd, encode<MsgType::MOVE_REQUEST>(
+						   PL_MovReq{uint8_t(pos), {}, 0}, sizeof(PL_MovReq)));
+	};
+	auto expect_error = [](int fd, GameErr code) {
+		PL_Error e;
+		assert(expect_frame<MsgType::ERROR>(fd, &e));
+		assert(e.error_code == uint8_t(code));
+	};
+	auto expect_rematch = [](int fd, RematchStatus status) {
+		PL_Rematch r;
+		assert(expect_frame<MsgType::REMATCH>(fd, &r));
+		assert(r.status == uint8_t(status));
+	};
+
+	// Nobody may move before the opponent arrives
+	std::array<int, 2> fds;
+	fds[0] = connect_port(port);
+	assert(expect_frame<MsgType::WELCOME>(fds[0]));
+	move(fds[0], 4);
+	expect_error(fds[0], GameErr::MOVE_OUT_OF_TURN);
+	fds[1] = connect_port(port);
+	assert(expect_frame<MsgType::WELCOME>(fds[1]));
+
+	// The first mover takes the top row while the other fills the middle
+	constexpr int POS[] = {0, 3, 1, 4, 2};
+	uint64_t moves = 0;
+	for (int i = 0; i < 5; i++)
+		moves |= uint64_t(POS[i]) << (4 * i);
+	uint16_t seq = 0;
+	for (int game = 0; game < GAMES; game++) {
+		int first = game % 2;
+		PL_Board b;
+		assert(expect_frame<MsgType::BOARD_UPDATE>(fds[first], &b));
+		for (uint8_t c : b.cells)
+			assert(c == uint8_t(Cell::EMPTY));
+		PL_Turn turn;
+		assert(expect_frame<MsgType::TURN>(fds[first], &turn));
+		assert(turn.player == first + 1);
+
+		for (int i = 0; i < 5; i++) {
+			int mover = (i % 2 == 0 ? first : 1 - first);
+			move(fds[mover], POS[i]);
+			seq++;
+			for (int fd : fds) {
+				PL_MoveEvent ev;
+				assert(expect_frame<MsgType::MOVE_EVENT>(fd, &ev));
+				assert(ntohs(ev.seq) == seq && ev.player == mover + 1);
+			}
+		}
+		for (int fd : fds) {
+			PL_Win w;
+			assert(expect_frame<MsgType::WIN>(fd, &w));
+			assert(w.winner == first + 1);
+		}
+		if (game == GAMES - 1)
+			break;
+
+		// The loser offers a rematch; the winner cannot move until it
+		// accepts
+		int loser = 1 - first;
+		send_frame(fds[loser], encode<MsgType::REMATCH_REQUEST>());
+		expect_rematch(fds[first], RematchStatus::OFFERED);
+		move(fds[first], 8);
+		expect_error(fds[first], GameErr::GAME_ALREADY_FINISHED);
+		send_frame(fds[first], encode<MsgType::REMATCH_REQUEST>());
+		for (int fd : fds)
+			expect_rematch(fd, RematchStatus::STARTED);
+	}
+
+	send_frame(fds[0], encode<MsgType::STATS_REQUEST>());
+	PL_Stats st;
+	assert(expect_frame<MsgType::STATS>(fds[0], &st));
+	assert(ntohl(st.moves) == 5 * GAMES);
+	assert(ntohl(st.outcomes[int(Outcome::X_WIN)]) == GAMES);
+
+	for (int fd : fds)
+		close(fd);
+	stop_server(server);
+
+	// Whoever moved first is X, so every game is an X win
+	HistoryReader reader;
+	assert(reader.open(path));
+	HistoryResult all = reader.run(HistoryQuery{}, 1, GAMES);
+	assert(all.matched == GAMES);
+	for (const auto& [row, r] : all.rows)
+		assert(r.outcome == Outcome::X_WIN && r.move_count == 5 &&
+			   r.moves == moves);
+	unlink(path);
+	unlink((std::string(path) + ".tail").c_str());
+}
+
+/**
+ * TEST: with --shards=2 the two players of each match meet on one shard
+ * however the kernel spreads their connections, and a dropped player
+ * resumes its seat whichever shard the reconnect lands on
+ */
+void test_sharded_pairing() {
+	using namespace TTT_PROTO;
+	constexpr int ROUNDS = 3;
+	constexpr int GRACE_MS = 500;
+	int port = free_port();
+	pid_t server = start_server(
+		port, {"--shards=2", "--resume-grace=" + std::to_string(GRACE_MS)});
+
+	for (int round = 0; round < ROUNDS; round++) {
+		// One match per shard
+		int fds[2][2];
+		PL_Welcome welcome[2][2];
+		for (int m = 0; m < 2; m++) {
+			for (int p = 0; p < 2; p++) {
+				fds[m][p] = connect_port(port);
+				assert(fds[m][p] >= 0);
+				assert(expect_frame<MsgType::WELCOME>(fds[m][p],
+													  &welcome[m][p]));
+				assert(welcome[m][p].p_id == p + 1);
+			}
+			for (int p = 0; p < 2; p++)
+				assert(expect_frame<MsgType::TURN>(fds[m][p]));
+		}
+
+		// Player 1 of each match drops and resumes; the held seat lives on
+		// the shard named by the token, not necessarily the one the
+		// reconnect lands on
+		for (int m = 0; m < 2; m++) {
+			close(fds[m][0]);
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			fds[m][0] = connect_port(port);
+			assert(fds[m][0] >= 0);
+			PL_Resume resume{welcome[m][0].resume_token, htons(0), {}};
+			auto f = encode<MsgType::RESUME>(resume);
+			assert(send(fds[m][0], f.data(), f.size(), 0) ==
+				   ssize_t(f.size()));
+			PL_Welcome again;
+			assert(expect_frame<MsgType::WELCOME>(fds[m][0], &again));
+			assert(again.p_id == 1);
+			assert(again.resume_token == welcome[m][0].resume_token);
+			assert(expect_frame<MsgType::TURN>(fds[m][0]));
+		}
+
+		// Everyone leaves; wait out the held seats before the next round
+		for (auto& match : fds)
+			for (int fd : match)
+				close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(GRACE_MS + 300));
+	}
+	stop_server(server);
+}
+
+/**
+ * TEST: with --shards=2 every mux connection pairs with the next one,
+ * wherever the kernel would have hashed it
+ */
+void test_sharded_mux() {
+	using namespace TTT_PROTO;
+	constexpr int CONNS = 8;
+	int port = free_port();
+	int mux_port = free_port();
+	pid_t server = start_server(
+		port, {"--shards=2", "--mux-port=" + std::to_string(mux_port)});
+
+	std::array<int, CONNS> fds;
+	for (int i = 0; i < CONNS; i++) {
+		fds[i] = connect_port(mux_port);
+		assert(fds[i] >= 0);
+		auto f = encode<MsgType::JOIN_REQUEST>();
+		assert(send(fds[i], f.data(), f.size(), 0) == ssize_t(f.size()));
+		PL_Joined joined;
+		assert(expect_frame<MsgType::JOINED>(fds[i], &joined));
+		assert(joined.p_id == i % 2 + 1);
+		if (i % 2 == 1) {
+			assert(expect_frame<MsgType::TURN>(fds[i - 1]));
+			assert(expect_frame<MsgType::TURN>(fds[i]));
+		}
+	}
+	for (int fd : fds)
+		close(fd);
+	stop_server(server);
+}
+
+/**
+ * TEST: the router opens each match on the first backend along the match
+ * id's walk of the ring that has no match, skipping one that refuses the
+ * player because it is already full
+ */
+void test_router() {
+	using namespace TTT_PROTO;
+	constexpr uint32_t BACKENDS = 4;
+	std::array<int, BACKENDS> ports;
+	std::array<pid_t, BACKENDS> servers;
+	std::vector<std::string> args;
+	HashRing ring;
+	for (uint32_t i = 0; i < BACKENDS; i++) {
+		ports[i] = free_port();
+		servers[i] = start_server(ports[i], {});
+		std::string name = "127.0.0.1:" + std::to_string(ports[i]);
+		ring.add(i, name);
+		args.push_back("--backend=" + name);
+	}
+
+	// Fill the backend match 1 hashes to behind the router's back
+	std::vector<uint32_t> order;
+	ring.walk(1, order);
+	std::array<bool, BACKENDS> busy{};
+	busy[order[0]] = true;
+	std::vector<int> fds;
+	for (int p = 0; p < 2; p++) {
+		fds.push_back(connect_port(ports[order[0]]));
+		assert(expect_frame<MsgType::WELCOME>(fds.back()));
+	}
+
+	int port = free_port();
+	pid_t router = start_router(port, args);
+	std::array<int64_t, 2> placed;
+	for (uint64_t match = 1; match <= 2; match++) {
+		placed[match - 1] =
+			ring.place(match, [&](uint32_t id) { return !busy[id]; });
+		assert(placed[match - 1] >= 0 && placed[match - 1] != order[0]);
+		busy[placed[match - 1]] = true;
+		for (int p = 0; p < 2; p++) {
+			fds.push_back(connect_port(port));
+			PL_Welcome w;
+			assert(expect_frame<MsgType::WELCOME>(fds.back(), &w));
+			assert(w.p_id == p + 1);
+		}
+	}
+
+	// The backends the matches hashed to refuse a third player; the one
+	// left over still seats one
+	for (uint32_t i = 0; i < BACKENDS; i++) {
+		int fd = connect_port(ports[i]);
+		assert(expect_frame<MsgType::WELCOME>(fd) == !busy[i]);
+		close(fd);
+	}
+
+	for (int fd : fds)
+		close(fd);
+	stop_server(router);
+	for (pid_t pid : servers)
+		stop_server(pid);
+}
+
 int main() {
 	test_welcome();
+	test_no_steady_state_allocs();
+	test_typed_messages();
+	test_event_log();
+	test_capture();
+	test_logger();
+	test_analytics();
+	test_reader_gate();
+	test_handover();
+	test_snapshot_policy();
+	test_heartbeat();
+	test_ratings();
+	test_history();
+	test_validate();
+	test_hash_ring();
+	test_rematch();
+	test_sharded_pairing();
+	test_sharded_mux();
+	test_router();
 	std::cout << "All tests passed!" << std::endl;
 
 	return 0;
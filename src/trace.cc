@@ -0,0 +1,102 @@
+#include "trace.hh"
+#include "perthread.hh"
+
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+namespace trace {
+
+std::atomic<bool> enabled(false);
+
+namespace {
+
+struct Event {
+	const char* name;
+	uint64_t start_ns;
+	uint64_t dur_ns;
+};
+
+// Spans kept per thread; older ones are overwritten
+constexpr uint64_t RING_SIZE = 8192;
+
+/**
+ * Single-producer ring. Only the owning thread writes events and publishes
+ * `head`; the dumper reads behind it and discards anything the writer may
+ * have lapped while it was copying
+ */
+struct Ring {
+	Event events[RING_SIZE];
+	std::atomic<uint64_t> head{0};
+	int tid = 0;
+	// False while a live thread owns the ring
+	std::atomic<bool> free{false};
+
+	// Each thread shows up under its own tid, even on a recycled ring
+	void claimed();
+};
+
+// Rings outlive their threads, so the dumper can still export spans from
+// threads that have exited
+PerThread<Ring> rings;
+// Guarded by rings.mutex()
+int next_tid = 1;
+
+void Ring::claimed() { tid = next_tid++; }
+
+} // namespace
+
+void record(const char* name, uint64_t start_ns, uint64_t end_ns) {
+	Ring& r = rings.local();
+
+	uint64_t h = r.head.load(std::memory_order_relaxed);
+	r.events[h % RING_SIZE] = Event{name, start_ns, end_ns - start_ns};
+	r.head.store(h + 1, std::memory_order_release);
+}
+
+bool dump_chrome_json(const char* path) {
+	FILE* f = std::fopen(path, "w");
+	if (!f)
+		return false;
+
+	std::fprintf(f, "{\"traceEvents\":[\n");
+	bool first = true;
+	int pid = getpid();
+
+	std::lock_guard<std::mutex> lock(rings.mutex());
+	std::vector<Event> copy;
+	for (auto& r : rings.items()) {
+		// The writer fills slot `head` before publishing it, and that slot
+		// holds the oldest entry once the ring is full, so only the newest
+		// RING_SIZE - 1 entries are safe to read
+		uint64_t head = r->head.load(std::memory_order_acquire);
+		uint64_t begin = head >= RING_SIZE ? head - RING_SIZE + 1 : 0;
+
+		copy.clear();
+		for (uint64_t i = begin; i < head; i++)
+			copy.push_back(r->events[i % RING_SIZE]);
+
+		// Drop the oldest entries if the writer lapped us while copying,
+		// counting the one it may be writing now
+		uint64_t after = r->head.load(std::memory_order_acquire) + 1;
+		size_t skip = 0;
+		if (after - begin > RING_SIZE)
+			skip = size_t(after - begin - RING_SIZE);
+
+		for (size_t i = skip; i < copy.size(); i++) {
+			const Event& e = copy[i];
+			std::fprintf(f,
+						 "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+						 "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+						 first ? "" : ",\n", e.name, e.start_ns / 1000.0,
+						 e.dur_ns / 1000.0, pid, r->tid);
+			first = false;
+		}
+	}
+
+	std::fprintf(f, "\n]}\n");
+	return std::fclose(f) == 0;
+}
+
+} // namespace trace
@@ -0,0 +1,318 @@
+#include "validate.hh"
+
+#include <immintrin.h>
+
+// Cells of each winning line, as a 9-bit mask
+static constexpr uint32_t WIN_LINES[8] = {
+	0007, 0070, 0700, // Rows
+	0111, 0222, 0444, // Columns
+	0421, 0124,		  // Diagonals
+};
+static constexpr uint32_t FULL_BOARD = 0777;
+
+// No one can win before the fifth move (ply 4), so win checks start there
+static constexpr int FIRST_WIN_PLY = 4;
+
+const char* verdict_name(Verdict v) {
+	switch (v) {
+	case Verdict::OK:
+		return "ok";
+	case Verdict::ILLEGAL_MOVE:
+		return "illegal move";
+	case Verdict::PLAY_AFTER_END:
+		return "play after end";
+	case Verdict::WRONG_OUTCOME:
+		return "wrong outcome";
+	case Verdict::UNDECIDED:
+		return "undecided";
+	default:
+		return "?";
+	}
+}
+
+const char* kernel_name(ValidateKernel k) {
+	switch (k) {
+	case ValidateKernel::AVX2:
+		return "avx2";
+	case ValidateKernel::SSE41:
+		return "sse4.1";
+	default:
+		return "scalar";
+	}
+}
+
+bool kernel_supported(ValidateKernel k) {
+	switch (k) {
+	case ValidateKernel::AVX2:
+		return __builtin_cpu_supports("avx2");
+	case ValidateKernel::SSE41:
+		return __builtin_cpu_supports("sse4.1");
+	default:
+		return true;
+	}
+}
+
+ValidateKernel best_kernel() {
+	static const ValidateKernel best =
+		kernel_supported(ValidateKernel::AVX2)	  ? ValidateKernel::AVX2
+		: kernel_supported(ValidateKernel::SSE41) ? ValidateKernel::SSE41
+												  : ValidateKernel::SCALAR;
+	return best;
+}
+
+/**
+ * Scalar kernel: one game at a time, on the same bitmask representation
+ */
+static Verdict validate_one(const MatchRow& r) {
+	uint32_t mover[2] = {0, 0};
+	bool won = false;
+
+	for (int k = 0; k < r.move_count; k++) {
+		if (won)
+			return Verdict::PLAY_AFTER_END;
+		// Nine moves without a win fill the board
+		if (k >= 9)
+			return Verdict::ILLEGAL_MOVE;
+
+		uint32_t bit = 1u << move_at(r.moves, k);
+		if (bit & (~FULL_BOARD | mover[0] | mover[1]))
+			return Verdict::ILLEGAL_MOVE;
+		uint32_t& m = mover[k & 1];
+		m |= bit;
+
+		if (k >= FIRST_WIN_PLY) {
+			for (uint32_t line : WIN_LINES)
+				won |= (m & line) == line;
+		}
+	}
+
+	// The winner made the last move: X on odd move counts
+	Outcome expected;
+	if (won)
+		expected = (r.move_count & 1) ? Outcome::X_WIN : Outcome::O_WIN;
+	else if (r.move_count == 9)
+		expected = Outcome::DRAW;
+	else
+		return Verdict::UNDECIDED;
+	return r.outcome == expected ? Verdict::OK : Verdict::WRONG_OUTCOME;
+}
+
+static void validate_scalar(const MatchRow* rows, size_t n, Verdict* out) {
+	for (size_t i = 0; i < n; i++)
+		out[i] = validate_one(rows[i]);
+}
+
+/**
+ * AVX2 kernel: eight games per iteration, one per 32-bit lane. Every lane
+ * steps through the nine plies together; masks keep finished, failed and
+ * shorter games from changing
+ */
+__attribute__((target("avx2"))) static void
+validate_avx2(const MatchRow* rows, size_t n, Verdict* out) {
+	// Gather offsets of each row's fields, in 32-bit words
+	constexpr int STRIDE = sizeof(MatchRow) / 4;
+	static_assert(sizeof(MatchRow) % 4 == 0);
+	constexpr int META = offsetof(MatchRow, outcome) / 4;
+	constexpr int MOVES = offsetof(MatchRow, moves) / 4;
+	const __m256i idx = _mm256_mullo_epi32(
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(STRIDE));
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi32(-1);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i nib = _mm256_set1_epi32(0xF);
+	const __m256i off_board = _mm256_set1_epi32(~FULL_BOARD);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const int* base = reinterpret_cast<const int*>(rows + i);
+		__m256i meta = _mm256_i32gather_epi32(base + META, idx, 4);
+		__m256i lo = _mm256_i32gather_epi32(base + MOVES, idx, 4);
+		__m256i hi = _mm256_i32gather_epi32(base + MOVES + 1, idx, 4);
+		__m256i outcome = _mm256_and_si256(meta, _mm256_set1_epi32(0xFF));
+		__m256i count =
+			_mm256_and_si256(_mm256_srli_epi32(meta, 8), _mm256_set1_epi32(0xFF));
+
+		__m256i mover[2] = {zero, zero};
+		__m256i won = zero, illegal = zero, after_end = zero;
+
+		for (int k = 0; k < 9; k++) {
+			__m256i active = _mm256_cmpgt_epi32(count, _mm256_set1_epi32(k));
+			// Moves recorded after a win
+			after_end = _mm256_or_si256(after_end, _mm256_and_si256(active, won));
+
+			__m256i pos = k < 8 ? _mm256_srli_epi32(lo, 4 * k)
+								: _mm256_srli_epi32(hi, 4 * (k - 8));
+			__m256i bit = _mm256_sllv_epi32(one, _mm256_and_si256(pos, nib));
+
+			// Lanes still replaying: this ply exists, no win or error yet
+			__m256i live = _mm256_andnot_si256(
+				_mm256_or_si256(won, illegal), active);
+			__m256i blocked = _mm256_and_si256(
+				bit, _mm256_or_si256(off_board,
+									 _mm256_or_si256(mover[0], mover[1])));
+			__m256i bad = _mm256_andnot_si256(_mm256_cmpeq_epi32(blocked, zero),
+											  live);
+			illegal = _mm256_or_si256(illegal, bad);
+			live = _mm256_andnot_si256(bad, live);
+
+			__m256i& m = mover[k & 1];
+			m = _mm256_or_si256(m, _mm256_and_si256(bit, live));
+
+			if (k >= FIRST_WIN_PLY) {
+				__m256i win = zero;
+				for (uint32_t line : WIN_LINES) {
+					__m256i l = _mm256_set1_epi32(int(line));
+					win = _mm256_or_si256(
+						win, _mm256_cmpeq_epi32(_mm256_and_si256(m, l), l));
+				}
+				won = _mm256_or_si256(won, _mm256_and_si256(win, live));
+			}
+		}
+
+		// A tenth move is after a win, or on a full board
+		__m256i extra = _mm256_andnot_si256(
+			_mm256_or_si256(illegal, after_end),
+			_mm256_cmpgt_epi32(count, _mm256_set1_epi32(9)));
+		after_end = _mm256_or_si256(after_end, _mm256_and_si256(extra, won));
+		illegal = _mm256_or_si256(illegal, _mm256_andnot_si256(won, extra));
+
+		// Expected outcome: winner by move parity, draw on a full board
+		__m256i odd = _mm256_cmpeq_epi32(_mm256_and_si256(count, one), one);
+		__m256i expected = _mm256_blendv_epi8(
+			_mm256_set1_epi32(int(Outcome::O_WIN)),
+			_mm256_set1_epi32(int(Outcome::X_WIN)), odd);
+		expected = _mm256_blendv_epi8(_mm256_set1_epi32(int(Outcome::DRAW)),
+									  expected, won);
+		__m256i full = _mm256_cmpeq_epi32(count, _mm256_set1_epi32(9));
+		__m256i undecided = _mm256_andnot_si256(_mm256_or_si256(won, full), ones);
+
+		// Lowest-priority verdict first, each later blend overriding it
+		__m256i v = _mm256_andnot_si256(_mm256_cmpeq_epi32(outcome, expected),
+										_mm256_set1_epi32(int(Verdict::WRONG_OUTCOME)));
+		v = _mm256_blendv_epi8(v, _mm256_set1_epi32(int(Verdict::UNDECIDED)),
+							   undecided);
+		v = _mm256_blendv_epi8(
+			v, _mm256_set1_epi32(int(Verdict::PLAY_AFTER_END)), after_end);
+		v = _mm256_blendv_epi8(v, _mm256_set1_epi32(int(Verdict::ILLEGAL_MOVE)),
+							   illegal);
+
+		alignas(32) uint32_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+		for (int j = 0; j < 8; j++)
+			out[i + j] = Verdict(lanes[j]);
+	}
+	validate_scalar(rows + i, n - i, out + i);
+}
+
+/**
+ * SSE4.1 kernel: the AVX2 kernel on four lanes. SSE has no per-lane shift,
+ * so 1 << pos is built as the float 2^pos and converted back
+ */
+__attribute__((target("sse4.1"))) static void
+validate_sse41(const MatchRow* rows, size_t n, Verdict* out) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi32(-1);
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i nib = _mm_set1_epi32(0xF);
+	const __m128i off_board = _mm_set1_epi32(~FULL_BOARD);
+
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const MatchRow* r = rows + i;
+		__m128i outcome = _mm_setr_epi32(int(r[0].outcome), int(r[1].outcome),
+										 int(r[2].outcome), int(r[3].outcome));
+		__m128i count = _mm_setr_epi32(r[0].move_count, r[1].move_count,
+									   r[2].move_count, r[3].move_count);
+		__m128i lo = _mm_setr_epi32(int(r[0].moves), int(r[1].moves),
+									int(r[2].moves), int(r[3].moves));
+		__m128i hi =
+			_mm_setr_epi32(int(r[0].moves >> 32), int(r[1].moves >> 32),
+						   int(r[2].moves >> 32), int(r[3].moves >> 32));
+
+		__m128i mover[2] = {zero, zero};
+		__m128i won = zero, illegal = zero, after_end = zero;
+
+		for (int k = 0; k < 9; k++) {
+			__m128i active = _mm_cmpgt_epi32(count, _mm_set1_epi32(k));
+			after_end = _mm_or_si128(after_end, _mm_and_si128(active, won));
+
+			__m128i pos = k < 8 ? _mm_srli_epi32(lo, 4 * k)
+								: _mm_srli_epi32(hi, 4 * (k - 8));
+			pos = _mm_and_si128(pos, nib);
+			__m128i bit = _mm_cvttps_epi32(_mm_castsi128_ps(
+				_mm_slli_epi32(_mm_add_epi32(pos, _mm_set1_epi32(127)), 23)));
+
+			__m128i live = _mm_andnot_si128(_mm_or_si128(won, illegal), active);
+			__m128i blocked = _mm_and_si128(
+				bit, _mm_or_si128(off_board, _mm_or_si128(mover[0], mover[1])));
+			__m128i bad =
+				_mm_andnot_si128(_mm_cmpeq_epi32(blocked, zero), live);
+			illegal = _mm_or_si128(illegal, bad);
+			live = _mm_andnot_si128(bad, live);
+
+			__m128i& m = mover[k & 1];
+			m = _mm_or_si128(m, _mm_and_si128(bit, live));
+
+			if (k >= FIRST_WIN_PLY) {
+				__m128i win = zero;
+				for (uint32_t line : WIN_LINES) {
+					__m128i l = _mm_set1_epi32(int(line));
+					win = _mm_or_si128(win,
+									   _mm_cmpeq_epi32(_mm_and_si128(m, l), l));
+				}
+				won = _mm_or_si128(won, _mm_and_si128(win, live));
+			}
+		}
+
+		__m128i extra =
+			_mm_andnot_si128(_mm_or_si128(illegal, after_end),
+							 _mm_cmpgt_epi32(count, _mm_set1_epi32(9)));
+		after_end = _mm_or_si128(after_end, _mm_and_si128(extra, won));
+		illegal = _mm_or_si128(illegal, _mm_andnot_si128(won, extra));
+
+		__m128i odd = _mm_cmpeq_epi32(_mm_and_si128(count, one), one);
+		__m128i expected =
+			_mm_blendv_epi8(_mm_set1_epi32(int(Outcome::O_WIN)),
+							_mm_set1_epi32(int(Outcome::X_WIN)), odd);
+		expected =
+			_mm_blendv_epi8(_mm_set1_epi32(int(Outcome::DRAW)), expected, won);
+		__m128i full = _mm_cmpeq_epi32(count, _mm_set1_epi32(9));
+		__m128i undecided = _mm_andnot_si128(_mm_or_si128(won, full), ones);
+
+		__m128i v =
+			_mm_andnot_si128(_mm_cmpeq_epi32(outcome, expected),
+							 _mm_set1_epi32(int(Verdict::WRONG_OUTCOME)));
+		v = _mm_blendv_epi8(v, _mm_set1_epi32(int(Verdict::UNDECIDED)),
+							undecided);
+		v = _mm_blendv_epi8(v, _mm_set1_epi32(int(Verdict::PLAY_AFTER_END)),
+							after_end);
+		v = _mm_blendv_epi8(v, _mm_set1_epi32(int(Verdict::ILLEGAL_MOVE)),
+							illegal);
+
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+		for (int j = 0; j < 4; j++)
+			out[i + j] = Verdict(lanes[j]);
+	}
+	validate_scalar(rows + i, n - i, out + i);
+}
+
+void validate_games(const MatchRow* rows, size_t n, Verdict* out,
+					ValidateKernel kernel) {
+	switch (kernel) {
+	case ValidateKernel::AVX2:
+		validate_avx2(rows, n, out);
+		break;
+	case ValidateKernel::SSE41:
+		validate_sse41(rows, n, out);
+		break;
+	default:
+		validate_scalar(rows, n, out);
+		break;
+	}
+}
+
+void validate_games(const MatchRow* rows, size_t n, Verdict* out) {
+	validate_games(rows, n, out, best_kernel());
+}